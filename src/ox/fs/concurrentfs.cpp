@@ -0,0 +1,172 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "concurrentfs.hpp"
+
+namespace ox {
+
+ConcurrentFileSystem::ConcurrentFileSystem(FileSystem *fs) {
+	m_fs = fs;
+}
+
+ConcurrentFileSystem::~ConcurrentFileSystem() {
+	delete m_fs;
+}
+
+int ConcurrentFileSystem::stripDirectories() {
+	ExclusiveLock lock(&m_lock);
+	return m_fs->stripDirectories();
+}
+
+int ConcurrentFileSystem::mkdir(const char *path) {
+	ExclusiveLock lock(&m_lock);
+	return m_fs->mkdir(path);
+}
+
+int ConcurrentFileSystem::move(const char *src, const char *dest) {
+	ExclusiveLock lock(&m_lock);
+	return m_fs->move(src, dest);
+}
+
+int ConcurrentFileSystem::read(const char *path, void *buffer, size_t buffSize) {
+	SharedLock lock(&m_lock);
+	return m_fs->read(path, buffer, buffSize);
+}
+
+int ConcurrentFileSystem::read(uint64_t inode, void *buffer, size_t size) {
+	SharedLock lock(&m_lock);
+	return m_fs->read(inode, buffer, size);
+}
+
+int ConcurrentFileSystem::read(uint64_t inode, size_t readStart, size_t readSize, void *buffer, size_t *size) {
+	SharedLock lock(&m_lock);
+	return m_fs->read(inode, readStart, readSize, buffer, size);
+}
+
+uint8_t *ConcurrentFileSystem::read(uint64_t inode, size_t *size) {
+	SharedLock lock(&m_lock);
+	return m_fs->read(inode, size);
+}
+
+FileView ConcurrentFileSystem::readView(const char *path) {
+	SharedLock lock(&m_lock);
+	return m_fs->readView(path);
+}
+
+FileView ConcurrentFileSystem::readView(uint64_t inode) {
+	SharedLock lock(&m_lock);
+	return m_fs->readView(inode);
+}
+
+int ConcurrentFileSystem::remove(uint64_t inode, bool recursive) {
+	ExclusiveLock lock(&m_lock);
+	return m_fs->remove(inode, recursive);
+}
+
+int ConcurrentFileSystem::remove(const char *path, bool recursive) {
+	ExclusiveLock lock(&m_lock);
+	return m_fs->remove(path, recursive);
+}
+
+void ConcurrentFileSystem::resize(uint64_t size) {
+	ExclusiveLock lock(&m_lock);
+	m_fs->resize(size);
+}
+
+bool ConcurrentFileSystem::compactStep(uint64_t budget) {
+	ExclusiveLock lock(&m_lock);
+	return m_fs->compactStep(budget);
+}
+
+int ConcurrentFileSystem::write(const char *path, void *buffer, uint64_t size, uint8_t fileType) {
+	ExclusiveLock lock(&m_lock);
+	return m_fs->write(path, buffer, size, fileType);
+}
+
+int ConcurrentFileSystem::write(uint64_t inode, void *buffer, uint64_t size, uint8_t fileType) {
+	ExclusiveLock lock(&m_lock);
+	return m_fs->write(inode, buffer, size, fileType);
+}
+
+FileStat ConcurrentFileSystem::stat(uint64_t inode) {
+	SharedLock lock(&m_lock);
+	return m_fs->stat(inode);
+}
+
+FileStat ConcurrentFileSystem::stat(const char *path) {
+	SharedLock lock(&m_lock);
+	return m_fs->stat(path);
+}
+
+int ConcurrentFileSystem::incLinks(uint64_t inode) {
+	ExclusiveLock lock(&m_lock);
+	return m_fs->incLinks(inode);
+}
+
+int ConcurrentFileSystem::decLinks(uint64_t inode) {
+	ExclusiveLock lock(&m_lock);
+	return m_fs->decLinks(inode);
+}
+
+uint64_t ConcurrentFileSystem::spaceNeeded(uint64_t size) {
+	SharedLock lock(&m_lock);
+	return m_fs->spaceNeeded(size);
+}
+
+uint64_t ConcurrentFileSystem::available() {
+	SharedLock lock(&m_lock);
+	return m_fs->available();
+}
+
+uint64_t ConcurrentFileSystem::size() {
+	SharedLock lock(&m_lock);
+	return m_fs->size();
+}
+
+uint8_t *ConcurrentFileSystem::buff() {
+	return m_fs->buff();
+}
+
+void ConcurrentFileSystem::walk(int(*cb)(const char*, uint64_t, uint64_t)) {
+	SharedLock lock(&m_lock);
+	m_fs->walk(cb);
+}
+
+int ConcurrentFileSystem::upgrade() {
+	ExclusiveLock lock(&m_lock);
+	return m_fs->upgrade();
+}
+
+int ConcurrentFileSystem::sync() {
+	// keeps changes from being written out half made
+	SharedLock lock(&m_lock);
+	return m_fs->sync();
+}
+
+FileSystem *ConcurrentFileSystem::snapshot() {
+	// a snapshot of a mapping only keeps the pages apart from the changes
+	// made after it starts watching them
+	ExclusiveLock lock(&m_lock);
+	return m_fs->snapshot();
+}
+
+bool ConcurrentFileSystem::cheapSnapshots() {
+	return m_fs->cheapSnapshots();
+}
+
+int ConcurrentFileSystem::verify() {
+	SharedLock lock(&m_lock);
+	return m_fs->verify();
+}
+
+int ConcurrentFileSystem::readDirectory(const char *path, Directory<uint64_t, uint64_t> *dirOut) {
+	SharedLock lock(&m_lock);
+	return m_fs->readDirectory(path, dirOut);
+}
+
+}
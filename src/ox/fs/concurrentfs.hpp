@@ -0,0 +1,102 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <ox/std/rwlock.hpp>
+
+#include "filesystem.hpp"
+
+namespace ox {
+
+/**
+ * A FileSystem that can be used from several threads at once. It holds a
+ * reader-writer lock around another FileSystem, so reads run side by side
+ * and changes run alone.
+ *
+ * FileViews and the buffer point into the store and are not covered by the
+ * lock, they are only safe to use while no other thread makes changes.
+ */
+class ConcurrentFileSystem: public FileSystem {
+
+	private:
+		FileSystem *m_fs = nullptr;
+		RwLock m_lock;
+
+	public:
+		/**
+		 * @param fs the FileSystem to guard, which the ConcurrentFileSystem
+		 * takes ownership of
+		 */
+		explicit ConcurrentFileSystem(FileSystem *fs);
+
+		~ConcurrentFileSystem();
+
+		int stripDirectories() override;
+
+		int mkdir(const char *path) override;
+
+		int move(const char *src, const char *dest) override;
+
+		int read(const char *path, void *buffer, size_t buffSize) override;
+
+		int read(uint64_t inode, void *buffer, size_t size) override;
+
+		int read(uint64_t inode, size_t readStart, size_t readSize, void *buffer, size_t *size) override;
+
+		uint8_t *read(uint64_t inode, size_t *size) override;
+
+		FileView readView(const char *path) override;
+
+		FileView readView(uint64_t inode) override;
+
+		int remove(uint64_t inode, bool recursive = false) override;
+
+		int remove(const char *path, bool recursive = false) override;
+
+		void resize(uint64_t size = 0) override;
+
+		bool compactStep(uint64_t budget) override;
+
+		int write(const char *path, void *buffer, uint64_t size, uint8_t fileType = FileType_NormalFile) override;
+
+		int write(uint64_t inode, void *buffer, uint64_t size, uint8_t fileType = FileType_NormalFile) override;
+
+		FileStat stat(uint64_t inode) override;
+
+		FileStat stat(const char *path) override;
+
+		int incLinks(uint64_t inode) override;
+
+		int decLinks(uint64_t inode) override;
+
+		uint64_t spaceNeeded(uint64_t size) override;
+
+		uint64_t available() override;
+
+		uint64_t size() override;
+
+		uint8_t *buff() override;
+
+		void walk(int(*cb)(const char*, uint64_t, uint64_t)) override;
+
+		int upgrade() override;
+
+		int sync() override;
+
+		FileSystem *snapshot() override;
+
+		bool cheapSnapshots() override;
+
+		int verify() override;
+
+	protected:
+		int readDirectory(const char *path, Directory<uint64_t, uint64_t> *dirOut) override;
+};
+
+}
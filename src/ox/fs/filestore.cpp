@@ -0,0 +1,61 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <ox/std/rwlock.hpp>
+
+#include "filestore.hpp"
+
+namespace ox {
+
+FileStoreWatcher *fileStoreWatchers = nullptr;
+
+// held shared while watchers are told of a change, and exclusively while the
+// list changes, so that a watcher is never told of a change after it is
+// removed
+static RwLock watchersLock;
+
+void watchFileStore(FileStoreWatcher *watcher) {
+	ExclusiveLock lock(&watchersLock);
+	watcher->next = fileStoreWatchers;
+	__atomic_store_n(&fileStoreWatchers, watcher, __ATOMIC_RELEASE);
+}
+
+void unwatchFileStore(FileStoreWatcher *watcher) {
+	ExclusiveLock lock(&watchersLock);
+	for (auto w = &fileStoreWatchers; *w; w = &(*w)->next) {
+		if (*w == watcher) {
+			__atomic_store_n(w, watcher->next, __ATOMIC_RELEASE);
+			watcher->next = nullptr;
+			return;
+		}
+	}
+}
+
+void unwatchFileStore(const uint8_t *buffer) {
+	ExclusiveLock lock(&watchersLock);
+	for (auto w = &fileStoreWatchers; *w;) {
+		auto watcher = *w;
+		if (watcher->buffer == buffer) {
+			__atomic_store_n(w, watcher->next, __ATOMIC_RELEASE);
+			watcher->next = nullptr;
+		} else {
+			w = &watcher->next;
+		}
+	}
+}
+
+void fileStoreChanging(const uint8_t *buffer, uint64_t start, uint64_t end) {
+	SharedLock lock(&watchersLock);
+	for (auto w = fileStoreWatchers; w; w = w->next) {
+		if (w->buffer == buffer) {
+			w->beforeChange(start, end);
+		}
+	}
+}
+
+}
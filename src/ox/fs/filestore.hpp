@@ -12,12 +12,79 @@
 
 namespace ox {
 
+/**
+ * Is told before each change a FileStore makes to the buffer it watches, so
+ * that it can keep what the buffer held. Changes made to the buffer other than
+ * through a FileStore are not seen.
+ */
+class FileStoreWatcher {
+
+	public:
+		// the buffer of the FileStore watched
+		const uint8_t *buffer = nullptr;
+		// the next watcher of any buffer
+		FileStoreWatcher *next = nullptr;
+
+		virtual ~FileStoreWatcher() {};
+
+		/**
+		 * Called before the bytes of the buffer from start up to end change.
+		 */
+		virtual void beforeChange(uint64_t start, uint64_t end) = 0;
+};
+
+// the watchers of every buffer
+extern FileStoreWatcher *fileStoreWatchers;
+
+/**
+ * Starts telling the given watcher of the changes to its buffer.
+ */
+void watchFileStore(FileStoreWatcher *watcher);
+
+/**
+ * Stops telling the given watcher of changes, once no change is being told to
+ * it. It does nothing if the watcher is not watching.
+ */
+void unwatchFileStore(FileStoreWatcher *watcher);
+
+/**
+ * Stops telling the watchers of the given buffer of its changes.
+ */
+void unwatchFileStore(const uint8_t *buffer);
+
+/**
+ * Tells the watchers of the given buffer that the bytes from start up to end
+ * are about to change.
+ */
+void fileStoreChanging(const uint8_t *buffer, uint64_t start, uint64_t end);
+
 template<typename FsT, typename InodeId>
 struct __attribute__((packed)) FileStoreHeader {
 	public:
 		typedef InodeId InodeId_t;
 		typedef FsT FsSize_t;
-		const static auto VERSION = 7;
+		const static auto VERSION = 24;
+		const static auto SIZE_CLASSES = sizeof(FsSize_t) * 8;
+		// the most ranges of changed bytes that are kept apart, past which
+		// the closest are merged
+		const static auto DIRTY_RANGES = 32;
+		// files at least this large are compressed if that makes them smaller
+		const static auto COMPRESS_MIN = 256;
+		// files are compressed in blocks of this many bytes, so that part of
+		// a file can be read without decompressing the rest
+		const static auto COMPRESS_BLOCK = 4096;
+		// files at least this large share their data with identical files
+		// when dedup is on
+		const static auto DEDUP_MIN = 64;
+		// files no larger than this are kept in slabs when slabs are on
+		const static auto SLAB_MAX = 48;
+		// each slab holds the files of 2^SLAB_SHIFT consecutive ids
+		const static auto SLAB_SHIFT = 6;
+		// the data of Inodes is aligned to this many bytes from the start of
+		// the buffer when FileStoreOption_Aligned is set
+		const static auto PAYLOAD_ALIGN = 16;
+		// the number of lists the type index spreads the file types over
+		const static auto TYPE_LISTS = 32;
 
 	private:
 		uint16_t m_version;
@@ -25,6 +92,28 @@ struct __attribute__((packed)) FileStoreHeader {
 		FsSize_t m_size;
 		FsSize_t m_memUsed;
 		FsSize_t m_rootInode;
+		// heads of the free block lists, indexed by the floor(log2) of the size
+		// of the free blocks in them
+		FsSize_t m_freeLists[SIZE_CLASSES];
+		// the Inode up to the end of which there are no gaps
+		FsSize_t m_compactCursor;
+		// the root of the tree of blobs, by content hash
+		FsSize_t m_blobRoot;
+		// the root of the tree of slabs, by the ids they hold
+		FsSize_t m_slabRoot;
+		// heads of the type index's lists of files, indexed by file type
+		// modulo TYPE_LISTS
+		FsSize_t m_typeLists[TYPE_LISTS];
+		// FileStoreOptions
+		uint16_t m_options;
+		// incremented by every compaction that moves inodes, which leaves
+		// copies of them behind that stale addresses would still find
+		uint32_t m_moves;
+		// the number of ranges in m_dirty
+		uint16_t m_dirtyCount;
+		// the [start, end) ranges of the buffer that changed since the last
+		// flush, in order and apart from each other
+		FsSize_t m_dirty[DIRTY_RANGES][2];
 
 	public:
 		void setVersion(uint16_t);
@@ -41,10 +130,75 @@ struct __attribute__((packed)) FileStoreHeader {
 
 		void setRootInode(FsSize_t);
 		FsSize_t getRootInode();
+
+		void setFreeList(int sizeClass, FsSize_t);
+		FsSize_t getFreeList(int sizeClass);
+
+		void setCompactCursor(FsSize_t);
+		FsSize_t getCompactCursor();
+
+		void setBlobRoot(FsSize_t);
+		FsSize_t getBlobRoot();
+
+		void setSlabRoot(FsSize_t);
+		FsSize_t getSlabRoot();
+
+		void setTypeList(int list, FsSize_t);
+		FsSize_t getTypeList(int list);
+
+		void setOptions(uint16_t);
+		uint16_t getOptions();
+
+		void setMoves(uint32_t);
+		uint32_t getMoves();
+
+		/**
+		 * Records that the bytes from start up to end are changing. The
+		 * watchers of the buffer are told before the bytes change, so this
+		 * must be called first.
+		 */
+		void markDirty(FsSize_t start, FsSize_t end);
+
+		int dirtyCount();
+
+		FsSize_t dirtyStart(int range);
+
+		FsSize_t dirtyEnd(int range);
+
+		void clearDirty();
+
+		/**
+		 * Returns the offset from the start of the header of the record of
+		 * the dirty ranges.
+		 */
+		FsSize_t dirtyRecordOffset();
+
+		/**
+		 * Returns the length of the record of the given number of dirty
+		 * ranges.
+		 */
+		FsSize_t dirtyRecordLen(int count);
+
+	private:
+		void setDirtyCount(int count);
+
+		void setDirty(int range, FsSize_t start, FsSize_t end);
+
+		/**
+		 * Records that the given field of the header is changing.
+		 */
+		void markField(const void *field, FsSize_t len);
+
+		/**
+		 * Tells the watchers of the buffer that the record of the dirty
+		 * ranges is changing.
+		 */
+		void recordChanging();
 };
 
 template<typename FsSize_t, typename InodeId_t>
 void FileStoreHeader<FsSize_t, InodeId_t>::setVersion(uint16_t version) {
+	markField(&m_version, sizeof(m_version));
 	m_version = bigEndianAdapt(version);
 }
 
@@ -55,6 +209,7 @@ uint16_t FileStoreHeader<FsSize_t, InodeId_t>::getVersion() {
 
 template<typename FsSize_t, typename InodeId_t>
 void FileStoreHeader<FsSize_t, InodeId_t>::setFsType(uint16_t fsType) {
+	markField(&m_fsType, sizeof(m_fsType));
 	m_fsType = bigEndianAdapt(fsType);
 }
 
@@ -65,6 +220,7 @@ uint16_t FileStoreHeader<FsSize_t, InodeId_t>::getFsType() {
 
 template<typename FsSize_t, typename InodeId_t>
 void FileStoreHeader<FsSize_t, InodeId_t>::setSize(FsSize_t size) {
+	markField(&m_size, sizeof(m_size));
 	m_size = bigEndianAdapt(size);
 }
 
@@ -75,6 +231,7 @@ FsSize_t FileStoreHeader<FsSize_t, InodeId_t>::getSize() {
 
 template<typename FsSize_t, typename InodeId_t>
 void FileStoreHeader<FsSize_t, InodeId_t>::setMemUsed(FsSize_t memUsed) {
+	markField(&m_memUsed, sizeof(m_memUsed));
 	m_memUsed = bigEndianAdapt(memUsed);
 }
 
@@ -85,6 +242,7 @@ FsSize_t FileStoreHeader<FsSize_t, InodeId_t>::getMemUsed() {
 
 template<typename FsSize_t, typename InodeId_t>
 void FileStoreHeader<FsSize_t, InodeId_t>::setRootInode(FsSize_t rootInode) {
+	markField(&m_rootInode, sizeof(m_rootInode));
 	m_rootInode = bigEndianAdapt(rootInode);
 }
 
@@ -93,6 +251,257 @@ FsSize_t FileStoreHeader<FsSize_t, InodeId_t>::getRootInode() {
 	return bigEndianAdapt(m_rootInode);
 }
 
+template<typename FsSize_t, typename InodeId_t>
+void FileStoreHeader<FsSize_t, InodeId_t>::setFreeList(int sizeClass, FsSize_t freeList) {
+	markField(&m_freeLists[sizeClass], sizeof(m_freeLists[sizeClass]));
+	m_freeLists[sizeClass] = bigEndianAdapt(freeList);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+FsSize_t FileStoreHeader<FsSize_t, InodeId_t>::getFreeList(int sizeClass) {
+	return bigEndianAdapt(m_freeLists[sizeClass]);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+void FileStoreHeader<FsSize_t, InodeId_t>::setCompactCursor(FsSize_t compactCursor) {
+	markField(&m_compactCursor, sizeof(m_compactCursor));
+	m_compactCursor = bigEndianAdapt(compactCursor);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+FsSize_t FileStoreHeader<FsSize_t, InodeId_t>::getCompactCursor() {
+	return bigEndianAdapt(m_compactCursor);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+void FileStoreHeader<FsSize_t, InodeId_t>::setBlobRoot(FsSize_t blobRoot) {
+	markField(&m_blobRoot, sizeof(m_blobRoot));
+	m_blobRoot = bigEndianAdapt(blobRoot);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+FsSize_t FileStoreHeader<FsSize_t, InodeId_t>::getBlobRoot() {
+	return bigEndianAdapt(m_blobRoot);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+void FileStoreHeader<FsSize_t, InodeId_t>::setSlabRoot(FsSize_t slabRoot) {
+	markField(&m_slabRoot, sizeof(m_slabRoot));
+	m_slabRoot = bigEndianAdapt(slabRoot);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+FsSize_t FileStoreHeader<FsSize_t, InodeId_t>::getSlabRoot() {
+	return bigEndianAdapt(m_slabRoot);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+void FileStoreHeader<FsSize_t, InodeId_t>::setTypeList(int list, FsSize_t typeList) {
+	markField(&m_typeLists[list], sizeof(m_typeLists[list]));
+	m_typeLists[list] = bigEndianAdapt(typeList);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+FsSize_t FileStoreHeader<FsSize_t, InodeId_t>::getTypeList(int list) {
+	return bigEndianAdapt(m_typeLists[list]);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+void FileStoreHeader<FsSize_t, InodeId_t>::setOptions(uint16_t options) {
+	markField(&m_options, sizeof(m_options));
+	m_options = bigEndianAdapt(options);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+uint16_t FileStoreHeader<FsSize_t, InodeId_t>::getOptions() {
+	return bigEndianAdapt(m_options);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+void FileStoreHeader<FsSize_t, InodeId_t>::setMoves(uint32_t moves) {
+	markField(&m_moves, sizeof(m_moves));
+	m_moves = bigEndianAdapt(moves);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+uint32_t FileStoreHeader<FsSize_t, InodeId_t>::getMoves() {
+	return bigEndianAdapt(m_moves);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+void FileStoreHeader<FsSize_t, InodeId_t>::markDirty(FsSize_t start, FsSize_t end) {
+	if (end > getSize()) {
+		end = getSize();
+	}
+	if (start >= end) {
+		return;
+	}
+	if (__atomic_load_n(&fileStoreWatchers, __ATOMIC_ACQUIRE)) {
+		fileStoreChanging((uint8_t*) this, start, end);
+		recordChanging();
+	}
+
+	// find the first range that does not end before start
+	int count = dirtyCount();
+	int i = 0;
+	while (i < count && dirtyEnd(i) < start) {
+		i++;
+	}
+
+	if (i < count && dirtyStart(i) <= end) {
+		// it meets the range, which takes in any others that it now meets
+		start = start < dirtyStart(i) ? start : dirtyStart(i);
+		int next = i + 1;
+		for (; next < count && dirtyStart(next) <= end; next++) {
+			end = end > dirtyEnd(next) ? end : dirtyEnd(next);
+		}
+		end = end > dirtyEnd(i) ? end : dirtyEnd(i);
+		setDirty(i, start, end);
+		if (next > i + 1) {
+			// the entries past the count are kept zeroed, as they are not
+			// flushed
+			ox_memmove(m_dirty[i + 1], m_dirty[next], (count - next) * sizeof(m_dirty[0]));
+			ox_memset(m_dirty[count - (next - i - 1)], 0, (next - i - 1) * sizeof(m_dirty[0]));
+			setDirtyCount(count - (next - i - 1));
+		}
+		return;
+	}
+
+	if (count == DIRTY_RANGES) {
+		// merge the two closest ranges, counting the new one as being at i
+		auto rangeStart = [&](int r) {
+			return r < i ? dirtyStart(r) : r == i ? start : dirtyStart(r - 1);
+		};
+		auto rangeEnd = [&](int r) {
+			return r < i ? dirtyEnd(r) : r == i ? end : dirtyEnd(r - 1);
+		};
+		int closest = 0;
+		for (int r = 1; r < count; r++) {
+			if (rangeStart(r + 1) - rangeEnd(r) < rangeStart(closest + 1) - rangeEnd(closest)) {
+				closest = r;
+			}
+		}
+		if (closest == i - 1) {
+			setDirty(i - 1, dirtyStart(i - 1), end);
+			return;
+		} else if (closest == i) {
+			setDirty(i, start, dirtyEnd(i));
+			return;
+		}
+		const auto r = closest < i ? closest : closest - 1;
+		setDirty(r, dirtyStart(r), dirtyEnd(r + 1));
+		ox_memmove(m_dirty[r + 1], m_dirty[r + 2], (count - r - 2) * sizeof(m_dirty[0]));
+		count--;
+		if (r < i) {
+			i--;
+		}
+	}
+
+	ox_memmove(m_dirty[i + 1], m_dirty[i], (count - i) * sizeof(m_dirty[0]));
+	setDirty(i, start, end);
+	setDirtyCount(count + 1);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+int FileStoreHeader<FsSize_t, InodeId_t>::dirtyCount() {
+	return bigEndianAdapt(m_dirtyCount);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+FsSize_t FileStoreHeader<FsSize_t, InodeId_t>::dirtyStart(int range) {
+	return bigEndianAdapt(m_dirty[range][0]);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+FsSize_t FileStoreHeader<FsSize_t, InodeId_t>::dirtyEnd(int range) {
+	return bigEndianAdapt(m_dirty[range][1]);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+void FileStoreHeader<FsSize_t, InodeId_t>::clearDirty() {
+	if (__atomic_load_n(&fileStoreWatchers, __ATOMIC_ACQUIRE)) {
+		recordChanging();
+	}
+	ox_memset(m_dirty, 0, dirtyCount() * sizeof(m_dirty[0]));
+	setDirtyCount(0);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+FsSize_t FileStoreHeader<FsSize_t, InodeId_t>::dirtyRecordOffset() {
+	return (uint8_t*) &m_dirtyCount - (uint8_t*) this;
+}
+
+template<typename FsSize_t, typename InodeId_t>
+FsSize_t FileStoreHeader<FsSize_t, InodeId_t>::dirtyRecordLen(int count) {
+	return sizeof(m_dirtyCount) + count * sizeof(m_dirty[0]);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+void FileStoreHeader<FsSize_t, InodeId_t>::setDirtyCount(int count) {
+	m_dirtyCount = bigEndianAdapt((uint16_t) count);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+void FileStoreHeader<FsSize_t, InodeId_t>::setDirty(int range, FsSize_t start, FsSize_t end) {
+	m_dirty[range][0] = bigEndianAdapt(start);
+	m_dirty[range][1] = bigEndianAdapt(end);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+void FileStoreHeader<FsSize_t, InodeId_t>::markField(const void *field, FsSize_t len) {
+	const FsSize_t start = (const uint8_t*) field - (const uint8_t*) this;
+	markDirty(start, start + len);
+}
+
+template<typename FsSize_t, typename InodeId_t>
+void FileStoreHeader<FsSize_t, InodeId_t>::recordChanging() {
+	const auto start = dirtyRecordOffset();
+	fileStoreChanging((uint8_t*) this, start, start + dirtyRecordLen(DIRTY_RANGES));
+}
+
+enum InodeFlag {
+	// the Inode's data is a list of Extents, which point to the chunks that
+	// hold the file's data
+	InodeFlag_Extents = 1,
+	// the Inode holds part of the data of the file of the same id, it is not
+	// in the tree
+	InodeFlag_Chunk = 2,
+	// the Inode's checksum holds the CRC32C of its data
+	InodeFlag_Checksum = 4,
+	// the Inode's data is the file's data compressed, laid out as a
+	// FileStore::Compressed
+	InodeFlag_Compressed = 8,
+	// the Inode's data is a FileStore::ContentHash naming the blob that holds
+	// the file's data
+	InodeFlag_Shared = 16,
+	// the Inode holds data shared by files of identical contents, as a
+	// FileStore::ContentHash followed by the data, it is in the tree of blobs
+	// rather than the tree of files, and its links count the files
+	InodeFlag_Blob = 32,
+	// the Inode holds the small files of a run of ids, laid out as a
+	// FileStore::SlabHeader, it is in the tree of slabs rather than the tree
+	// of files, and its id is the first id of the run shifted down by
+	// SLAB_SHIFT
+	InodeFlag_Slab = 64,
+	// the Inode is a file's, and its data is followed by the
+	// FileStore::TypeLinks of the type index
+	InodeFlag_TypeLinks = 256,
+};
+
+enum FileStoreOption {
+	// files written with the same contents share one copy of them
+	FileStoreOption_Dedup = 1,
+	// small files share slabs rather than each having an Inode
+	FileStoreOption_Slabs = 2,
+	// Inodes are placed and padded so that their data is aligned to
+	// PAYLOAD_ALIGN bytes, it can only be set by format
+	FileStoreOption_Aligned = 8,
+	// files are kept in lists by file type
+	FileStoreOption_TypeIndex = 16,
+	// files are compressed when that saves enough space
+	FileStoreOption_Compress = 32,
+};
+
 template<typename Header>
 class FileStore {
 
@@ -100,6 +509,14 @@ class FileStore {
 		typedef typename Header::InodeId_t InodeId_t;
 		typedef typename Header::FsSize_t FsSize_t;
 		const static auto VERSION = Header::VERSION;
+		const static auto DIRTY_RANGES = Header::DIRTY_RANGES;
+		const static auto COMPRESS_MIN = Header::COMPRESS_MIN;
+		const static auto COMPRESS_BLOCK = Header::COMPRESS_BLOCK;
+		const static auto DEDUP_MIN = Header::DEDUP_MIN;
+		const static auto SLAB_MAX = Header::SLAB_MAX;
+		const static auto SLAB_IDS = 1 << Header::SLAB_SHIFT;
+		const static auto PAYLOAD_ALIGN = Header::PAYLOAD_ALIGN;
+		const static auto TYPE_LISTS = Header::TYPE_LISTS;
 
 		struct StatInfo {
 			InodeId_t inodeId;
@@ -108,6 +525,24 @@ class FileStore {
 			uint8_t fileType;
 		};
 
+		/**
+		 * A "file" to be written by a batch write.
+		 */
+		struct BatchEntry {
+			InodeId_t id;
+			void *data;
+			typename Header::FsSize_t dataLen;
+			uint8_t fileType;
+		};
+
+		/**
+		 * The data of a "file" where it sits in the file store's buffer.
+		 */
+		struct View {
+			uint8_t *data;
+			typename Header::FsSize_t size;
+		};
+
 	private:
 		struct __attribute__((packed)) Inode {
 			private:
@@ -119,6 +554,8 @@ class FileStore {
 				InodeId_t m_id;
 				InodeId_t m_links;
 				uint8_t m_fileType;
+				uint16_t m_flags;
+				uint32_t m_checksum;
 				typename Header::FsSize_t m_left;
 				typename Header::FsSize_t m_right;
 
@@ -143,6 +580,23 @@ class FileStore {
 				void setFileType(uint8_t);
 				uint8_t getFileType();
 
+				void setFlags(uint16_t);
+				uint16_t getFlags();
+
+				void setChecksum(uint32_t);
+				uint32_t getChecksum();
+
+				/**
+				 * Sets the checksum to that of the Inode's data.
+				 */
+				void updateChecksum();
+
+				/**
+				 * Returns false if the Inode has a checksum that does not
+				 * match its data.
+				 */
+				bool checksumValid();
+
 				void setLeft(typename Header::FsSize_t);
 				typename Header::FsSize_t getLeft();
 
@@ -153,77 +607,334 @@ class FileStore {
 				uint8_t *getData();
 		};
 
-		Header m_header;
-
-	public:
 		/**
-		 * Dumps this file store's inodes to the given file store.
+		 * An entry in the data of an InodeFlag_Extents Inode.
 		 */
-		int dumpTo(FileStore<Header> *dest);
+		struct __attribute__((packed)) Extent {
+			private:
+				// the chunk Inode holding this part of the file
+				typename Header::FsSize_t m_chunk;
+
+			public:
+				void setChunk(typename Header::FsSize_t);
+				typename Header::FsSize_t getChunk();
+		};
 
 		/**
-		 * Compacts and resizes the file store to the minimum possible size for
-		 * the contents.
-		 *
-		 * NOTE: This does NOT resize the buffer that this file store refers to!
+		 * The start of the data of an InodeFlag_Compressed Inode. It is
+		 * followed by a CompressedBlock for each COMPRESS_BLOCK bytes of the
+		 * file, then by the blocks themselves. Each block is an LZ4 block,
+		 * unless it would not have been smaller than the part of the file it
+		 * holds, in which case it is that part as is.
 		 */
-		void resize(typename Header::FsSize_t size = 0);
+		struct __attribute__((packed)) Compressed {
+			private:
+				// the size of the file
+				typename Header::FsSize_t m_size;
+
+			public:
+				void setSize(typename Header::FsSize_t);
+				typename Header::FsSize_t getSize();
+		};
 
 		/**
-		 * Writes the given data to a "file" with the given id.
-		 * @param id the id of the file
-		 * @param data the contents of the file
-		 * @param dataLen the number of bytes data points to
+		 * The neighbours of a file in its type index list, which follow the
+		 * data of its Inode when it has InodeFlag_TypeLinks, so that files
+		 * only pay for them when the type index is on.
 		 */
-		int write(InodeId_t id, void *data, typename Header::FsSize_t dataLen, uint8_t fileType = 0);
+		struct __attribute__((packed)) TypeLinks {
+			private:
+				typename Header::FsSize_t m_prev;
+				typename Header::FsSize_t m_next;
+
+			public:
+				void setPrev(typename Header::FsSize_t);
+				typename Header::FsSize_t getPrev();
+
+				void setNext(typename Header::FsSize_t);
+				typename Header::FsSize_t getNext();
+		};
+
+		struct __attribute__((packed)) CompressedBlock {
+			private:
+				// where the block ends, from the end of the CompressedBlocks
+				typename Header::FsSize_t m_end;
+
+			public:
+				void setEnd(typename Header::FsSize_t);
+				typename Header::FsSize_t getEnd();
+		};
 
 		/**
-		 * Removes the inode of the given ID.
-		 * @param id the id of the file
+		 * The data of an InodeFlag_Shared Inode, and the start of the data
+		 * of an InodeFlag_Blob Inode.
 		 */
-		int remove(InodeId_t id);
+		struct __attribute__((packed)) ContentHash {
+			private:
+				// the XXH64 of the shared data
+				uint64_t m_hash;
+
+			public:
+				void setHash(uint64_t);
+				uint64_t getHash();
+		};
 
 		/**
-		 * Increments the links of the inode of the given ID.
-		 * @param id the id of the inode
+		 * The start of the data of an InodeFlag_Slab Inode. It is followed
+		 * by a SlabOffset for each file in the slab, in id order, then by a
+		 * SlabEntry for each file, each followed by the file's data.
 		 */
-		int incLinks(InodeId_t id);
+		struct __attribute__((packed)) SlabHeader {
+			private:
+				// one bit per id of the slab, set for the ids that have files
+				uint64_t m_present;
+
+			public:
+				void setPresent(uint64_t);
+				uint64_t getPresent();
+		};
+
+		struct __attribute__((packed)) SlabOffset {
+			private:
+				// where the file's SlabEntry is, from the end of the
+				// SlabOffsets
+				uint16_t m_offset;
+
+			public:
+				void setOffset(uint16_t);
+				uint16_t getOffset();
+		};
+
+		struct __attribute__((packed)) SlabEntry {
+			private:
+				InodeId_t m_links;
+				uint8_t m_fileType;
+				uint8_t m_dataLen;
+
+			public:
+				void setLinks(InodeId_t);
+				InodeId_t getLinks();
+
+				void setFileType(uint8_t);
+				uint8_t getFileType();
+
+				void setDataLen(uint8_t);
+				uint8_t getDataLen();
+
+				uint8_t *getData();
+		};
 
 		/**
-		 * Decrements the links of the inode of the given ID.
-		 * @param id the id of the inode
+		 * A file in a slab, read out of its SlabEntry.
 		 */
-		int decLinks(InodeId_t id);
+		struct SmallFile {
+			InodeId_t links = 0;
+			uint8_t fileType = 0;
+			uint8_t dataLen = 0;
+			// where the file's data is in the slab, or null if there is no
+			// such file
+			uint8_t *data = nullptr;
+		};
 
 		/**
-		 * Removes all inodes of the type.
-		 * @param fileType the type of file to remove
+		 * The Inode layout of format version 7, which had no m_flags.
 		 */
-		int removeAllType(uint8_t fileType);
+		struct __attribute__((packed)) InodeV7 {
+			typename Header::FsSize_t prev;
+			typename Header::FsSize_t next;
+			typename Header::FsSize_t dataLen;
+			InodeId_t id;
+			InodeId_t links;
+			uint8_t fileType;
+			typename Header::FsSize_t left;
+			typename Header::FsSize_t right;
+		};
 
 		/**
-		 * Reads the "file" at the given id. You are responsible for freeing
-		 * the data when done with it.
-		 * @param id id of the "file"
-		 * @param data pointer to the pointer where the data is stored
-		 * @param size pointer to a value that will be assigned the size of data
-		 * @return 0 if read is a success
+		 * Sits at the start of every gap between two inodes that is large
+		 * enough to hold it, linking the gap into the free list of its size
+		 * class.
 		 */
-		int read(InodeId_t id, void *data, typename Header::FsSize_t *size);
+		struct __attribute__((packed)) FreeBlock {
+			private:
+				// the size of the gap
+				typename Header::FsSize_t m_size;
+				// the Inode that the gap follows
+				typename Header::FsSize_t m_inode;
+				typename Header::FsSize_t m_prev;
+				typename Header::FsSize_t m_next;
 
-		/**
-		 * Reads the "file" at the given id. You are responsible for freeing
-		 * the data when done with it.
-		 * @param id id of the "file"
+			public:
+				void setSize(typename Header::FsSize_t);
+				typename Header::FsSize_t getSize();
+
+				void setInode(typename Header::FsSize_t);
+				typename Header::FsSize_t getInode();
+
+				void setPrev(typename Header::FsSize_t);
+				typename Header::FsSize_t getPrev();
+
+				void setNext(typename Header::FsSize_t);
+				typename Header::FsSize_t getNext();
+		};
+
+		Header m_header;
+
+	public:
+		/**
+		 * Dumps this file store's inodes to the given file store, which takes
+		 * on this file store's options.
+		 */
+		int dumpTo(FileStore<Header> *dest);
+
+		/**
+		 * Compacts and resizes the file store to the minimum possible size for
+		 * the contents.
+		 *
+		 * NOTE: This does NOT resize the buffer that this file store refers to!
+		 */
+		void resize(typename Header::FsSize_t size = 0);
+
+		/**
+		 * Compacts all of the inodes into a contiguous space, starting at the
+		 * first inode. Unlike compactStep, this fixes up the tree in one pass
+		 * over the inodes rather than searching the tree for each moved inode.
+		 */
+		void compact();
+
+		/**
+		 * Runs part of a compaction, moving inodes down into the gaps before
+		 * them until at least budget bytes have been moved or there is nothing
+		 * left to move. The file store is fully usable between steps.
+		 * @param budget the number of bytes to move before returning
+		 * @return true if the file store is now fully compacted
+		 */
+		bool compactStep(typename Header::FsSize_t budget);
+
+		/**
+		 * Writes the given data to a "file" with the given id. With
+		 * compression on, data of at least COMPRESS_MIN bytes that does not
+		 * fit where the file already is is stored compressed if that saves
+		 * enough space to be worth decompressing it on read. With dedup on,
+		 * data of at least DEDUP_MIN bytes is shared with the files that have
+		 * the same contents instead.
+		 * @param id the id of the file
+		 * @param data the contents of the file
+		 * @param dataLen the number of bytes data points to
+		 */
+		int write(InodeId_t id, void *data, typename Header::FsSize_t dataLen, uint8_t fileType = 0);
+
+		/**
+		 * Writes the given data into the existing "file" of the given id at the
+		 * given offset, growing the file if the data runs past its end. Only
+		 * the written bytes are copied unless the file has to move to grow.
+		 * A compressed file is decompressed first, and a shared file gets a
+		 * copy of its own, and either stays that way.
+		 * @param id the id of the file
+		 * @param offset where in the file to write the data
+		 * @param data the data to write
+		 * @param dataLen the number of bytes data points to
+		 * @return 0 if the write is a success
+		 */
+		int write(InodeId_t id, typename Header::FsSize_t offset, void *data, typename Header::FsSize_t dataLen);
+
+		/**
+		 * Appends the given data to the existing "file" of the given id.
+		 * @param id the id of the file
+		 * @param data the data to append
+		 * @param dataLen the number of bytes data points to
+		 * @return 0 if the append is a success
+		 */
+		int append(InodeId_t id, void *data, typename Header::FsSize_t dataLen);
+
+		/**
+		 * Writes several "files" at once, as if by write for each entry in
+		 * order, but with one space check, at most one compaction, and the new
+		 * inodes laid out next to each other.
+		 * @param entries the files to write
+		 * @param count the number of entries
+		 * @return 0 if every write is a success
+		 */
+		int write(BatchEntry *entries, size_t count);
+
+		/**
+		 * Removes the inode of the given ID.
+		 * @param id the id of the file
+		 */
+		int remove(InodeId_t id);
+
+		/**
+		 * Increments the links of the inode of the given ID.
+		 * @param id the id of the inode
+		 * @param hint the address of the inode, if known, as from find
+		 */
+		int incLinks(InodeId_t id, typename Header::FsSize_t hint = 0);
+
+		/**
+		 * Decrements the links of the inode of the given ID.
+		 * @param id the id of the inode
+		 * @param hint the address of the inode, if known, as from find
+		 */
+		int decLinks(InodeId_t id, typename Header::FsSize_t hint = 0);
+
+		/**
+		 * Removes all inodes of the type.
+		 * @param fileType the type of file to remove
+		 */
+		int removeAllType(uint8_t fileType);
+
+		/**
+		 * Removes every file the predicate picks. The files are taken out of
+		 * the index in one pass over it, rather than one lookup each, which
+		 * makes clearing out large numbers of files cheap.
+		 * @param predicate called with the StatInfo of each file, returns
+		 * true if the file is to be removed
+		 * @return 0 if all picked files were removed
+		 */
+		template<typename Predicate>
+		int removeIf(Predicate predicate);
+
+		/**
+		 * Calls the callback with the StatInfo of each file of the type,
+		 * until it returns non-zero. With the type index on, this only visits
+		 * the files of types that share the type's list, and the slabs,
+		 * otherwise it visits every inode. The callback must not change the
+		 * file store.
+		 * @param fileType the type of file to visit
+		 * @param cb called with the StatInfo of each file of the type
+		 * @return the last value returned by the callback
+		 */
+		template<typename Callback>
+		int forEachOfType(uint8_t fileType, Callback cb);
+
+		/**
+		 * Reads the "file" at the given id, after checking it against its
+		 * checksums. You are responsible for freeing the data when done with
+		 * it.
+		 * @param id id of the "file"
+		 * @param data pointer to the pointer where the data is stored
+		 * @param size pointer to a value that will be assigned the size of data
+		 * @param hint the address of the inode, if known, as from find
+		 * @return 0 if read is a success, 2 if the data does not match its
+		 * checksums
+		 */
+		int read(InodeId_t id, void *data, typename Header::FsSize_t *size, typename Header::FsSize_t hint = 0);
+
+		/**
+		 * Reads the "file" at the given id. You are responsible for freeing
+		 * the data when done with it.
+		 * @param id id of the "file"
 		 * @param readStart where in the data to start reading
 		 * @param readSize how much data to read
 		 * @param data pointer to the pointer where the data is stored
 		 * @param size pointer to a value that will be assigned the size of data
-		 * @return 0 if read is a success
+		 * @param hint the address of the inode, if known, as from find
+		 * @return 0 if read is a success, 2 if the file is compressed and its
+		 * data does not decompress
 		 */
 		int read(InodeId_t id, typename Header::FsSize_t readStart,
 		         typename Header::FsSize_t readSize, void *data,
-		         typename Header::FsSize_t *size);
+		         typename Header::FsSize_t *size, typename Header::FsSize_t hint = 0);
 
 		/**
 		 * Reads the "file" at the given id. You are responsible for freeing
@@ -233,20 +944,138 @@ class FileStore {
 		 * @param readSize how much data to read
 		 * @param data pointer to the pointer where the data is stored
 		 * @param size pointer to a value that will be assigned the size of data
-		 * @return 0 if read is a success
+		 * @return 0 if read is a success, 2 if the file is compressed and its
+		 * data does not decompress
 		 */
 		template<typename T>
 		int read(InodeId_t id, typename Header::FsSize_t readStart,
 		         typename Header::FsSize_t readSize, T *data,
 		         typename Header::FsSize_t *size);
 
+		/**
+		 * Returns a view of the "file" at the given id in the file store's
+		 * buffer, without copying it. The view is only valid until the next
+		 * call that changes the file store. If the file store was formatted
+		 * with FileStoreOption_Aligned, the data of a file with an Inode of
+		 * its own is aligned to PAYLOAD_ALIGN from the start of the buffer,
+		 * so it can be used in place as a struct if the buffer is aligned.
+		 * Shared files are aligned to 8 and files in slabs not at all.
+		 * @param id id of the "file"
+		 * @param hint the address of the inode, if known, as from find
+		 * Compressed files have no view, as they only exist decompressed in
+		 * what read puts them in.
+		 * @return the view, with a null data pointer if the file was not found
+		 * or is spread over several chunks or compressed and must be read with
+		 * read
+		 */
+		View view(InodeId_t id, typename Header::FsSize_t hint = 0);
+
 		/**
 		 * Reads the stat information of the inode of the given inode id.
 		 * If the returned inode id is 0, then the requested inode was not found.
 		 * @param id id of the inode to stat
+		 * @param hint the address of the inode, if known, as from find
 		 * @return the stat information of the inode of the given inode id
 		 */
-		StatInfo stat(InodeId_t id);
+		StatInfo stat(InodeId_t id, typename Header::FsSize_t hint = 0);
+
+		/**
+		 * Checks the data of the "file" at the given id against its checksums.
+		 * @param id id of the "file"
+		 * @param hint the address of the inode, if known, as from find
+		 * @return 0 if the data matches, 1 if the file was not found, 2 if the
+		 * data does not match
+		 */
+		int verify(InodeId_t id, typename Header::FsSize_t hint = 0);
+
+		/**
+		 * Checks every inode that has a checksum against it, and that the
+		 * inode list and the extent lists point where they should, in one pass
+		 * over the buffer in address order.
+		 * @return the number of inodes that fail the check, or -1 if the inode
+		 * list is broken
+		 */
+		int verifyAll();
+
+		/**
+		 * Turns dedup on or off. While it is on, files written with the same
+		 * contents share one copy of them, which is kept until the last of
+		 * the files is removed or rewritten. Files already written are left
+		 * as they are.
+		 */
+		void setDedup(bool dedup);
+
+		bool dedup();
+
+		/**
+		 * Returns the number of bytes that sharing the data of identical
+		 * files saves over each file holding its own copy, less the cost of
+		 * the sharing, so it is negative if few files share.
+		 */
+		int64_t dedupSaved();
+
+		/**
+		 * Turns slabs on or off. While they are on, files of up to SLAB_MAX
+		 * bytes are kept in slabs shared by the files of 2^SLAB_SHIFT
+		 * consecutive ids, each with a few bytes of bookkeeping rather than
+		 * an Inode. A small file that is written to in part, or rewritten
+		 * larger, gets an Inode of its own. Files already written are left
+		 * as they are.
+		 */
+		void setSlabs(bool slabs);
+
+		bool slabs();
+
+		/**
+		 * Returns the number of bytes that keeping small files in slabs
+		 * saves over each file having its own Inode, less the cost of the
+		 * slabs.
+		 */
+		int64_t slabSaved();
+
+		/**
+		 * Turns compression on or off. While it is on, files of at least
+		 * COMPRESS_MIN bytes that are written anew, rather than over a file
+		 * with room for them where it is, are compressed in blocks of
+		 * COMPRESS_BLOCK bytes when that saves an eighth of their size, at
+		 * the cost of decompressing them on each read and of their views.
+		 * Files already written are left as they are.
+		 */
+		void setCompress(bool compress);
+
+		bool compress();
+
+		/**
+		 * Turns the type index on or off. While it is on, every file with an
+		 * Inode is kept in one of TYPE_LISTS lists by its file type, so that
+		 * the files of a type can be found without looking through the rest.
+		 * Turning it on indexes the files already written, moving those that
+		 * have no room after them for their TypeLinks. Turning it off gives
+		 * back the space of the TypeLinks.
+		 * @return 0, or 3 if there is not enough space to index the files,
+		 * in which case the index is left off
+		 */
+		int setTypeIndex(bool typeIndex);
+
+		bool typeIndex();
+
+		/**
+		 * Finds the address of the inode of the given id, which can be passed
+		 * back as a hint to skip the tree search. The address stays valid until
+		 * the inode is removed or moved, by a write that does not fit in place
+		 * or by compaction.
+		 * @param id id of the inode
+		 * @return the address of the inode, or 0 if there is none or the
+		 * file is in a slab
+		 */
+		typename Header::FsSize_t find(InodeId_t id);
+
+		/**
+		 * Returns a count that changes whenever compaction moves inodes,
+		 * including compaction run by an allocation, so that addresses from
+		 * find can be dropped when it changes.
+		 */
+		uint32_t moves();
 
 		/**
 		 * Returns the space needed for this data at the given inode address.
@@ -274,7 +1103,30 @@ class FileStore {
 
 		uint16_t version();
 
-		static uint8_t *format(uint8_t *buffer, typename Header::FsSize_t size, uint16_t fsType = 0);
+		/**
+		 * Passes every range of the buffer that has changed since the last
+		 * flush to the given writer, then marks the buffer clean. The ranges
+		 * are exact until there are more than DIRTY_RANGES of them, when the
+		 * closest are merged. The header only passes the fields that changed,
+		 * and the record of the dirty ranges, as it records the flush.
+		 * @param writer called as writer(uint64_t offset, const uint8_t *data,
+		 * uint64_t len) for each range, returning 0 on success
+		 * @return 0 if every range was written, the changes are kept otherwise
+		 */
+		template<typename Writer>
+		int flushDirty(Writer writer);
+
+		/**
+		 * Upgrades a file store of an older format version to the current
+		 * format version in place.
+		 * @return 0 if the file store is now of the current format version
+		 */
+		int upgrade();
+
+		/**
+		 * @param options the FileStoreOptions the file store starts with
+		 */
+		static uint8_t *format(uint8_t *buffer, typename Header::FsSize_t size, uint16_t fsType = 0, uint16_t options = 0);
 
 	private:
 		/**
@@ -286,15 +1138,44 @@ class FileStore {
 		 */
 		Inode *getInode(Inode *root, InodeId_t id);
 
+		/**
+		 * Gets the inode at the given id, from the given address if it holds
+		 * that inode and from the tree otherwise.
+		 */
+		Inode *getInode(InodeId_t id, typename Header::FsSize_t hint);
+
 		/**
 		 * Gets the parent inode at the given id.
 		 * @param root the root node to start comparing on
-		 * @param id id of the "file"
-		 * @param pathLen number of characters in pathLen
+		 * @param key id of the "file", or content hash of the blob
 		 * @param targetAddr the address of the target inode
 		 * @return the requested Inode, if available
 		 */
-		Inode *getInodeParent(Inode *root, InodeId_t id, typename Header::FsSize_t targetAddr);
+		Inode *getInodeParent(Inode *root, uint64_t key, typename Header::FsSize_t targetAddr);
+
+		/**
+		 * Gets the inode of the given key from the tree of the given root.
+		 * @return the inode, or nullptr if there is none
+		 */
+		Inode *getNode(typename Header::FsSize_t root, uint64_t key);
+
+		/**
+		 * Gets the blob of the given content hash.
+		 * @return the blob, or nullptr if there is none
+		 */
+		Inode *getBlob(uint64_t hash);
+
+		/**
+		 * Gets the slab that holds the small files of the run of ids that
+		 * the given id is in.
+		 * @return the slab, or nullptr if there is none
+		 */
+		Inode *getSlab(InodeId_t id);
+
+		/**
+		 * Gets the blob holding the data of the given InodeFlag_Shared inode.
+		 */
+		Inode *blobOf(Inode *inode);
 
 		/**
 		 * Reads the "file" at the given id. You are responsible for freeing
@@ -312,427 +1193,2442 @@ class FileStore {
 		         typename Header::FsSize_t *size);
 
 		/**
-		 * Removes the inode of the given ID.
-		 * @param id the id of the file
+		 * Returns whether or not the data of the file of the given inode
+		 * matches its checksums.
 		 */
-		int remove(Inode *root, InodeId_t id);
+		bool intact(Inode *inode);
 
 		/**
-		 * Removes the given node from the linked list.
-		 * @param node node to remove
+		 * Returns the size of the file of the given inode, which for an
+		 * InodeFlag_Extents inode is the total size of its chunks.
 		 */
-		void dealloc(Inode *node);
+		typename Header::FsSize_t fileSize(Inode *inode);
 
 		/**
-		 * Gets the address of the next available inode, assuming there is a next
-		 * available inode.
+		 * Copies len bytes of the file of the given inode, starting at offset,
+		 * out to dest.
+		 * @return 0, or 2 if the file is compressed and its data does not
+		 * decompress
 		 */
-		typename Header::FsSize_t nextInodeAddr();
+		int copyOut(Inode *inode, typename Header::FsSize_t offset, uint8_t *dest, typename Header::FsSize_t len);
 
 		/**
-		 * Gets an address for a new Inode.
-		 * @param size the size of the Inode
+		 * Does what copyOut does for an InodeFlag_Compressed inode,
+		 * decompressing only the blocks the bytes are in.
 		 */
-		void *alloc(typename Header::FsSize_t size);
+		int copyOutCompressed(Inode *inode, typename Header::FsSize_t offset, uint8_t *dest, typename Header::FsSize_t len);
 
 		/**
-		 * Compacts all of the inodes into a contiguous space, starting at the first inode.
+		 * Allocates an InodeFlag_Compressed inode holding the given data,
+		 * without compacting.
+		 * @return the inode, or nullptr if the space is not there or the data
+		 * does not compress well enough to be worth it
 		 */
-		void compact();
+		Inode *allocCompressed(const uint8_t *data, typename Header::FsSize_t dataLen);
 
 		/**
-		 * Inserts the given insertValue into the tree of the given root.
-		 * If the inode already exists, it replaces the old on deletes it.
-		 * @return true if the inode was inserted
+		 * Replaces the given InodeFlag_Compressed or InodeFlag_Shared inode
+		 * with one holding its file's data as is.
+		 * @return the new inode, or nullptr if there is not enough space
 		 */
-		bool insert(Inode *root, Inode *insertValue);
+		Inode *inflate(Inode *inode);
 
-		typename Header::FsSize_t firstInode();
+		/**
+		 * Writes the given data to a "file" with the given id as a share of
+		 * the blob of its contents, making the blob if there is none.
+		 * @return the result of the write, or -1 if the data cannot be shared
+		 * because a blob of other contents has the same hash or too many
+		 * files share it already
+		 */
+		int writeShared(InodeId_t id, void *data, typename Header::FsSize_t dataLen, uint8_t fileType);
 
-		typename Header::FsSize_t lastInode();
+		/**
+		 * Gets the small file of the given id from its slab.
+		 * @param slab pointer to be assigned the slab, if not null
+		 * @return the file, with null data if the file is not in a slab
+		 */
+		SmallFile getSmall(InodeId_t id, Inode **slab = nullptr);
 
 		/**
-		 * Updates the address of the inode in the tree.
+		 * Gets the file at the given position in the run of ids of the given
+		 * slab.
+		 * @return the file, with null data if there is no file there
 		 */
-		void updateInodeAddress(InodeId_t id, typename Header::FsSize_t oldAddr, typename Header::FsSize_t newAddr);
+		SmallFile slabEntry(Inode *slab, int slot);
 
-		uint8_t *begin() {
-			return (uint8_t*) this;
-		}
+		/**
+		 * Writes the given data to a "file" with the given id in the slab of
+		 * its run of ids, making the slab if there is none.
+		 * @return 0 if the write is a success
+		 */
+		int writeSmall(InodeId_t id, void *data, typename Header::FsSize_t dataLen, uint8_t fileType);
 
-		uint8_t *end() {
-			return begin() + this->m_header.getSize();
-		}
+		/**
+		 * Rewrites the slab of the given id with the file of the given id
+		 * replaced by the given file, or removed if file is null. Removing a
+		 * file never allocates, and removing the last file of a slab
+		 * deallocates the slab.
+		 * @return 0 if the slab was rewritten, 3 if there is not enough space
+		 */
+		int editSlab(InodeId_t id, const SmallFile *file);
 
 		/**
-		 * Converts an actual pointer to a FsSize_t.
+		 * Moves the small file of the given id out of its slab into an inode
+		 * of its own.
+		 * @return the inode, or nullptr if there is not enough space
 		 */
-		typename Header::FsSize_t ptr(void *ptr);
+		Inode *promote(InodeId_t id);
 
 		/**
-		 * Converts a FsSize_t to an actual pointer.
+		 * Does what read does for a file in a slab.
 		 */
 		template<typename T>
-		T ptr(typename Header::FsSize_t ptr) {
-			return (T) (begin() + ptr);
-		};
+		int readSmall(InodeId_t id, typename Header::FsSize_t readStart,
+		              typename Header::FsSize_t readSize, T *data,
+		              typename Header::FsSize_t *size);
 
-};
+		/**
+		 * Copies len bytes from src into the file of the given inode, starting
+		 * at offset. The file must already be large enough.
+		 * @param extend the checksum covers exactly the data before offset, so
+		 * it is carried on over the new bytes instead of recomputed
+		 */
+		void copyIn(Inode *inode, typename Header::FsSize_t offset, const uint8_t *src, typename Header::FsSize_t len, bool extend = false);
 
-template<typename Header>
-typename Header::FsSize_t FileStore<Header>::Inode::size() {
-	return sizeof(Inode) + getDataLen();
-}
+		/**
+		 * Allocates an InodeFlag_Extents inode and enough chunks for dataLen
+		 * bytes out of the existing gaps and the space after the last inode,
+		 * without compacting.
+		 * @param id the id the chunks are to be owned by
+		 * @return the extent list inode, or nullptr if the space is not there
+		 */
+		Inode *allocExtents(InodeId_t id, typename Header::FsSize_t dataLen);
 
-template<typename Header>
-void FileStore<Header>::Inode::setDataLen(typename Header::FsSize_t dataLen) {
-	this->m_dataLen = bigEndianAdapt(dataLen);
-}
+		/**
+		 * Adds a chunk of the given size to the end of the file of the given
+		 * InodeFlag_Extents inode.
+		 * @return the extent list inode, which may have moved, or nullptr if
+		 * there is not enough space
+		 */
+		Inode *growExtents(Inode *inode, typename Header::FsSize_t dataLen);
 
-template<typename Header>
-typename Header::FsSize_t FileStore<Header>::Inode::getDataLen() {
-	return bigEndianAdapt(m_dataLen);
-}
+		/**
+		 * Deallocates the chunks of the given InodeFlag_Extents inode.
+		 */
+		void freeExtents(Inode *inode);
 
-template<typename Header>
-void FileStore<Header>::Inode::setPrev(typename Header::FsSize_t prev) {
-	this->m_prev = bigEndianAdapt(prev);
-}
+		/**
+		 * Points the extent list of the file of the given id at the new
+		 * address of a moved chunk.
+		 */
+		void updateChunkAddress(InodeId_t id, typename Header::FsSize_t oldAddr, typename Header::FsSize_t newAddr);
 
-template<typename Header>
-typename Header::FsSize_t FileStore<Header>::Inode::getPrev() {
-	return bigEndianAdapt(m_prev);
-}
+		/**
+		 * Returns the size of the largest allocation that can be made without
+		 * compacting.
+		 */
+		typename Header::FsSize_t largestAlloc();
 
-template<typename Header>
-void FileStore<Header>::Inode::setNext(typename Header::FsSize_t next) {
-	this->m_next = bigEndianAdapt(next);
-}
+		/**
+		 * Writes the given data into the given inode at the given offset.
+		 */
+		int write(Inode *inode, typename Header::FsSize_t offset, void *data, typename Header::FsSize_t dataLen);
 
-template<typename Header>
-typename Header::FsSize_t FileStore<Header>::Inode::getNext() {
-	return bigEndianAdapt(m_next);
-}
+		/**
+		 * Moves the given inode to a new allocation with room for dataLen bytes
+		 * of data, keeping its id, links, file type, and as much of its data as
+		 * fits. When it grows, the checksum is left covering the old data.
+		 * @return the moved inode, or nullptr if there is not enough space
+		 */
+		Inode *relocate(Inode *inode, typename Header::FsSize_t dataLen);
 
-template<typename Header>
-void FileStore<Header>::Inode::setId(InodeId_t id) {
-	this->m_id = bigEndianAdapt(id);
-}
+		/**
+		 * Takes the inode of the given ID out of the tree without deallocating
+		 * it or its chunks.
+		 * @return the inode, or nullptr if it was not found
+		 */
+		Inode *unlink(InodeId_t id);
 
-template<typename Header>
-typename Header::InodeId_t FileStore<Header>::Inode::getId() {
-	return bigEndianAdapt(m_id);
-}
+		/**
+		 * Takes the given blob or slab out of its tree without deallocating
+		 * it.
+		 * @return the inode
+		 */
+		Inode *detach(Inode *inode);
 
-template<typename Header>
-void FileStore<Header>::Inode::setLinks(InodeId_t links) {
-	this->m_links = bigEndianAdapt(links);
-}
+		/**
+		 * Deallocates the given inode, which must be out of the tree, along
+		 * with its chunks or its share of a blob.
+		 */
+		void release(Inode *inode);
 
-template<typename Header>
-typename Header::InodeId_t FileStore<Header>::Inode::getLinks() {
+		/**
+		 * Returns whether or not removing the file of the given inode also
+		 * deallocates other, as one of its chunks or as a blob only it
+		 * shares.
+		 */
+		bool frees(Inode *inode, Inode *other);
+
+		/**
+		 * Removes the inode of the given key from the subtree of the given
+		 * root. The inode at firstInode() is never removed.
+		 * @param root the root node of the subtree
+		 * @param key the id of the file, or content hash of the blob
+		 * @param removed pointer to be assigned the removed inode
+		 * @return the new root of the subtree
+		 */
+		Inode *remove(Inode *root, uint64_t key, Inode **removed);
+
+		/**
+		 * Joins two subtrees, where every key in left is less than every key
+		 * in right, into one.
+		 * @return the root of the joined tree
+		 */
+		Inode *merge(Inode *left, Inode *right);
+
+		/**
+		 * Takes every file the predicate picks out of the subtree of the
+		 * given root. The files taken out are chained through m_right onto
+		 * removed, to be released once the walk is done. The inode at
+		 * firstInode() is never taken out.
+		 * @param root the root node of the subtree
+		 * @param predicate called with the StatInfo of each file
+		 * @param removed the chain of files taken out so far
+		 * @return the new root of the subtree
+		 */
+		template<typename Predicate>
+		Inode *filter(Inode *root, Predicate &predicate, Inode **removed);
+
+		/**
+		 * Returns the StatInfo of the given file inode.
+		 */
+		StatInfo statOf(Inode *inode);
+
+		/**
+		 * Calls the callback with the StatInfo of each file of the type in
+		 * the slabs of the subtree of the given root, until it returns
+		 * non-zero.
+		 * @return the last value returned by the callback
+		 */
+		template<typename Callback>
+		int forEachSmallOfType(Inode *root, uint8_t fileType, Callback &cb);
+
+		/**
+		 * Removes the files kept in slabs that the predicate picks.
+		 * @return 0 if all picked files were removed
+		 */
+		template<typename Predicate>
+		int removeSmallIf(Predicate &predicate);
+
+		/**
+		 * Returns the TypeLinks after the data of the given inode, or nullptr
+		 * if it has none.
+		 */
+		TypeLinks *typeLinks(Inode *inode);
+
+		/**
+		 * Returns the size of an Inode for a file of dataLen bytes, including
+		 * its TypeLinks if the type index is on.
+		 */
+		typename Header::FsSize_t fileInodeSize(typename Header::FsSize_t dataLen);
+
+		/**
+		 * Allocates an Inode for a file of dataLen bytes, with TypeLinks if
+		 * the type index is on.
+		 * @param compact whether to compact the store when no gap fits it
+		 * @return the Inode, or nullptr if there is no room for it
+		 */
+		Inode *allocFile(typename Header::FsSize_t dataLen, bool compact = true);
+
+		/**
+		 * Gives the given file inode TypeLinks out of the gap after it.
+		 * @return false if the gap is too small
+		 */
+		bool addTypeLinks(Inode *inode);
+
+		/**
+		 * Takes the TypeLinks off the given file inode, leaving a gap after
+		 * it.
+		 */
+		void dropTypeLinks(Inode *inode);
+
+		/**
+		 * Adds the given file inode to the type index if it has TypeLinks.
+		 */
+		void linkType(Inode *inode);
+
+		/**
+		 * Takes the given file inode out of the type index if it has
+		 * TypeLinks.
+		 */
+		void unlinkType(Inode *inode);
+
+		/**
+		 * Changes the file type of the given file inode, moving it to the
+		 * list of its new type if need be.
+		 */
+		void retype(Inode *inode, uint8_t fileType);
+
+		/**
+		 * Points the neighbours of the given file inode in the type index
+		 * at its new address.
+		 */
+		void updateTypeAddress(Inode *inode, typename Header::FsSize_t oldAddr, typename Header::FsSize_t newAddr);
+
+		/**
+		 * Empties the type index and re-adds every file that has TypeLinks.
+		 */
+		void rebuildTypeLists();
+
+		/**
+		 * Removes the given node from the linked list.
+		 * @param node node to remove
+		 */
+		void dealloc(Inode *node);
+
+		/**
+		 * Gets the address of the next available inode, assuming there is a next
+		 * available inode.
+		 */
+		typename Header::FsSize_t nextInodeAddr();
+
+		/**
+		 * Returns the first address at or after the given one where an Inode
+		 * would have its data aligned to PAYLOAD_ALIGN, or the address itself
+		 * if FileStoreOption_Aligned is not set.
+		 */
+		typename Header::FsSize_t alignInode(typename Header::FsSize_t addr);
+
+		/**
+		 * Returns where the next Inode after the given one may start, which
+		 * is the end of the given one padded out by alignInode.
+		 */
+		typename Header::FsSize_t endOf(Inode *inode);
+
+		/**
+		 * Returns the space an Inode of the given size takes where its data
+		 * is aligned, including the padding after it.
+		 */
+		typename Header::FsSize_t footprint(typename Header::FsSize_t size);
+
+		/**
+		 * Gets an address for a new Inode, preferring to fill a gap left by
+		 * dealloc over appending to the end of the inode list.
+		 * @param size the size of the Inode
+		 */
+		void *alloc(typename Header::FsSize_t size);
+
+		/**
+		 * Gets an address for a new Inode like alloc, but returns nullptr
+		 * rather than compacting if there is no room.
+		 * @param size the size of the Inode
+		 */
+		void *tryAlloc(typename Header::FsSize_t size);
+
+		/**
+		 * Changes the data length of the given inode without moving it, if
+		 * the space between it and the next inode allows it.
+		 * @return true if the inode was resized
+		 */
+		bool resizeInPlace(Inode *inode, typename Header::FsSize_t dataLen);
+
+		/**
+		 * Finds a free block of at least the given size.
+		 * @return the free block, or nullptr if none is large enough
+		 */
+		FreeBlock *findFreeBlock(typename Header::FsSize_t size);
+
+		/**
+		 * Returns the size of the gap between the given inode and the next
+		 * inode. The space after the last inode is not counted as a gap.
+		 */
+		typename Header::FsSize_t gapAfter(Inode *inode);
+
+		/**
+		 * Adds the gap after the given inode to the free lists if it is large
+		 * enough to hold a FreeBlock.
+		 */
+		void indexGap(Inode *inode);
+
+		/**
+		 * Removes the gap after the given inode from the free lists. This must
+		 * be called before anything changes the gap's size.
+		 */
+		void unindexGap(Inode *inode);
+
+		/**
+		 * Empties the free lists and re-adds every gap in the inode list.
+		 */
+		void rebuildFreeLists();
+
+		static int sizeClass(typename Header::FsSize_t size);
+
+		/**
+		 * Moves the inode after the given inode down to the end of the given
+		 * inode.
+		 * @return the moved inode
+		 */
+		Inode *moveNext(Inode *inode);
+
+		/**
+		 * Inserts the given insertValue into the tree of files, or into the
+		 * tree of blobs if it is a blob.
+		 * @return true if the inode was inserted, false if an inode of the same
+		 * key is already present
+		 */
+		bool insert(Inode *insertValue);
+
+		/**
+		 * Inserts the given insertValue into the subtree of the given root,
+		 * rotating it up until its parent has a higher priority.
+		 * @param inserted pointer to be assigned whether or not the inode was
+		 * inserted
+		 * @return the new root of the subtree
+		 */
+		Inode *insert(Inode *root, Inode *insertValue, bool *inserted);
+
+		Inode *rotateLeft(Inode *root);
+
+		Inode *rotateRight(Inode *root);
+
+		/**
+		 * Discards the trees and rebuilds them from the inode list.
+		 */
+		void rebuildIndex();
+
+		/**
+		 * Returns the tree priority of the given inode key. The trees are kept
+		 * as treaps, which keeps them balanced without any per inode
+		 * bookkeeping, so the priority is derived from a hash of the key.
+		 */
+		static uint64_t priority(uint64_t key);
+
+		/**
+		 * Returns what the given inode is ordered by in its tree, the content
+		 * hash for blobs and the id for everything else.
+		 */
+		static uint64_t keyOf(Inode *inode);
+
+		/**
+		 * Returns whether or not a belongs above b in the tree.
+		 */
+		static bool higherPriority(Inode *a, Inode *b);
+
+		typename Header::FsSize_t firstInode();
+
+		typename Header::FsSize_t lastInode();
+
+		/**
+		 * Updates the address of the inode in the tree.
+		 */
+		void updateInodeAddress(InodeId_t id, typename Header::FsSize_t oldAddr, typename Header::FsSize_t newAddr);
+
+		/**
+		 * Updates the address of the given blob or slab, which has moved, in
+		 * its tree.
+		 */
+		void updateTreeAddress(Inode *inode, typename Header::FsSize_t oldAddr, typename Header::FsSize_t newAddr);
+
+		/**
+		 * Returns the root of the tree that the given inode belongs in.
+		 */
+		typename Header::FsSize_t rootOf(Inode *inode);
+
+		void setRootOf(Inode *inode, typename Header::FsSize_t root);
+
+		uint8_t *begin() {
+			return (uint8_t*) this;
+		}
+
+		uint8_t *end() {
+			return begin() + this->m_header.getSize();
+		}
+
+		/**
+		 * Records that len bytes at the given address are about to change,
+		 * which must be before they do, as the buffer's watchers are told.
+		 */
+		void dirty(typename Header::FsSize_t addr, typename Header::FsSize_t len) {
+			m_header.markDirty(addr, addr + len);
+		}
+
+		/**
+		 * Records that the given inode's header is about to change.
+		 * @return the inode
+		 */
+		Inode *dirty(Inode *inode) {
+			dirty(ptr(inode), sizeof(Inode));
+			return inode;
+		}
+
+		/**
+		 * Records that the given free block is about to change.
+		 * @return the free block
+		 */
+		FreeBlock *dirty(FreeBlock *block) {
+			dirty(ptr(block), sizeof(FreeBlock));
+			return block;
+		}
+
+		/**
+		 * Records that the given type links are about to change.
+		 * @return the type links
+		 */
+		TypeLinks *dirty(TypeLinks *links) {
+			dirty(ptr(links), sizeof(TypeLinks));
+			return links;
+		}
+
+		/**
+		 * Records that the given extent is about to change.
+		 * @return the extent
+		 */
+		Extent *dirty(Extent *extent) {
+			dirty(ptr(extent), sizeof(Extent));
+			return extent;
+		}
+
+		/**
+		 * Converts an actual pointer to a FsSize_t.
+		 */
+		typename Header::FsSize_t ptr(void *ptr);
+
+		/**
+		 * Converts a FsSize_t to an actual pointer.
+		 */
+		template<typename T>
+		T ptr(typename Header::FsSize_t ptr) {
+			return (T) (begin() + ptr);
+		};
+
+		/**
+		 * Converts a FsSize_t to an Inode pointer, or nullptr if the FsSize_t
+		 * is 0.
+		 */
+		Inode *node(typename Header::FsSize_t addr) {
+			return addr ? ptr<Inode*>(addr) : nullptr;
+		};
+
+};
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::Inode::size() {
+	const auto links = getFlags() & InodeFlag_TypeLinks;
+	return sizeof(Inode) + getDataLen() + (links ? sizeof(TypeLinks) : 0);
+}
+
+template<typename Header>
+void FileStore<Header>::Inode::setDataLen(typename Header::FsSize_t dataLen) {
+	this->m_dataLen = bigEndianAdapt(dataLen);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::Inode::getDataLen() {
+	return bigEndianAdapt(m_dataLen);
+}
+
+template<typename Header>
+void FileStore<Header>::Inode::setPrev(typename Header::FsSize_t prev) {
+	this->m_prev = bigEndianAdapt(prev);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::Inode::getPrev() {
+	return bigEndianAdapt(m_prev);
+}
+
+template<typename Header>
+void FileStore<Header>::Inode::setNext(typename Header::FsSize_t next) {
+	this->m_next = bigEndianAdapt(next);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::Inode::getNext() {
+	return bigEndianAdapt(m_next);
+}
+
+template<typename Header>
+void FileStore<Header>::Inode::setId(InodeId_t id) {
+	this->m_id = bigEndianAdapt(id);
+}
+
+template<typename Header>
+typename Header::InodeId_t FileStore<Header>::Inode::getId() {
+	return bigEndianAdapt(m_id);
+}
+
+template<typename Header>
+void FileStore<Header>::Inode::setLinks(InodeId_t links) {
+	this->m_links = bigEndianAdapt(links);
+}
+
+template<typename Header>
+typename Header::InodeId_t FileStore<Header>::Inode::getLinks() {
 	return bigEndianAdapt(m_links);
 }
 
 template<typename Header>
-void FileStore<Header>::Inode::setFileType(uint8_t fileType) {
-	this->m_fileType = bigEndianAdapt(fileType);
+void FileStore<Header>::Inode::setFileType(uint8_t fileType) {
+	this->m_fileType = bigEndianAdapt(fileType);
+}
+
+template<typename Header>
+uint8_t FileStore<Header>::Inode::getFileType() {
+	return bigEndianAdapt(m_fileType);
+}
+
+template<typename Header>
+void FileStore<Header>::Inode::setFlags(uint16_t flags) {
+	this->m_flags = bigEndianAdapt(flags);
+}
+
+template<typename Header>
+uint16_t FileStore<Header>::Inode::getFlags() {
+	return bigEndianAdapt(m_flags);
+}
+
+template<typename Header>
+void FileStore<Header>::Inode::setChecksum(uint32_t checksum) {
+	this->m_checksum = bigEndianAdapt(checksum);
+}
+
+template<typename Header>
+uint32_t FileStore<Header>::Inode::getChecksum() {
+	return bigEndianAdapt(m_checksum);
+}
+
+template<typename Header>
+void FileStore<Header>::Inode::updateChecksum() {
+	setChecksum(ox_crc32c(getData(), getDataLen()));
+	setFlags(getFlags() | InodeFlag_Checksum);
+}
+
+template<typename Header>
+bool FileStore<Header>::Inode::checksumValid() {
+	return !(getFlags() & InodeFlag_Checksum) || ox_crc32c(getData(), getDataLen()) == getChecksum();
+}
+
+template<typename Header>
+void FileStore<Header>::Inode::setLeft(typename Header::FsSize_t left) {
+	this->m_left = bigEndianAdapt(left);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::Inode::getLeft() {
+	return bigEndianAdapt(m_left);
+}
+
+template<typename Header>
+void FileStore<Header>::Inode::setRight(typename Header::FsSize_t right) {
+	this->m_right = bigEndianAdapt(right);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::Inode::getRight() {
+	return bigEndianAdapt(m_right);
+}
+
+template<typename Header>
+void FileStore<Header>::Inode::setData(void *data, typename Header::FsSize_t size) {
+	ox_memcpy(getData(), data, size);
+	setDataLen(size);
+	updateChecksum();
+}
+
+template<typename Header>
+uint8_t *FileStore<Header>::Inode::getData() {
+	return (uint8_t*) (this + 1);
+}
+
+
+// TypeLinks
+
+template<typename Header>
+void FileStore<Header>::TypeLinks::setPrev(typename Header::FsSize_t prev) {
+	this->m_prev = bigEndianAdapt(prev);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::TypeLinks::getPrev() {
+	return bigEndianAdapt(m_prev);
+}
+
+template<typename Header>
+void FileStore<Header>::TypeLinks::setNext(typename Header::FsSize_t next) {
+	this->m_next = bigEndianAdapt(next);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::TypeLinks::getNext() {
+	return bigEndianAdapt(m_next);
+}
+
+
+// Extent
+
+template<typename Header>
+void FileStore<Header>::Extent::setChunk(typename Header::FsSize_t chunk) {
+	this->m_chunk = bigEndianAdapt(chunk);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::Extent::getChunk() {
+	return bigEndianAdapt(m_chunk);
+}
+
+
+// Compressed
+
+template<typename Header>
+void FileStore<Header>::Compressed::setSize(typename Header::FsSize_t size) {
+	this->m_size = bigEndianAdapt(size);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::Compressed::getSize() {
+	return bigEndianAdapt(m_size);
+}
+
+template<typename Header>
+void FileStore<Header>::CompressedBlock::setEnd(typename Header::FsSize_t end) {
+	this->m_end = bigEndianAdapt(end);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::CompressedBlock::getEnd() {
+	return bigEndianAdapt(m_end);
+}
+
+
+// ContentHash
+
+template<typename Header>
+void FileStore<Header>::ContentHash::setHash(uint64_t hash) {
+	this->m_hash = bigEndianAdapt(hash);
+}
+
+template<typename Header>
+uint64_t FileStore<Header>::ContentHash::getHash() {
+	return bigEndianAdapt(m_hash);
+}
+
+
+// Slab
+
+template<typename Header>
+void FileStore<Header>::SlabHeader::setPresent(uint64_t present) {
+	this->m_present = bigEndianAdapt(present);
+}
+
+template<typename Header>
+uint64_t FileStore<Header>::SlabHeader::getPresent() {
+	return bigEndianAdapt(m_present);
+}
+
+template<typename Header>
+void FileStore<Header>::SlabOffset::setOffset(uint16_t offset) {
+	this->m_offset = bigEndianAdapt(offset);
+}
+
+template<typename Header>
+uint16_t FileStore<Header>::SlabOffset::getOffset() {
+	return bigEndianAdapt(m_offset);
+}
+
+template<typename Header>
+void FileStore<Header>::SlabEntry::setLinks(InodeId_t links) {
+	this->m_links = bigEndianAdapt(links);
+}
+
+template<typename Header>
+typename Header::InodeId_t FileStore<Header>::SlabEntry::getLinks() {
+	return bigEndianAdapt(m_links);
+}
+
+template<typename Header>
+void FileStore<Header>::SlabEntry::setFileType(uint8_t fileType) {
+	this->m_fileType = bigEndianAdapt(fileType);
+}
+
+template<typename Header>
+uint8_t FileStore<Header>::SlabEntry::getFileType() {
+	return bigEndianAdapt(m_fileType);
+}
+
+template<typename Header>
+void FileStore<Header>::SlabEntry::setDataLen(uint8_t dataLen) {
+	this->m_dataLen = bigEndianAdapt(dataLen);
+}
+
+template<typename Header>
+uint8_t FileStore<Header>::SlabEntry::getDataLen() {
+	return bigEndianAdapt(m_dataLen);
+}
+
+template<typename Header>
+uint8_t *FileStore<Header>::SlabEntry::getData() {
+	return (uint8_t*) (this + 1);
+}
+
+
+// FreeBlock
+
+template<typename Header>
+void FileStore<Header>::FreeBlock::setSize(typename Header::FsSize_t size) {
+	this->m_size = bigEndianAdapt(size);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::FreeBlock::getSize() {
+	return bigEndianAdapt(m_size);
+}
+
+template<typename Header>
+void FileStore<Header>::FreeBlock::setInode(typename Header::FsSize_t inode) {
+	this->m_inode = bigEndianAdapt(inode);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::FreeBlock::getInode() {
+	return bigEndianAdapt(m_inode);
+}
+
+template<typename Header>
+void FileStore<Header>::FreeBlock::setPrev(typename Header::FsSize_t prev) {
+	this->m_prev = bigEndianAdapt(prev);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::FreeBlock::getPrev() {
+	return bigEndianAdapt(m_prev);
+}
+
+template<typename Header>
+void FileStore<Header>::FreeBlock::setNext(typename Header::FsSize_t next) {
+	this->m_next = bigEndianAdapt(next);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::FreeBlock::getNext() {
+	return bigEndianAdapt(m_next);
+}
+
+
+// FileStore
+
+template<typename Header>
+int FileStore<Header>::dumpTo(FileStore<Header> *dest) {
+	if (dest->size() >= size()) {
+		// dest keeps the layout it was formatted with
+		const uint16_t aligned = dest->m_header.getOptions() & FileStoreOption_Aligned;
+		dest->m_header.setOptions((m_header.getOptions() & ~FileStoreOption_Aligned) | aligned);
+		auto i = ptr<Inode*>(firstInode());
+		do {
+			if (i->getFlags() & InodeFlag_Extents) {
+				auto extents = (Extent*) i->getData();
+				dest->write(i->getId(), nullptr, 0, i->getFileType());
+				for (typename Header::FsSize_t e = 0; e < i->getDataLen() / sizeof(Extent); e++) {
+					auto chunk = ptr<Inode*>(extents[e].getChunk());
+					dest->append(i->getId(), chunk->getData(), chunk->getDataLen());
+				}
+			} else if (i->getFlags() & InodeFlag_Compressed) {
+				// copy it as it is, rather than decompressing it to have dest
+				// compress it again
+				auto inode = dest->allocFile(i->getDataLen());
+				if (inode) {
+					ox_memcpy(inode->getData(), i->getData(), i->getDataLen());
+					inode->setId(i->getId());
+					inode->setFileType(i->getFileType());
+					inode->setFlags((i->getFlags() & ~InodeFlag_TypeLinks) | (inode->getFlags() & InodeFlag_TypeLinks));
+					inode->setChecksum(i->getChecksum());
+					dest->remove(i->getId());
+					dest->insert(inode);
+				}
+			} else if (i->getFlags() & InodeFlag_Shared) {
+				auto blob = blobOf(i);
+				dest->write(i->getId(), blob->getData() + sizeof(ContentHash),
+				            blob->getDataLen() - sizeof(ContentHash), i->getFileType());
+			} else if (i->getFlags() & InodeFlag_Slab) {
+				const InodeId_t base = i->getId() << Header::SLAB_SHIFT;
+				for (int s = 0; s < SLAB_IDS; s++) {
+					auto small = slabEntry(i, s);
+					if (small.data) {
+						dest->write(base + s, small.data, small.dataLen, small.fileType);
+					}
+				}
+			} else if (!(i->getFlags() & (InodeFlag_Chunk | InodeFlag_Blob))) {
+				dest->write(i->getId(), i->getData(), i->getDataLen(), i->getFileType());
+			}
+			i = ptr<Inode*>(i->getNext());
+		} while (ptr(i) != firstInode());
+		return 0;
+	} else {
+		return -1;
+	}
+}
+
+template<typename Header>
+void FileStore<Header>::resize(typename Header::FsSize_t size) {
+	if (size < m_header.getSize()) {
+		// shrink file store
+		if (m_header.getMemUsed() > size) {
+			size = m_header.getMemUsed();
+		}
+		compact();
+		m_header.setSize(size);
+	} else if (size > m_header.getSize()) {
+		// grow file store, the new space has never been written anywhere
+		const auto oldSize = m_header.getSize();
+		m_header.setSize(size);
+		dirty(oldSize, size - oldSize);
+	}
+}
+
+template<typename Header>
+int FileStore<Header>::write(InodeId_t id, void *data, typename Header::FsSize_t dataLen, uint8_t fileType) {
+	auto retval = 1;
+	if ((m_header.getOptions() & FileStoreOption_Slabs) && dataLen <= Header::SLAB_MAX) {
+		return writeSmall(id, data, dataLen, fileType);
+	}
+	// a file in a slab keeps its links, and its entry goes when the new
+	// version of it is in place
+	if ((m_header.getOptions() & FileStoreOption_Dedup) && dataLen >= Header::DEDUP_MIN) {
+		retval = writeShared(id, data, dataLen, fileType);
+		if (retval != -1) {
+			return retval;
+		}
+	}
+
+	const auto size = fileInodeSize(dataLen);
+	auto existing = getInode(ptr<Inode*>(m_header.getRootInode()), id);
+	if (existing && ptr(existing) != firstInode()
+	    && !(existing->getFlags() & (InodeFlag_Extents | InodeFlag_Shared))
+	    && resizeInPlace(existing, dataLen)) {
+		// rewriting the file where it is costs less than compressing it
+		retype(existing, fileType);
+		dirty(ptr(existing), existing->size());
+		existing->setFlags(existing->getFlags() & ~InodeFlag_Compressed);
+		existing->setData(data, dataLen);
+		return 0;
+	}
+
+	Inode *packed = nullptr;
+	if ((m_header.getOptions() & FileStoreOption_Compress) && dataLen >= Header::COMPRESS_MIN) {
+		packed = allocCompressed((uint8_t*) data, dataLen);
+	}
+	if (packed || size <= (m_header.getSize() - m_header.getMemUsed())) {
+		auto links = existing ? existing->getLinks() : 0;
+		auto inode = packed;
+		if (!inode) {
+			inode = allocFile(dataLen, false);
+		}
+		if (!inode) {
+			// spreading the file over the gaps is cheaper than moving
+			// everything else out of its way
+			inode = allocExtents(id, dataLen);
+		}
+		if (!inode) {
+			inode = allocFile(dataLen);
+		}
+		if (inode) {
+			// alloc may have compacted, moving the slab
+			if (!existing) {
+				links = getSmall(id).links;
+			}
+			remove(id);
+			inode->setId(id);
+			inode->setLinks(links);
+			inode->setFileType(fileType);
+			if (!packed) {
+				copyIn(inode, 0, (uint8_t*) data, dataLen);
+			}
+			if (insert(inode)) {
+				retval = 0;
+			} else {
+				release(inode);
+				retval = 2;
+			}
+		} else {
+			retval = 3;
+		}
+	} else {
+		retval = 4;
+	}
+	return retval;
+}
+
+template<typename Header>
+int FileStore<Header>::write(BatchEntry *entries, size_t count) {
+	uint64_t total = 0;
+	for (size_t i = 0; i < count; i++) {
+		total += footprint(fileInodeSize(entries[i].dataLen));
+	}
+	if (!count) {
+		return 0;
+	} else if (total > available()) {
+		return 4;
+	}
+
+	auto region = (Inode*) alloc(total);
+	if (!region) {
+		return 3;
+	}
+
+	// split the allocation up into the batch's inodes, alloc has zeroed it
+	const auto prev = region->getPrev();
+	const auto next = region->getNext();
+	unindexGap(region);
+	auto addr = ptr(region);
+	typename Header::FsSize_t last = prev;
+	for (size_t i = 0; i < count; i++) {
+		auto inode = ptr<Inode*>(addr);
+		const auto size = footprint(fileInodeSize(entries[i].dataLen));
+		inode->setPrev(last);
+		inode->setNext(i + 1 < count ? addr + size : next);
+		inode->setId(entries[i].id);
+		inode->setFileType(entries[i].fileType);
+		inode->setData(entries[i].data, entries[i].dataLen);
+		if (m_header.getOptions() & FileStoreOption_TypeIndex) {
+			inode->setFlags(inode->getFlags() | InodeFlag_TypeLinks);
+		}
+		last = addr;
+		addr += size;
+	}
+	dirty(ptr<Inode*>(next))->setPrev(last);
+	indexGap(ptr<Inode*>(last));
+
+	// replace the older versions in the tree
+	int err = 0;
+	addr = ptr(region);
+	for (size_t i = 0; i < count; i++) {
+		auto inode = ptr<Inode*>(addr);
+		addr += footprint(inode->size());
+		auto existing = getInode(ptr<Inode*>(m_header.getRootInode()), inode->getId());
+		auto small = existing ? SmallFile() : getSmall(inode->getId());
+		if (existing && ptr(existing) != firstInode()) {
+			inode->setLinks(existing->getLinks());
+			remove(inode->getId());
+		} else if (small.data) {
+			// removing a file from a slab never allocates, so the batch's
+			// inodes stay where they are
+			inode->setLinks(small.links);
+			editSlab(inode->getId(), nullptr);
+		}
+		if (!insert(inode)) {
+			dealloc(inode);
+			err = 2;
+		}
+	}
+	return err;
+}
+
+template<typename Header>
+int FileStore<Header>::write(InodeId_t id, typename Header::FsSize_t offset, void *data, typename Header::FsSize_t dataLen) {
+	auto inode = getInode(ptr<Inode*>(m_header.getRootInode()), id);
+	if (!inode && getSmall(id).data) {
+		inode = promote(id);
+		if (!inode) {
+			return 3;
+		}
+	}
+	return inode ? write(inode, offset, data, dataLen) : 1;
+}
+
+template<typename Header>
+int FileStore<Header>::append(InodeId_t id, void *data, typename Header::FsSize_t dataLen) {
+	auto inode = getInode(ptr<Inode*>(m_header.getRootInode()), id);
+	if (!inode && getSmall(id).data) {
+		inode = promote(id);
+		if (!inode) {
+			return 3;
+		}
+	}
+	return inode ? write(inode, fileSize(inode), data, dataLen) : 1;
+}
+
+template<typename Header>
+int FileStore<Header>::write(Inode *inode, typename Header::FsSize_t offset, void *data, typename Header::FsSize_t dataLen) {
+	if (inode->getFlags() & (InodeFlag_Compressed | InodeFlag_Shared)) {
+		inode = inflate(inode);
+		if (!inode) {
+			return 3;
+		}
+	}
+
+	const typename Header::FsSize_t end = offset + dataLen;
+	const auto oldLen = fileSize(inode);
+	const auto extents = inode->getFlags() & InodeFlag_Extents;
+	if (ptr(inode) == firstInode() || end < offset) {
+		return 2;
+	}
+
+	if (end > oldLen) {
+		if (extents) {
+			inode = growExtents(inode, end - oldLen);
+		} else if (!resizeInPlace(inode, end)) {
+			inode = relocate(inode, end);
+		}
+		if (!inode) {
+			return 3;
+		}
+	}
+
+	// growing leaves the checksum covering the old data, so an append only
+	// has to carry it on over the new bytes
+	const bool extend = !extents && offset >= oldLen && (inode->getFlags() & InodeFlag_Checksum);
+	// new chunks come zeroed from alloc
+	if (offset > oldLen && !extents) {
+		dirty(ptr(inode->getData()) + oldLen, offset - oldLen);
+		ox_memset(&inode->getData()[oldLen], 0, offset - oldLen);
+		if (extend) {
+			dirty(inode)->setChecksum(ox_crc32c(&inode->getData()[oldLen], offset - oldLen, inode->getChecksum()));
+		}
+	}
+	copyIn(inode, offset, (uint8_t*) data, dataLen, extend);
+	return 0;
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::relocate(Inode *inode, typename Header::FsSize_t dataLen) {
+	const auto id = inode->getId();
+	if (fileInodeSize(dataLen) > available()) {
+		return nullptr;
+	}
+
+	auto dest = allocFile(dataLen);
+	if (!dest) {
+		return nullptr;
+	}
+	// alloc may have compacted, moving the inode
+	inode = getInode(ptr<Inode*>(m_header.getRootInode()), id);
+
+	dest->setId(id);
+	dest->setLinks(inode->getLinks());
+	dest->setFileType(inode->getFileType());
+	dest->setFlags((inode->getFlags() & ~InodeFlag_TypeLinks) | (dest->getFlags() & InodeFlag_TypeLinks));
+	ox_memcpy(dest->getData(), inode->getData(), inode->getDataLen() < dataLen ? inode->getDataLen() : dataLen);
+	if (dataLen < inode->getDataLen()) {
+		if (dest->getFlags() & InodeFlag_Checksum) {
+			dest->updateChecksum();
+		}
+	} else {
+		// the checksum still covers the old data, the caller fills in the rest
+		dest->setChecksum(inode->getChecksum());
+	}
+	// the chunks of an extent list now belong to dest
+	dealloc(unlink(id));
+	insert(dest);
+	return dest;
+}
+
+template<typename Header>
+bool FileStore<Header>::intact(Inode *inode) {
+	if (!inode->checksumValid()) {
+		return false;
+	}
+	if (inode->getFlags() & InodeFlag_Shared) {
+		auto blob = blobOf(inode);
+		return blob && blob->checksumValid();
+	} else if (inode->getFlags() & InodeFlag_Extents) {
+		auto extents = (Extent*) inode->getData();
+		for (typename Header::FsSize_t i = 0; i < inode->getDataLen() / sizeof(Extent); i++) {
+			if (!ptr<Inode*>(extents[i].getChunk())->checksumValid()) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::fileSize(Inode *inode) {
+	if (inode->getFlags() & InodeFlag_Extents) {
+		typename Header::FsSize_t size = 0;
+		auto extents = (Extent*) inode->getData();
+		for (typename Header::FsSize_t i = 0; i < inode->getDataLen() / sizeof(Extent); i++) {
+			size += ptr<Inode*>(extents[i].getChunk())->getDataLen();
+		}
+		return size;
+	} else if (inode->getFlags() & InodeFlag_Compressed) {
+		return ((Compressed*) inode->getData())->getSize();
+	} else if (inode->getFlags() & InodeFlag_Shared) {
+		return blobOf(inode)->getDataLen() - sizeof(ContentHash);
+	}
+	return inode->getDataLen();
+}
+
+template<typename Header>
+int FileStore<Header>::copyOut(Inode *inode, typename Header::FsSize_t offset, uint8_t *dest, typename Header::FsSize_t len) {
+	if (inode->getFlags() & InodeFlag_Compressed) {
+		return copyOutCompressed(inode, offset, dest, len);
+	} else if (inode->getFlags() & InodeFlag_Shared) {
+		ox_memcpy(dest, blobOf(inode)->getData() + sizeof(ContentHash) + offset, len);
+		return 0;
+	} else if (!(inode->getFlags() & InodeFlag_Extents)) {
+		ox_memcpy(dest, &inode->getData()[offset], len);
+		return 0;
+	}
+	auto extents = (Extent*) inode->getData();
+	for (typename Header::FsSize_t i = 0; len && i < inode->getDataLen() / sizeof(Extent); i++) {
+		auto chunk = ptr<Inode*>(extents[i].getChunk());
+		const auto chunkLen = chunk->getDataLen();
+		if (offset >= chunkLen) {
+			offset -= chunkLen;
+			continue;
+		}
+		const auto n = chunkLen - offset < len ? chunkLen - offset : len;
+		ox_memcpy(dest, &chunk->getData()[offset], n);
+		dest += n;
+		len -= n;
+		offset = 0;
+	}
+	return 0;
+}
+
+template<typename Header>
+int FileStore<Header>::copyOutCompressed(Inode *inode, typename Header::FsSize_t offset, uint8_t *dest, typename Header::FsSize_t len) {
+	const uint64_t blockSize = Header::COMPRESS_BLOCK;
+	auto header = (Compressed*) inode->getData();
+	const uint64_t size = header->getSize();
+	auto blocks = (CompressedBlock*) (header + 1);
+	auto packed = (uint8_t*) (blocks + (size + blockSize - 1) / blockSize);
+	for (uint64_t b = offset / blockSize; len; b++) {
+		const uint64_t start = b ? blocks[b - 1].getEnd() : 0;
+		const uint64_t packedLen = blocks[b].getEnd() - start;
+		const uint64_t blockLen = size - b * blockSize < blockSize ? size - b * blockSize : blockSize;
+		const uint64_t skip = offset - b * blockSize;
+		const uint64_t n = blockLen - skip < len ? blockLen - skip : len;
+		if (packedLen == blockLen) {
+			ox_memcpy(dest, packed + start + skip, n);
+		} else if (n == blockLen) {
+			if (ox_lz4Decompress(packed + start, packedLen, dest, blockLen) != (int64_t) blockLen) {
+				return 2;
+			}
+		} else {
+			uint8_t block[blockSize];
+			if (ox_lz4Decompress(packed + start, packedLen, block, blockLen) != (int64_t) blockLen) {
+				return 2;
+			}
+			ox_memcpy(dest, block + skip, n);
+		}
+		dest += n;
+		offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::allocCompressed(const uint8_t *data, typename Header::FsSize_t dataLen) {
+	const uint64_t blockSize = Header::COMPRESS_BLOCK;
+	const uint64_t blockCount = (dataLen + blockSize - 1) / blockSize;
+	const uint64_t tableLen = sizeof(Compressed) + blockCount * sizeof(CompressedBlock);
+	// blocks that do not compress are kept as they are, so this is the most
+	// the data can take
+	if (fileInodeSize(0) + tableLen + dataLen > available()) {
+		return nullptr;
+	}
+	auto inode = allocFile(tableLen + dataLen, false);
+	if (!inode) {
+		return nullptr;
+	}
+
+	auto header = (Compressed*) inode->getData();
+	auto blocks = (CompressedBlock*) (header + 1);
+	auto packed = inode->getData() + tableLen;
+	header->setSize(dataLen);
+	uint64_t packedLen = 0;
+	for (uint64_t b = 0; b < blockCount; b++) {
+		const auto block = data + b * blockSize;
+		const uint64_t blockLen = dataLen - b * blockSize < blockSize ? dataLen - b * blockSize : blockSize;
+		auto n = ox_lz4Compress(block, blockLen, packed + packedLen, blockLen - 1);
+		if (!n) {
+			ox_memcpy(packed + packedLen, block, blockLen);
+			n = blockLen;
+		}
+		packedLen += n;
+		blocks[b].setEnd(packedLen);
+	}
+
+	// decompressing costs more than it is worth unless it saves an eighth
+	if (tableLen + packedLen > dataLen - dataLen / 8u) {
+		dealloc(inode);
+		return nullptr;
+	}
+	resizeInPlace(inode, tableLen + packedLen);
+	inode->setFlags(inode->getFlags() | InodeFlag_Compressed);
+	inode->updateChecksum();
+	return inode;
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::inflate(Inode *inode) {
+	const auto id = inode->getId();
+	const auto dataLen = fileSize(inode);
+	if ((uint64_t) fileInodeSize(0) + dataLen > available()) {
+		return nullptr;
+	}
+
+	auto dest = allocFile(dataLen);
+	if (!dest) {
+		return nullptr;
+	}
+	// alloc may have compacted, moving the inode
+	inode = getInode(ptr<Inode*>(m_header.getRootInode()), id);
+
+	dest->setId(id);
+	dest->setLinks(inode->getLinks());
+	dest->setFileType(inode->getFileType());
+	if (copyOut(inode, 0, dest->getData(), dataLen)) {
+		dealloc(dest);
+		return nullptr;
+	}
+	dest->updateChecksum();
+	release(unlink(id));
+	insert(dest);
+	return dest;
+}
+
+template<typename Header>
+int FileStore<Header>::writeShared(InodeId_t id, void *data, typename Header::FsSize_t dataLen, uint8_t fileType) {
+	const auto hash = ox_xxh64(data, dataLen);
+	auto blob = getBlob(hash);
+	if (blob && (blob->getDataLen() - sizeof(ContentHash) != dataLen ||
+	             ox_memcmp(blob->getData() + sizeof(ContentHash), data, dataLen) != 0 ||
+	             blob->getLinks() == (InodeId_t) ~0)) {
+		return -1;
+	}
+
+	auto existing = getInode(ptr<Inode*>(m_header.getRootInode()), id);
+	if (blob && existing && (existing->getFlags() & InodeFlag_Shared) && blobOf(existing) == blob) {
+		// the file already has these contents
+		retype(existing, fileType);
+		return 0;
+	}
+
+	const uint64_t refSize = fileInodeSize(sizeof(ContentHash));
+	const uint64_t blobSize = sizeof(Inode) + sizeof(ContentHash) + dataLen;
+	if (refSize + (blob ? 0 : blobSize) > available()) {
+		return 4;
+	}
+	if (!blob) {
+		blob = (Inode*) alloc(blobSize);
+		if (!blob) {
+			return 3;
+		}
+		blob->setFlags(InodeFlag_Blob);
+		((ContentHash*) blob->getData())->setHash(hash);
+		ox_memcpy(blob->getData() + sizeof(ContentHash), data, dataLen);
+		blob->updateChecksum();
+		insert(blob);
+	}
+
+	auto inode = allocFile(sizeof(ContentHash));
+	// alloc may have compacted, moving the blob
+	blob = getBlob(hash);
+	if (!inode) {
+		if (!blob->getLinks()) {
+			dealloc(detach(blob));
+		}
+		return 3;
+	}
+	// take the share before the old version of the file gives up its own,
+	// which may be of the same blob
+	dirty(blob)->setLinks(blob->getLinks() + 1);
+	existing = getInode(ptr<Inode*>(m_header.getRootInode()), id);
+	const auto links = existing ? existing->getLinks() : getSmall(id).links;
+	remove(id);
+
+	ContentHash ref;
+	ref.setHash(hash);
+	inode->setId(id);
+	inode->setLinks(links);
+	inode->setFileType(fileType);
+	inode->setFlags(inode->getFlags() | InodeFlag_Shared);
+	inode->setData(&ref, sizeof(ref));
+	if (!insert(inode)) {
+		release(inode);
+		return 2;
+	}
+	return 0;
+}
+
+template<typename Header>
+typename FileStore<Header>::SmallFile FileStore<Header>::getSmall(InodeId_t id, Inode **slab) {
+	if (!m_header.getSlabRoot()) {
+		return SmallFile();
+	}
+	auto s = getSlab(id);
+	if (slab) {
+		*slab = s;
+	}
+	return s ? slabEntry(s, id & (SLAB_IDS - 1)) : SmallFile();
+}
+
+template<typename Header>
+typename FileStore<Header>::SmallFile FileStore<Header>::slabEntry(Inode *slab, int slot) {
+	SmallFile file;
+	auto header = (SlabHeader*) slab->getData();
+	const auto present = header->getPresent();
+	if (!((present >> slot) & 1)) {
+		return file;
+	}
+	// the offsets of the files before this one come before its own
+	auto offsets = (SlabOffset*) (header + 1);
+	auto entries = (uint8_t*) (offsets + __builtin_popcountll(present));
+	const auto index = __builtin_popcountll(present & ((1ull << slot) - 1));
+	auto entry = (SlabEntry*) (entries + offsets[index].getOffset());
+	file.links = entry->getLinks();
+	file.fileType = entry->getFileType();
+	file.dataLen = entry->getDataLen();
+	file.data = entry->getData();
+	return file;
+}
+
+template<typename Header>
+int FileStore<Header>::writeSmall(InodeId_t id, void *data, typename Header::FsSize_t dataLen, uint8_t fileType) {
+	auto existing = getInode(ptr<Inode*>(m_header.getRootInode()), id);
+	if (existing && ptr(existing) == firstInode()) {
+		return 2;
+	}
+	SmallFile file;
+	file.links = existing ? existing->getLinks() : getSmall(id).links;
+	file.fileType = fileType;
+	file.dataLen = dataLen;
+	file.data = (uint8_t*) data;
+	auto err = editSlab(id, &file);
+	if (!err && existing) {
+		remove(id);
+	}
+	return err;
+}
+
+template<typename Header>
+int FileStore<Header>::editSlab(InodeId_t id, const SmallFile *file) {
+	const InodeId_t first = id & ~(InodeId_t) (SLAB_IDS - 1);
+	const int slot = id - first;
+	auto slab = getSlab(id);
+	const uint64_t oldPresent = slab ? ((SlabHeader*) slab->getData())->getPresent() : 0;
+	const uint64_t present = file ? oldPresent | 1ull << slot : oldPresent & ~(1ull << slot);
+	if (!present) {
+		if (slab) {
+			dealloc(detach(slab));
+		}
+		return 0;
+	}
+
+	// lay the new slab out in order of id
+	uint8_t buff[sizeof(SlabHeader) + SLAB_IDS * (sizeof(SlabOffset) + sizeof(SlabEntry) + Header::SLAB_MAX)];
+	((SlabHeader*) buff)->setPresent(present);
+	auto offsets = (SlabOffset*) (buff + sizeof(SlabHeader));
+	auto entries = (uint8_t*) (offsets + __builtin_popcountll(present));
+	uint64_t len = 0;
+	for (int s = 0, i = 0; s < SLAB_IDS; s++) {
+		if ((present >> s) & 1) {
+			const auto f = s == slot ? *file : slabEntry(slab, s);
+			offsets[i++].setOffset(len);
+			auto e = (SlabEntry*) (entries + len);
+			e->setLinks(f.links);
+			e->setFileType(f.fileType);
+			e->setDataLen(f.dataLen);
+			len += sizeof(SlabEntry);
+			ox_memcpy(entries + len, f.data, f.dataLen);
+			len += f.dataLen;
+		}
+	}
+	const typename Header::FsSize_t dataLen = entries + len - buff;
+
+	if (!slab || !resizeInPlace(slab, dataLen)) {
+		if (sizeof(Inode) + dataLen > available()) {
+			return 3;
+		}
+		auto dest = (Inode*) alloc(sizeof(Inode) + dataLen);
+		if (!dest) {
+			return 3;
+		}
+		if (slab) {
+			// alloc may have compacted, moving the slab
+			dealloc(detach(getSlab(id)));
+		}
+		slab = dest;
+		slab->setId(first >> Header::SLAB_SHIFT);
+		slab->setFlags(InodeFlag_Slab);
+		insert(slab);
+	}
+	dirty(ptr(slab), sizeof(Inode) + dataLen);
+	slab->setData(buff, dataLen);
+	return 0;
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::promote(InodeId_t id) {
+	const auto dataLen = getSmall(id).dataLen;
+	if (fileInodeSize(dataLen) > available()) {
+		return nullptr;
+	}
+	auto inode = allocFile(dataLen);
+	if (!inode) {
+		return nullptr;
+	}
+	// alloc may have compacted, moving the slab
+	auto small = getSmall(id);
+	inode->setId(id);
+	inode->setLinks(small.links);
+	inode->setFileType(small.fileType);
+	inode->setData(small.data, small.dataLen);
+	editSlab(id, nullptr);
+	insert(inode);
+	return inode;
+}
+
+template<typename Header>
+template<typename T>
+int FileStore<Header>::readSmall(InodeId_t id, typename Header::FsSize_t readStart,
+		typename Header::FsSize_t readSize, T *data, typename Header::FsSize_t *size) {
+	auto small = getSmall(id);
+	if (!small.data) {
+		return 1;
+	}
+	const typename Header::FsSize_t dataLen = small.dataLen;
+	if (dataLen - readStart < readSize) {
+		readSize = dataLen - readStart;
+	}
+	if (size) {
+		*size = readSize;
+	}
+	ox_memcpy(data, small.data + readStart, readSize / sizeof(T) * sizeof(T));
+	return 0;
+}
+
+template<typename Header>
+void FileStore<Header>::copyIn(Inode *inode, typename Header::FsSize_t offset, const uint8_t *src, typename Header::FsSize_t len, bool extend) {
+	if (!(inode->getFlags() & InodeFlag_Extents)) {
+		dirty(ptr(inode->getData()) + offset, len);
+		ox_memcpy(&inode->getData()[offset], src, len);
+		if (extend) {
+			dirty(inode)->setChecksum(ox_crc32c(&inode->getData()[offset], len, inode->getChecksum()));
+		} else {
+			dirty(inode)->updateChecksum();
+		}
+		return;
+	}
+	auto extents = (Extent*) inode->getData();
+	for (typename Header::FsSize_t i = 0; len && i < inode->getDataLen() / sizeof(Extent); i++) {
+		auto chunk = ptr<Inode*>(extents[i].getChunk());
+		const auto chunkLen = chunk->getDataLen();
+		if (offset >= chunkLen) {
+			offset -= chunkLen;
+			continue;
+		}
+		const auto n = chunkLen - offset < len ? chunkLen - offset : len;
+		dirty(ptr(chunk->getData()) + offset, n);
+		ox_memcpy(&chunk->getData()[offset], src, n);
+		dirty(chunk)->updateChecksum();
+		src += n;
+		len -= n;
+		offset = 0;
+	}
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::allocExtents(InodeId_t id, typename Header::FsSize_t dataLen) {
+	// the chunks are chained through m_right until the extent list exists,
+	// they are not in the tree, so nothing else reads it
+	Inode *chunks = nullptr;
+	typename Header::FsSize_t count = 0;
+	auto remaining = dataLen;
+	while (remaining) {
+		const auto space = largestAlloc();
+		// a chunk must hold more than it costs to list it
+		if (space <= sizeof(Inode) + sizeof(Extent)) {
+			break;
+		}
+		const typename Header::FsSize_t chunkLen = space - sizeof(Inode) < remaining ? space - sizeof(Inode) : remaining;
+		auto chunk = (Inode*) tryAlloc(sizeof(Inode) + chunkLen);
+		if (!chunk) {
+			break;
+		}
+		chunk->setId(id);
+		chunk->setFlags(InodeFlag_Chunk);
+		chunk->setRight(ptr(chunks));
+		chunks = chunk;
+		count++;
+		remaining -= chunkLen;
+	}
+
+	Inode *inode = nullptr;
+	if (!remaining) {
+		inode = allocFile(count * sizeof(Extent), false);
+	}
+
+	if (inode) {
+		inode->setFlags(inode->getFlags() | InodeFlag_Extents);
+		auto extents = (Extent*) inode->getData();
+		// the chain runs from the last chunk to the first
+		for (auto i = count; i > 0; i--) {
+			auto next = node(chunks->getRight());
+			chunks->setRight(0);
+			extents[i - 1].setChunk(ptr(chunks));
+			chunks = next;
+		}
+	} else {
+		while (chunks) {
+			auto next = node(chunks->getRight());
+			dealloc(chunks);
+			chunks = next;
+		}
+	}
+	return inode;
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::growExtents(Inode *inode, typename Header::FsSize_t dataLen) {
+	const auto id = inode->getId();
+	const auto count = inode->getDataLen() / sizeof(Extent);
+
+	// make room in the list first, so that the new chunk is never left
+	// unlisted, where nothing could find it to free it
+	const typename Header::FsSize_t listLen = (count + 1) * sizeof(Extent);
+	if (!resizeInPlace(inode, listLen)) {
+		inode = relocate(inode, listLen);
+		if (!inode) {
+			return nullptr;
+		}
+	}
+	dirty(&((Extent*) inode->getData())[count])->setChunk(0);
+
+	auto chunk = (Inode*) alloc(sizeof(Inode) + dataLen);
+	// alloc may have compacted, moving the inode
+	inode = getInode(ptr<Inode*>(m_header.getRootInode()), id);
+	if (!chunk) {
+		resizeInPlace(inode, count * sizeof(Extent));
+		return nullptr;
+	}
+	chunk->setId(id);
+	chunk->setFlags(InodeFlag_Chunk);
+	dirty(&((Extent*) inode->getData())[count])->setChunk(ptr(chunk));
+	return inode;
+}
+
+template<typename Header>
+void FileStore<Header>::freeExtents(Inode *inode) {
+	auto extents = (Extent*) inode->getData();
+	for (typename Header::FsSize_t i = 0; i < inode->getDataLen() / sizeof(Extent); i++) {
+		if (extents[i].getChunk()) {
+			dealloc(ptr<Inode*>(extents[i].getChunk()));
+		}
+	}
+}
+
+template<typename Header>
+void FileStore<Header>::updateChunkAddress(InodeId_t id, typename Header::FsSize_t oldAddr, typename Header::FsSize_t newAddr) {
+	auto inode = getInode(ptr<Inode*>(m_header.getRootInode()), id);
+	if (inode && (inode->getFlags() & InodeFlag_Extents)) {
+		auto extents = (Extent*) inode->getData();
+		for (typename Header::FsSize_t i = 0; i < inode->getDataLen() / sizeof(Extent); i++) {
+			if (extents[i].getChunk() == oldAddr) {
+				dirty(&extents[i])->setChunk(newAddr);
+				return;
+			}
+		}
+	}
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::largestAlloc() {
+	const auto next = nextInodeAddr();
+	typename Header::FsSize_t retval = ptr(end()) > next ? ptr(end()) - next : 0;
+	if (m_header.getOptions() & FileStoreOption_Aligned) {
+		// the Inode's padding must fit too
+		retval &= ~(typename Header::FsSize_t) (PAYLOAD_ALIGN - 1);
+	}
+	// the largest gap is in the largest non-empty class
+	for (auto i = (int) Header::SIZE_CLASSES - 1; i >= 0; i--) {
+		auto addr = m_header.getFreeList(i);
+		if (addr) {
+			for (; addr; addr = ptr<FreeBlock*>(addr)->getNext()) {
+				auto block = ptr<FreeBlock*>(addr);
+				if (block->getSize() > retval) {
+					retval = block->getSize();
+				}
+			}
+			break;
+		}
+	}
+	return retval;
+}
+
+template<typename Header>
+int FileStore<Header>::remove(InodeId_t id) {
+	auto removed = unlink(id);
+	if (removed) {
+		release(removed);
+		return 0;
+	} else if (getSmall(id).data) {
+		return editSlab(id, nullptr);
+	} else {
+		return 1;
+	}
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::unlink(InodeId_t id) {
+	Inode *removed = nullptr;
+	auto root = remove(node(m_header.getRootInode()), id, &removed);
+	if (removed) {
+		m_header.setRootInode(ptr(root));
+		unlinkType(removed);
+	}
+	return removed;
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::detach(Inode *inode) {
+	Inode *removed = nullptr;
+	auto root = remove(node(rootOf(inode)), keyOf(inode), &removed);
+	if (removed) {
+		setRootOf(inode, ptr(root));
+	}
+	return inode;
+}
+
+template<typename Header>
+void FileStore<Header>::release(Inode *inode) {
+	if (inode->getFlags() & InodeFlag_Extents) {
+		freeExtents(inode);
+	} else if (inode->getFlags() & InodeFlag_Shared) {
+		auto blob = blobOf(inode);
+		if (blob && blob->getLinks() > 1) {
+			dirty(blob)->setLinks(blob->getLinks() - 1);
+		} else if (blob) {
+			dealloc(detach(blob));
+		}
+	}
+	dealloc(inode);
+}
+
+template<typename Header>
+bool FileStore<Header>::frees(Inode *inode, Inode *other) {
+	if (other->getFlags() & InodeFlag_Chunk) {
+		return other->getId() == inode->getId() && (inode->getFlags() & InodeFlag_Extents);
+	} else if (other->getFlags() & InodeFlag_Blob) {
+		return other->getLinks() <= 1 && (inode->getFlags() & InodeFlag_Shared) &&
+		       ((ContentHash*) inode->getData())->getHash() == keyOf(other);
+	}
+	return false;
+}
+
+/**
+ * Increments the links of the inode of the given ID.
+ * @param id the id of the inode
+ */
+template<typename Header>
+int FileStore<Header>::incLinks(InodeId_t id, typename Header::FsSize_t hint) {
+	auto inode = getInode(id, hint);
+	Inode *slab = nullptr;
+	auto small = inode ? SmallFile() : getSmall(id, &slab);
+	if (inode) {
+		dirty(inode)->setLinks(inode->getLinks() + 1);
+		return 0;
+	} else if (small.data) {
+		auto entry = (SlabEntry*) small.data - 1;
+		dirty(ptr(entry), sizeof(SlabEntry));
+		entry->setLinks(small.links + 1);
+		dirty(slab)->updateChecksum();
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+/**
+ * Decrements the links of the inode of the given ID.
+ * @param id the id of the inode
+ */
+template<typename Header>
+int FileStore<Header>::decLinks(InodeId_t id, typename Header::FsSize_t hint) {
+	auto inode = getInode(id, hint);
+	Inode *slab = nullptr;
+	auto small = inode ? SmallFile() : getSmall(id, &slab);
+	if (inode) {
+		dirty(inode)->setLinks(inode->getLinks() - 1);
+		return 0;
+	} else if (small.data) {
+		auto entry = (SlabEntry*) small.data - 1;
+		dirty(ptr(entry), sizeof(SlabEntry));
+		entry->setLinks(small.links - 1);
+		dirty(slab)->updateChecksum();
+		return 0;
+	} else {
+		return 1;
+	}
 }
 
 template<typename Header>
-uint8_t FileStore<Header>::Inode::getFileType() {
-	return bigEndianAdapt(m_fileType);
+typename FileStore<Header>::Inode *FileStore<Header>::remove(Inode *root, uint64_t key, Inode **removed) {
+	if (root) {
+		if (keyOf(root) > key) {
+			auto left = remove(node(root->getLeft()), key, removed);
+			if (ptr(left) != root->getLeft()) {
+				dirty(root)->setLeft(ptr(left));
+			}
+		} else if (keyOf(root) < key) {
+			auto right = remove(node(root->getRight()), key, removed);
+			if (ptr(right) != root->getRight()) {
+				dirty(root)->setRight(ptr(right));
+			}
+		} else if (ptr(root) != firstInode()) {
+			*removed = root;
+			root = merge(node(root->getLeft()), node(root->getRight()));
+		}
+	}
+	return root;
 }
 
 template<typename Header>
-void FileStore<Header>::Inode::setLeft(typename Header::FsSize_t left) {
-	this->m_left = bigEndianAdapt(left);
+typename FileStore<Header>::Inode *FileStore<Header>::merge(Inode *left, Inode *right) {
+	if (!left) {
+		return right;
+	} else if (!right) {
+		return left;
+	} else if (higherPriority(left, right)) {
+		dirty(left)->setRight(ptr(merge(node(left->getRight()), right)));
+		return left;
+	} else {
+		dirty(right)->setLeft(ptr(merge(left, node(right->getLeft()))));
+		return right;
+	}
 }
 
 template<typename Header>
-typename Header::FsSize_t FileStore<Header>::Inode::getLeft() {
-	return bigEndianAdapt(m_left);
+typename FileStore<Header>::StatInfo FileStore<Header>::statOf(Inode *inode) {
+	StatInfo stat;
+	stat.size = fileSize(inode);
+	stat.fileType = inode->getFileType();
+	stat.links = inode->getLinks();
+	stat.inodeId = inode->getId();
+	return stat;
 }
 
 template<typename Header>
-void FileStore<Header>::Inode::setRight(typename Header::FsSize_t right) {
-	this->m_right = bigEndianAdapt(right);
+template<typename Predicate>
+typename FileStore<Header>::Inode *FileStore<Header>::filter(Inode *root, Predicate &predicate, Inode **removed) {
+	if (root) {
+		auto left = filter(node(root->getLeft()), predicate, removed);
+		auto right = filter(node(root->getRight()), predicate, removed);
+		if (ptr(root) != firstInode() && predicate(statOf(root))) {
+			auto joined = merge(left, right);
+			unlinkType(root);
+			dirty(root)->setLeft(0);
+			root->setRight(ptr(*removed));
+			*removed = root;
+			return joined;
+		}
+		if (ptr(left) != root->getLeft()) {
+			dirty(root)->setLeft(ptr(left));
+		}
+		if (ptr(right) != root->getRight()) {
+			dirty(root)->setRight(ptr(right));
+		}
+	}
+	return root;
 }
 
 template<typename Header>
-typename Header::FsSize_t FileStore<Header>::Inode::getRight() {
-	return bigEndianAdapt(m_right);
+int FileStore<Header>::removeAllType(uint8_t fileType) {
+	auto predicate = [fileType](const StatInfo &stat) {
+		return stat.fileType == fileType;
+	};
+	if (!(m_header.getOptions() & FileStoreOption_TypeIndex)) {
+		return removeIf(predicate);
+	}
+
+	// the type index has the files, so the rest of the tree is left alone
+	int err = removeSmallIf(predicate);
+	auto inode = node(m_header.getTypeList(fileType % TYPE_LISTS));
+	while (inode) {
+		auto next = node(typeLinks(inode)->getNext());
+		if (inode->getFileType() == fileType) {
+			release(unlink(inode->getId()));
+		}
+		inode = next;
+	}
+	return err;
 }
 
 template<typename Header>
-void FileStore<Header>::Inode::setData(void *data, typename Header::FsSize_t size) {
-	ox_memcpy(getData(), data, size);
-	setDataLen(size);
+template<typename Predicate>
+int FileStore<Header>::removeIf(Predicate predicate) {
+	int err = removeSmallIf(predicate);
+
+	// the rest are taken out of the tree first, as releasing a file clears
+	// the links of its inode
+	Inode *removed = nullptr;
+	auto root = filter(node(m_header.getRootInode()), predicate, &removed);
+	if (ptr(root) != m_header.getRootInode()) {
+		m_header.setRootInode(ptr(root));
+	}
+	// each file's gap is indexed as it goes, which costs less than
+	// reindexing the whole store unless most of it goes
+	while (removed) {
+		auto inode = removed;
+		removed = node(inode->getRight());
+		release(inode);
+	}
+
+	return err;
 }
 
 template<typename Header>
-uint8_t *FileStore<Header>::Inode::getData() {
-	return (uint8_t*) (this + 1);
+template<typename Predicate>
+int FileStore<Header>::removeSmallIf(Predicate &predicate) {
+	int err = 0;
+	if (!m_header.getSlabRoot()) {
+		return err;
+	}
+
+	// removing the files rewrites the slab in place, or removes it once it
+	// is empty, it does not move anything else
+	auto first = ptr<Inode*>(firstInode());
+	auto next = ptr<Inode*>(first->getNext());
+	while (next != first) {
+		auto current = next;
+		// get next before current is possibly cleared
+		next = ptr<Inode*>(current->getNext());
+		if (current->getFlags() & InodeFlag_Slab) {
+			const InodeId_t base = current->getId() << Header::SLAB_SHIFT;
+			uint64_t doomed = 0;
+			for (int s = 0; s < SLAB_IDS; s++) {
+				auto small = slabEntry(current, s);
+				if (small.data) {
+					StatInfo stat;
+					stat.size = small.dataLen;
+					stat.fileType = small.fileType;
+					stat.links = small.links;
+					stat.inodeId = base + s;
+					if (predicate(stat)) {
+						doomed |= 1ull << s;
+					}
+				}
+			}
+			for (int s = 0; s < SLAB_IDS; s++) {
+				if ((doomed >> s) & 1) {
+					err |= editSlab(base + s, nullptr);
+				}
+			}
+		}
+	}
+	return err;
 }
 
+template<typename Header>
+template<typename Callback>
+int FileStore<Header>::forEachOfType(uint8_t fileType, Callback cb) {
+	int err = 0;
+	if (m_header.getOptions() & FileStoreOption_TypeIndex) {
+		auto inode = node(m_header.getTypeList(fileType % TYPE_LISTS));
+		for (; !err && inode; inode = node(typeLinks(inode)->getNext())) {
+			if (inode->getFileType() == fileType) {
+				err = cb(statOf(inode));
+			}
+		}
+	} else {
+		auto first = ptr<Inode*>(firstInode());
+		auto inode = ptr<Inode*>(first->getNext());
+		for (; !err && inode != first; inode = ptr<Inode*>(inode->getNext())) {
+			if (inode->getFileType() == fileType &&
+			    !(inode->getFlags() & (InodeFlag_Chunk | InodeFlag_Blob | InodeFlag_Slab))) {
+				err = cb(statOf(inode));
+			}
+		}
+	}
+	if (!err) {
+		err = forEachSmallOfType(node(m_header.getSlabRoot()), fileType, cb);
+	}
+	return err;
+}
 
-// FileStore
+template<typename Header>
+template<typename Callback>
+int FileStore<Header>::forEachSmallOfType(Inode *root, uint8_t fileType, Callback &cb) {
+	int err = 0;
+	if (root) {
+		const InodeId_t base = root->getId() << Header::SLAB_SHIFT;
+		for (int s = 0; !err && s < SLAB_IDS; s++) {
+			auto small = slabEntry(root, s);
+			if (small.data && small.fileType == fileType) {
+				StatInfo stat;
+				stat.size = small.dataLen;
+				stat.fileType = small.fileType;
+				stat.links = small.links;
+				stat.inodeId = base + s;
+				err = cb(stat);
+			}
+		}
+		if (!err) {
+			err = forEachSmallOfType(node(root->getLeft()), fileType, cb);
+		}
+		if (!err) {
+			err = forEachSmallOfType(node(root->getRight()), fileType, cb);
+		}
+	}
+	return err;
+}
 
 template<typename Header>
-int FileStore<Header>::dumpTo(FileStore<Header> *dest) {
-	if (dest->size() >= size()) {
-		auto i = ptr<Inode*>(firstInode());
-		do {
-			dest->write(i->getId(), i->getData(), i->getDataLen(), i->getFileType());
-			i = ptr<Inode*>(i->getNext());
-		} while (ptr(i) != firstInode());
-		return 0;
-	} else {
-		return -1;
+typename FileStore<Header>::TypeLinks *FileStore<Header>::typeLinks(Inode *inode) {
+	if (!(inode->getFlags() & InodeFlag_TypeLinks)) {
+		return nullptr;
 	}
+	return (TypeLinks*) (inode->getData() + inode->getDataLen());
 }
 
 template<typename Header>
-void FileStore<Header>::resize(typename Header::FsSize_t size) {
-	if (size < m_header.getSize()) {
-		// shrink file store
-		if (m_header.getMemUsed() > size) {
-			size = m_header.getMemUsed();
+typename Header::FsSize_t FileStore<Header>::fileInodeSize(typename Header::FsSize_t dataLen) {
+	const auto links = m_header.getOptions() & FileStoreOption_TypeIndex;
+	return sizeof(Inode) + dataLen + (links ? sizeof(TypeLinks) : 0);
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::allocFile(typename Header::FsSize_t dataLen, bool compact) {
+	const auto size = fileInodeSize(dataLen);
+	auto inode = (Inode*) (compact ? alloc(size) : tryAlloc(size));
+	// alloc zeroed the links along with the rest
+	if (inode && size != sizeof(Inode) + dataLen) {
+		inode->setDataLen(dataLen);
+		inode->setFlags(InodeFlag_TypeLinks);
+	}
+	return inode;
+}
+
+template<typename Header>
+bool FileStore<Header>::addTypeLinks(Inode *inode) {
+	const auto addr = ptr(inode);
+	const auto limit = inode->getNext() == firstInode() ? ptr(end()) : inode->getNext();
+	const auto oldSize = inode->size();
+	const auto size = oldSize + sizeof(TypeLinks);
+	if (footprint(size) > limit - addr) {
+		return false;
+	}
+
+	unindexGap(inode);
+	m_header.setMemUsed(m_header.getMemUsed() - footprint(oldSize) + footprint(size));
+	dirty(addr + oldSize, sizeof(TypeLinks));
+	dirty(inode)->setFlags(inode->getFlags() | InodeFlag_TypeLinks);
+	ox_memset(typeLinks(inode), 0, sizeof(TypeLinks));
+	indexGap(inode);
+	return true;
+}
+
+template<typename Header>
+void FileStore<Header>::dropTypeLinks(Inode *inode) {
+	const auto oldSize = inode->size();
+	unindexGap(inode);
+	dirty(inode)->setFlags(inode->getFlags() & ~InodeFlag_TypeLinks);
+	m_header.setMemUsed(m_header.getMemUsed() - footprint(oldSize) + footprint(inode->size()));
+	indexGap(inode);
+
+	if (ptr(inode) < m_header.getCompactCursor() && gapAfter(inode)) {
+		m_header.setCompactCursor(ptr(inode));
+	}
+}
+
+template<typename Header>
+void FileStore<Header>::linkType(Inode *inode) {
+	auto links = typeLinks(inode);
+	if (links) {
+		const auto list = inode->getFileType() % TYPE_LISTS;
+		const auto head = m_header.getTypeList(list);
+		dirty(links)->setPrev(0);
+		links->setNext(head);
+		if (head) {
+			dirty(typeLinks(ptr<Inode*>(head)))->setPrev(ptr(inode));
 		}
-		compact();
-		m_header.setSize(size);
-	} else if (size > m_header.getSize()) {
-		// grow file store
-		m_header.setSize(size);
+		m_header.setTypeList(list, ptr(inode));
 	}
 }
 
 template<typename Header>
-int FileStore<Header>::write(InodeId_t id, void *data, typename Header::FsSize_t dataLen, uint8_t fileType) {
-	auto retval = 1;
-	const typename Header::FsSize_t size = sizeof(Inode) + dataLen;
-	if (size <= (m_header.getSize() - m_header.getMemUsed())) {
-		auto inode = (Inode*) alloc(size);
-		if (inode) {
-			remove(id);
-			inode->setId(id);
-			inode->setFileType(fileType);
-			inode->setData(data, dataLen);
-			auto root = ptr<Inode*>(m_header.getRootInode());
-			if (insert(root, inode) || root == inode) {
-				retval = 0;
-			} else {
-				dealloc(inode);
-				retval = 2;
-			}
+void FileStore<Header>::unlinkType(Inode *inode) {
+	auto links = typeLinks(inode);
+	if (links) {
+		const auto prev = links->getPrev();
+		const auto next = links->getNext();
+		if (prev) {
+			dirty(typeLinks(ptr<Inode*>(prev)))->setNext(next);
 		} else {
-			retval = 3;
+			m_header.setTypeList(inode->getFileType() % TYPE_LISTS, next);
 		}
-	} else {
-		retval = 4;
+		if (next) {
+			dirty(typeLinks(ptr<Inode*>(next)))->setPrev(prev);
+		}
+		dirty(links)->setPrev(0);
+		links->setNext(0);
 	}
-	return retval;
 }
 
 template<typename Header>
-int FileStore<Header>::remove(InodeId_t id) {
-	return remove(ptr<Inode*>(m_header.getRootInode()), id);
+void FileStore<Header>::retype(Inode *inode, uint8_t fileType) {
+	if (inode->getFileType() != fileType) {
+		unlinkType(inode);
+		dirty(inode)->setFileType(fileType);
+		linkType(inode);
+	}
 }
 
-/**
- * Increments the links of the inode of the given ID.
- * @param id the id of the inode
- */
 template<typename Header>
-int FileStore<Header>::incLinks(InodeId_t id) {
-	auto inode = getInode(ptr<Inode*>(m_header.getRootInode()), id);
-	if (inode) {
-		inode->setLinks(inode->getLinks() + 1);
-		return 0;
-	} else {
-		return 1;
+void FileStore<Header>::updateTypeAddress(Inode *inode, typename Header::FsSize_t oldAddr, typename Header::FsSize_t newAddr) {
+	auto links = typeLinks(inode);
+	if (!links) {
+		return;
+	}
+	if (links->getPrev()) {
+		dirty(typeLinks(ptr<Inode*>(links->getPrev())))->setNext(newAddr);
+	} else if (m_header.getTypeList(inode->getFileType() % TYPE_LISTS) == oldAddr) {
+		m_header.setTypeList(inode->getFileType() % TYPE_LISTS, newAddr);
+	}
+	if (links->getNext()) {
+		dirty(typeLinks(ptr<Inode*>(links->getNext())))->setPrev(newAddr);
 	}
 }
 
-/**
- * Decrements the links of the inode of the given ID.
- * @param id the id of the inode
- */
 template<typename Header>
-int FileStore<Header>::decLinks(InodeId_t id) {
-	auto inode = getInode(ptr<Inode*>(m_header.getRootInode()), id);
-	if (inode) {
-		inode->setLinks(inode->getLinks() - 1);
-		return 0;
-	} else {
-		return 1;
+void FileStore<Header>::rebuildTypeLists() {
+	for (int i = 0; i < (int) Header::TYPE_LISTS; i++) {
+		m_header.setTypeList(i, 0);
 	}
+	auto first = ptr<Inode*>(firstInode());
+	auto inode = first;
+	do {
+		linkType(inode);
+		inode = ptr<Inode*>(inode->getNext());
+	} while (inode != first);
 }
 
 template<typename Header>
-int FileStore<Header>::remove(Inode *root, InodeId_t id) {
-	auto err = 1;
+void FileStore<Header>::dealloc(Inode *inode) {
+	auto next = ptr<Inode*>(inode->getNext());
+	auto prev = ptr<Inode*>(inode->getPrev());
+	const auto size = inode->size();
+	unindexGap(prev);
+	unindexGap(inode);
+	dirty(prev)->setNext(ptr(next));
+	dirty(next)->setPrev(ptr(prev));
 
-	if (root->getId() > id) {
-		if (root->getLeft()) {
-			auto left = ptr<Inode*>(root->getLeft());
-			if (left->getId() != id) {
-				err = remove(left, id);
-			} else {
-				root->setLeft(0);
-				// pass children to parent
-				if (left->getRight()) {
-					insert(root, ptr<Inode*>(left->getRight()));
-				}
-				if (left->getLeft()) {
-					insert(root, ptr<Inode*>(left->getLeft()));
-				}
-				dealloc(left);
-				err = 0;
-			}
+	m_header.setMemUsed(m_header.getMemUsed() - footprint(size));
+
+	dirty(ptr(inode), size);
+	ox_memset(inode, 0, size);
+
+	// the gap before the inode, the inode, and the gap after it are now one
+	indexGap(prev);
+
+	if (ptr(inode) <= m_header.getCompactCursor()) {
+		m_header.setCompactCursor(ptr(prev));
+	}
+}
+
+template<typename Header>
+void FileStore<Header>::updateInodeAddress(InodeId_t id, typename Header::FsSize_t oldAddr, typename Header::FsSize_t newAddr) {
+	if (m_header.getRootInode() == oldAddr) {
+		m_header.setRootInode(newAddr);
+		return;
+	}
+	auto parent = getInodeParent(ptr<Inode*>(m_header.getRootInode()), id, oldAddr);
+	if (parent) {
+		if (parent->getLeft() == oldAddr) {
+			dirty(parent)->setLeft(newAddr);
+		} else if (parent->getRight() == oldAddr) {
+			dirty(parent)->setRight(newAddr);
 		}
-	} else if (root->getId() < id) {
-		if (root->getRight()) {
-			auto right = ptr<Inode*>(root->getRight());
-			if (right->getId() != id) {
-				err = remove(right, id);
-			} else {
-				root->setRight(0);
-				// pass children to parent
-				if (right->getRight()) {
-					insert(root, ptr<Inode*>(right->getRight()));
-				}
-				if (right->getLeft()) {
-					insert(root, ptr<Inode*>(right->getLeft()));
-				}
-				dealloc(right);
-				err = 0;
-			}
+	}
+}
+
+template<typename Header>
+void FileStore<Header>::updateTreeAddress(Inode *inode, typename Header::FsSize_t oldAddr, typename Header::FsSize_t newAddr) {
+	if (rootOf(inode) == oldAddr) {
+		setRootOf(inode, newAddr);
+		return;
+	}
+	auto parent = getInodeParent(ptr<Inode*>(rootOf(inode)), keyOf(inode), oldAddr);
+	if (parent) {
+		if (parent->getLeft() == oldAddr) {
+			dirty(parent)->setLeft(newAddr);
+		} else if (parent->getRight() == oldAddr) {
+			dirty(parent)->setRight(newAddr);
 		}
-	} else if (ptr<Inode*>(m_header.getRootInode())->getId() == id) {
-		m_header.setRootInode(root->getRight());
-		if (root->getLeft()) {
-			insert(ptr<Inode*>(m_header.getRootInode()), ptr<Inode*>(root->getLeft()));
+	}
+}
+
+template<typename Header>
+int FileStore<Header>::read(InodeId_t id, void *data, typename Header::FsSize_t *size, typename Header::FsSize_t hint) {
+	auto inode = getInode(id, hint);
+	if (!inode) {
+		Inode *slab = nullptr;
+		auto small = getSmall(id, &slab);
+		if (!small.data) {
+			return 1;
+		} else if (!slab->checksumValid()) {
+			return 2;
 		}
-		dealloc(root);
-		err = 0;
+		return readSmall(id, 0, small.dataLen, (uint8_t*) data, size);
+	} else if (!intact(inode)) {
+		return 2;
 	}
+	return read(inode, 0, fileSize(inode), (uint8_t*) data, size);
+}
 
-	return err;
+template<typename Header>
+int FileStore<Header>::read(InodeId_t id, typename Header::FsSize_t readStart,
+		typename Header::FsSize_t readSize, void *data, typename Header::FsSize_t *size,
+		typename Header::FsSize_t hint) {
+	auto inode = getInode(id, hint);
+	if (!inode) {
+		return readSmall(id, readStart, readSize, (uint8_t*) data, size);
+	}
+	return read<uint8_t>(inode, readStart, readSize, (uint8_t*) data, size);
 }
 
 template<typename Header>
-int FileStore<Header>::removeAllType(uint8_t fileType) {
-	int err = 0;
-	auto first = ptr<Inode*>(firstInode());
-	// skip the first inode for now, because removing the first inode will cause compact to run
-	auto current = first;
-	auto next = ptr<Inode*>(current->getNext());
+template<typename T>
+int FileStore<Header>::read(InodeId_t id, typename Header::FsSize_t readStart,
+		typename Header::FsSize_t readSize, T *data, typename Header::FsSize_t *size) {
+	auto inode = getInode(ptr<Inode*>(m_header.getRootInode()), id);
+	return inode ? read(inode, readStart, readSize, data, size) : readSmall(id, readStart, readSize, data, size);
+}
 
-	while (next != first) {
-		current = next;
-		// get next before current is possibly cleared
-		next = ptr<Inode*>(current->getNext());
+template<typename Header>
+template<typename T>
+int FileStore<Header>::read(Inode *inode, typename Header::FsSize_t readStart,
+		typename Header::FsSize_t readSize, T *data, typename Header::FsSize_t *size) {
+	// be sure read size is not greater than what is available to read
+	const auto dataLen = fileSize(inode);
+	if (dataLen - readStart < readSize) {
+		readSize = dataLen - readStart;
+	}
+	if (size) {
+		*size = readSize;
+	}
 
-		if (current->getFileType() == fileType) {
-			err |= remove(current->getId());
-		}
+	// the data is stored as the bytes of the Ts, so it can be copied in bulk
+	return copyOut(inode, readStart, (uint8_t*) data, readSize / sizeof(T) * sizeof(T));
+}
+
+template<typename Header>
+typename FileStore<Header>::View FileStore<Header>::view(InodeId_t id, typename Header::FsSize_t hint) {
+	auto inode = getInode(id, hint);
+	auto small = inode ? SmallFile() : getSmall(id);
+	View view;
+	if (inode && (inode->getFlags() & InodeFlag_Shared)) {
+		auto blob = blobOf(inode);
+		view.data = blob->getData() + sizeof(ContentHash);
+		view.size = blob->getDataLen() - sizeof(ContentHash);
+	} else if (inode && !(inode->getFlags() & (InodeFlag_Extents | InodeFlag_Compressed))) {
+		view.data = inode->getData();
+		view.size = inode->getDataLen();
+	} else if (small.data) {
+		view.data = small.data;
+		view.size = small.dataLen;
+	} else {
+		view.data = nullptr;
+		view.size = 0;
+	}
+	return view;
+}
+
+template<typename Header>
+typename FileStore<Header>::StatInfo FileStore<Header>::stat(InodeId_t id, typename Header::FsSize_t hint) {
+	auto inode = getInode(id, hint);
+	auto small = inode ? SmallFile() : getSmall(id);
+	StatInfo stat;
+	if (inode) {
+		stat = statOf(inode);
+	} else if (small.data) {
+		stat.size = small.dataLen;
+		stat.fileType = small.fileType;
+		stat.links = small.links;
+		stat.inodeId = id;
+	} else {
+		stat.inodeId = 0;
 	}
+	return stat;
+}
 
-	if (first->getFileType() == fileType) {
-		err |= remove(first->getId());
+template<typename Header>
+int FileStore<Header>::verify(InodeId_t id, typename Header::FsSize_t hint) {
+	auto inode = getInode(id, hint);
+	if (!inode) {
+		Inode *slab = nullptr;
+		if (!getSmall(id, &slab).data) {
+			return 1;
+		}
+		return slab->checksumValid() ? 0 : 2;
 	}
+	return intact(inode) ? 0 : 2;
+}
+
+template<typename Header>
+int FileStore<Header>::verifyAll() {
+	int bad = 0;
+	const auto first = firstInode();
+	const auto size = m_header.getSize();
+	auto addr = first;
+	do {
+		// the buffer may be corrupt anywhere, so nothing is followed before
+		// it is known to be in bounds
+		if (addr > size - sizeof(Inode)) {
+			return -1;
+		}
+		auto inode = ptr<Inode*>(addr);
+		const auto next = inode->getNext();
+		if (inode->getDataLen() > size - addr - sizeof(Inode) ||
+		    (next != first && next < addr + inode->size())) {
+			return -1;
+		}
 
-	return err;
+		auto ok = inode->checksumValid();
+		if (ok && (inode->getFlags() & InodeFlag_Extents)) {
+			// the chunks' own checksums are checked as the pass reaches them
+			auto extents = (Extent*) inode->getData();
+			for (typename Header::FsSize_t i = 0; ok && i < inode->getDataLen() / sizeof(Extent); i++) {
+				const auto chunk = extents[i].getChunk();
+				ok = chunk >= first && chunk <= size - sizeof(Inode) &&
+				     (ptr<Inode*>(chunk)->getFlags() & InodeFlag_Chunk) &&
+				     ptr<Inode*>(chunk)->getId() == inode->getId();
+			}
+		}
+		bad += !ok;
+		addr = next;
+	} while (addr != first);
+	return bad;
 }
 
 template<typename Header>
-void FileStore<Header>::dealloc(Inode *inode) {
-	auto next = ptr<Inode*>(inode->getNext());
-	auto prev = ptr<Inode*>(inode->getPrev());
-	prev->setNext(ptr(next));
-	next->setPrev(ptr(prev));
-
-	m_header.setMemUsed(m_header.getMemUsed() - inode->size());
+void FileStore<Header>::setDedup(bool dedup) {
+	const uint16_t options = m_header.getOptions() & ~FileStoreOption_Dedup;
+	m_header.setOptions(dedup ? options | FileStoreOption_Dedup : options);
+}
 
-	ox_memset(inode, 0, inode->size());
+template<typename Header>
+bool FileStore<Header>::dedup() {
+	return m_header.getOptions() & FileStoreOption_Dedup;
 }
 
 template<typename Header>
-void FileStore<Header>::updateInodeAddress(InodeId_t id, typename Header::FsSize_t oldAddr, typename Header::FsSize_t newAddr) {
-	auto parent = getInodeParent(ptr<Inode*>(m_header.getRootInode()), id, oldAddr);
-	if (parent) {
-		if (parent->getLeft() == oldAddr) {
-			parent->setLeft(newAddr);
-		} else if (parent->getRight() == oldAddr) {
-			parent->setRight(newAddr);
+int64_t FileStore<Header>::dedupSaved() {
+	int64_t saved = 0;
+	auto first = ptr<Inode*>(firstInode());
+	auto inode = first;
+	do {
+		if (inode->getFlags() & InodeFlag_Blob) {
+			// without the blob, each file sharing it would hold the data
+			// where it now holds the hash
+			const int64_t links = inode->getLinks();
+			const int64_t dataLen = inode->getDataLen() - sizeof(ContentHash);
+			saved += links * (dataLen - (int64_t) sizeof(ContentHash)) - (int64_t) inode->size();
 		}
-	}
+		inode = ptr<Inode*>(inode->getNext());
+	} while (inode != first);
+	return saved;
 }
 
 template<typename Header>
-int FileStore<Header>::read(InodeId_t id, void *data, typename Header::FsSize_t *size) {
-	auto inode = getInode(ptr<Inode*>(m_header.getRootInode()), id);
-	return inode ? read(inode, 0, inode->getDataLen(), (uint8_t*) data, size) : 1;
+void FileStore<Header>::setSlabs(bool slabs) {
+	const uint16_t options = m_header.getOptions() & ~FileStoreOption_Slabs;
+	m_header.setOptions(slabs ? options | FileStoreOption_Slabs : options);
 }
 
 template<typename Header>
-int FileStore<Header>::read(InodeId_t id, typename Header::FsSize_t readStart,
-		typename Header::FsSize_t readSize, void *data, typename Header::FsSize_t *size) {
-	auto inode = getInode(ptr<Inode*>(m_header.getRootInode()), id);
-	return inode ? read<uint8_t>(inode, readStart, readSize, (uint8_t*) data, size) : 1;
+bool FileStore<Header>::slabs() {
+	return m_header.getOptions() & FileStoreOption_Slabs;
 }
 
 template<typename Header>
-template<typename T>
-int FileStore<Header>::read(InodeId_t id, typename Header::FsSize_t readStart,
-		typename Header::FsSize_t readSize, T *data, typename Header::FsSize_t *size) {
-	auto inode = getInode(ptr<Inode*>(m_header.getRootInode()), id);
-	return inode ? read(inode, readStart, readSize, data, size) : 1;
+void FileStore<Header>::setCompress(bool compress) {
+	const uint16_t options = m_header.getOptions() & ~FileStoreOption_Compress;
+	m_header.setOptions(compress ? options | FileStoreOption_Compress : options);
 }
 
 template<typename Header>
-template<typename T>
-int FileStore<Header>::read(Inode *inode, typename Header::FsSize_t readStart,
-		typename Header::FsSize_t readSize, T *data, typename Header::FsSize_t *size) {
-	// be sure read size is not greater than what is available to read
-	if (inode->getDataLen() - readStart < readSize) {
-		readSize = inode->getDataLen() - readStart;
-	}
-	if (size) {
-		*size = readSize;
+bool FileStore<Header>::compress() {
+	return m_header.getOptions() & FileStoreOption_Compress;
+}
+
+template<typename Header>
+int FileStore<Header>::setTypeIndex(bool typeIndex) {
+	if (typeIndex == this->typeIndex()) {
+		return 0;
 	}
+	const uint16_t options = m_header.getOptions() & ~FileStoreOption_TypeIndex;
+	m_header.setOptions(typeIndex ? options | FileStoreOption_TypeIndex : options);
 
-	readSize /= sizeof(T);
-	uint8_t *it = &(inode->getData()[readStart]);
-	for (typename Header::FsSize_t i = 0; i < readSize; i++) {
-		T val;
-		for (size_t i = 0; i < sizeof(T); i++) {
-			((uint8_t*) (&val))[i] = *(it++);
+	// files only carry TypeLinks while the index is on
+	auto first = ptr<Inode*>(firstInode());
+	auto inode = ptr<Inode*>(first->getNext());
+	while (inode != first) {
+		auto next = ptr<Inode*>(inode->getNext());
+		if (!typeIndex) {
+			if (typeLinks(inode)) {
+				dropTypeLinks(inode);
+			}
+		} else if (!(inode->getFlags() & (InodeFlag_Chunk | InodeFlag_Blob | InodeFlag_Slab | InodeFlag_TypeLinks))
+		           && !addTypeLinks(inode)) {
+			const auto moves = m_header.getMoves();
+			if (!relocate(inode, inode->getDataLen())) {
+				setTypeIndex(false);
+				return 3;
+			}
+			// the files already done have their links, so after a compaction
+			// it is enough to start over
+			if (m_header.getMoves() != moves) {
+				next = ptr<Inode*>(first->getNext());
+			}
 		}
-		*(data++) = val;
+		inode = next;
 	}
+	rebuildTypeLists();
 	return 0;
 }
 
 template<typename Header>
-typename FileStore<Header>::StatInfo FileStore<Header>::stat(InodeId_t id) {
+bool FileStore<Header>::typeIndex() {
+	return m_header.getOptions() & FileStoreOption_TypeIndex;
+}
+
+template<typename Header>
+int64_t FileStore<Header>::slabSaved() {
+	int64_t saved = 0;
+	auto first = ptr<Inode*>(firstInode());
+	auto inode = first;
+	do {
+		if (inode->getFlags() & InodeFlag_Slab) {
+			// each file would otherwise have had an Inode, where it now has
+			// its share of the slab less its data
+			int64_t overhead = sizeof(Inode) + inode->getDataLen();
+			for (int s = 0; s < SLAB_IDS; s++) {
+				auto small = slabEntry(inode, s);
+				if (small.data) {
+					saved += fileInodeSize(0);
+					overhead -= small.dataLen;
+				}
+			}
+			saved -= overhead;
+		}
+		inode = ptr<Inode*>(inode->getNext());
+	} while (inode != first);
+	return saved;
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::find(InodeId_t id) {
 	auto inode = getInode(ptr<Inode*>(m_header.getRootInode()), id);
-	StatInfo stat;
-	if (inode) {
-		stat.size = inode->getDataLen();
-		stat.fileType = inode->getFileType();
-		stat.links = inode->getLinks();
-		stat.inodeId = id;
-	} else {
-		stat.inodeId = 0;
-	}
-	return stat;
+	// the sentinel is not a file
+	return inode && ptr(inode) != firstInode() ? ptr(inode) : 0;
 }
 
 template<typename Header>
 typename Header::FsSize_t FileStore<Header>::spaceNeeded(typename Header::FsSize_t size) {
-	return sizeof(Inode) + size;
+	return footprint(fileInodeSize(size));
 }
 
 template<typename Header>
@@ -765,23 +3661,66 @@ typename FileStore<Header>::Inode *FileStore<Header>::getInode(Inode *root, Inod
 }
 
 template<typename Header>
-typename FileStore<Header>::Inode *FileStore<Header>::getInodeParent(Inode *root, InodeId_t id, typename Header::FsSize_t targetAddr) {
+typename FileStore<Header>::Inode *FileStore<Header>::getInode(InodeId_t id, typename Header::FsSize_t hint) {
+	// hints must not be stale, this only checks what is cheap to check
+	if (hint >= firstInode() && hint <= m_header.getSize() - sizeof(Inode)) {
+		auto inode = ptr<Inode*>(hint);
+		if (inode->getId() == id && !(inode->getFlags() & (InodeFlag_Chunk | InodeFlag_Blob | InodeFlag_Slab))) {
+			return inode;
+		}
+	}
+	return getInode(ptr<Inode*>(m_header.getRootInode()), id);
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::getNode(typename Header::FsSize_t root, uint64_t key) {
+	auto inode = node(root);
+	while (inode) {
+		const auto k = keyOf(inode);
+		if (k > key) {
+			inode = node(inode->getLeft());
+		} else if (k < key) {
+			inode = node(inode->getRight());
+		} else {
+			break;
+		}
+	}
+	return inode;
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::getBlob(uint64_t hash) {
+	return getNode(m_header.getBlobRoot(), hash);
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::getSlab(InodeId_t id) {
+	return getNode(m_header.getSlabRoot(), id >> Header::SLAB_SHIFT);
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::blobOf(Inode *inode) {
+	return getBlob(((ContentHash*) inode->getData())->getHash());
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::getInodeParent(Inode *root, uint64_t key, typename Header::FsSize_t targetAddr) {
 	Inode *retval = nullptr;
 
-	if (root->getId() > id) {
+	if (keyOf(root) > key) {
 		if (root->getLeft()) {
 			if (root->getLeft() == targetAddr) {
 				retval = root;
 			} else {
-				retval = getInodeParent(ptr<Inode*>(root->getLeft()), id, targetAddr);
+				retval = getInodeParent(ptr<Inode*>(root->getLeft()), key, targetAddr);
 			}
 		}
-	} else if (root->getId() < id) {
+	} else if (keyOf(root) < key) {
 		if (root->getRight()) {
 			if (root->getRight() == targetAddr) {
 				retval = root;
 			} else {
-				retval = getInodeParent(ptr<Inode*>(root->getRight()), id, targetAddr);
+				retval = getInodeParent(ptr<Inode*>(root->getRight()), key, targetAddr);
 			}
 		}
 	}
@@ -791,79 +3730,459 @@ typename FileStore<Header>::Inode *FileStore<Header>::getInodeParent(Inode *root
 
 template<typename Header>
 typename Header::FsSize_t FileStore<Header>::nextInodeAddr() {
-	return lastInode() + ptr<Inode*>(lastInode())->size();
+	return endOf(ptr<Inode*>(lastInode()));
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::alignInode(typename Header::FsSize_t addr) {
+	if (!(m_header.getOptions() & FileStoreOption_Aligned)) {
+		return addr;
+	}
+	const typename Header::FsSize_t mask = PAYLOAD_ALIGN - 1;
+	return ((addr + sizeof(Inode) + mask) & ~mask) - sizeof(Inode);
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::endOf(Inode *inode) {
+	return alignInode(ptr(inode) + inode->size());
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::footprint(typename Header::FsSize_t size) {
+	if (!(m_header.getOptions() & FileStoreOption_Aligned)) {
+		return size;
+	}
+	const typename Header::FsSize_t mask = PAYLOAD_ALIGN - 1;
+	return (size + mask) & ~mask;
 }
 
 template<typename Header>
 void *FileStore<Header>::alloc(typename Header::FsSize_t size) {
-	auto next = nextInodeAddr();
-	if ((next + size) > ptr(end())) {
+	auto retval = tryAlloc(size);
+	if (!retval) {
 		compact();
-		next = nextInodeAddr();
-		if ((next + size) > ptr(end())) {
-			return nullptr;
-		}
+		retval = tryAlloc(size);
+	}
+	return retval;
+}
+
+template<typename Header>
+void *FileStore<Header>::tryAlloc(typename Header::FsSize_t size) {
+	auto block = findFreeBlock(size);
+	if (block) {
+		const auto retval = ptr(block);
+		const auto prev = ptr<Inode*>(block->getInode());
+		const auto next = ptr<Inode*>(prev->getNext());
+		unindexGap(prev);
+
+		const auto inode = ptr<Inode*>(retval);
+		dirty(retval, size);
+		ox_memset(inode, 0, size);
+		inode->setDataLen(size - sizeof(Inode));
+		inode->setPrev(ptr(prev));
+		inode->setNext(ptr(next));
+		dirty(prev)->setNext(retval);
+		dirty(next)->setPrev(retval);
+		m_header.setMemUsed(m_header.getMemUsed() + footprint(size));
+
+		// return what is left of the gap to the free lists
+		indexGap(inode);
+		return inode;
+	}
+
+	const auto next = nextInodeAddr();
+	if ((next + footprint(size)) > ptr(end())) {
+		return nullptr;
 	}
 
 	const auto retval = next;
 	const auto inode = ptr<Inode*>(retval);
+	dirty(retval, size);
 	ox_memset(inode, 0, size);
+	inode->setDataLen(size - sizeof(Inode));
 	inode->setPrev(ptr<Inode*>(firstInode())->getPrev());
 	inode->setNext(firstInode());
-	m_header.setMemUsed(m_header.getMemUsed() + size);
-	ptr<Inode*>(lastInode())->setNext(retval);
-	ptr<Inode*>(firstInode())->setPrev(retval);
+	m_header.setMemUsed(m_header.getMemUsed() + footprint(size));
+	dirty(ptr<Inode*>(lastInode()))->setNext(retval);
+	dirty(ptr<Inode*>(firstInode()))->setPrev(retval);
 	return inode;
 }
 
 template<typename Header>
-void FileStore<Header>::compact() {
-	auto dest = ptr<Inode*>(firstInode());
-	auto current = ptr<Inode*>(firstInode());
-	while (current->getNext() > firstInode() && current->getNext() < ptr(end())) {
-		ox_memcpy(dest, current, current->size());
-		if (dest->getNext() != firstInode()) {
-			dest->setNext(ptr(dest) + dest->size());
+bool FileStore<Header>::resizeInPlace(Inode *inode, typename Header::FsSize_t dataLen) {
+	const auto addr = ptr(inode);
+	const auto limit = inode->getNext() == firstInode() ? ptr(end()) : inode->getNext();
+	const typename Header::FsSize_t space = limit - addr;
+	const typename Header::FsSize_t overhead = sizeof(Inode) + (typeLinks(inode) ? sizeof(TypeLinks) : 0);
+	if (space < overhead || space - overhead < dataLen || footprint(overhead + dataLen) > space) {
+		return false;
+	}
+
+	unindexGap(inode);
+	m_header.setMemUsed(m_header.getMemUsed() - footprint(inode->size()) + footprint(overhead + dataLen));
+	if (overhead != sizeof(Inode) && dataLen != inode->getDataLen()) {
+		// the links follow the data
+		dirty(ptr(inode->getData()) + dataLen, sizeof(TypeLinks));
+		ox_memmove(inode->getData() + dataLen, typeLinks(inode), sizeof(TypeLinks));
+	}
+	dirty(inode)->setDataLen(dataLen);
+	indexGap(inode);
+
+	if (addr < m_header.getCompactCursor() && gapAfter(inode)) {
+		m_header.setCompactCursor(addr);
+	}
+	return true;
+}
+
+template<typename Header>
+typename FileStore<Header>::FreeBlock *FileStore<Header>::findFreeBlock(typename Header::FsSize_t size) {
+	auto sc = sizeClass(size);
+
+	// blocks in the size's own class may be too small
+	for (auto addr = m_header.getFreeList(sc); addr;) {
+		auto block = ptr<FreeBlock*>(addr);
+		if (block->getSize() >= size) {
+			return block;
+		}
+		addr = block->getNext();
+	}
+
+	// any block in a larger class is large enough
+	for (auto i = sc + 1; i < (int) Header::SIZE_CLASSES; i++) {
+		auto addr = m_header.getFreeList(i);
+		if (addr) {
+			return ptr<FreeBlock*>(addr);
 		}
-		ptr<Inode*>(dest->getNext())->setPrev(ptr(dest));
-		updateInodeAddress(dest->getId(), ptr(current), ptr(dest));
-		current = ptr<Inode*>(dest->getNext());
-		dest = ptr<Inode*>(ptr(dest) + dest->size());
 	}
+
+	return nullptr;
 }
 
 template<typename Header>
-bool FileStore<Header>::insert(Inode *root, Inode *insertValue) {
-	auto retval = false;
+typename Header::FsSize_t FileStore<Header>::gapAfter(Inode *inode) {
+	if (inode->getNext() == firstInode()) {
+		return 0;
+	}
+	return inode->getNext() - endOf(inode);
+}
 
-	if (root->getId() > insertValue->getId()) {
-		if (root->getLeft()) {
-			retval = insert(ptr<Inode*>(root->getLeft()), insertValue);
-		} else {
-			root->setLeft(ptr(insertValue));
-			retval = true;
+template<typename Header>
+void FileStore<Header>::indexGap(Inode *inode) {
+	auto gap = gapAfter(inode);
+	if (gap >= sizeof(FreeBlock)) {
+		auto sc = sizeClass(gap);
+		auto addr = endOf(inode);
+		auto block = dirty(ptr<FreeBlock*>(addr));
+		auto head = m_header.getFreeList(sc);
+		block->setSize(gap);
+		block->setInode(ptr(inode));
+		block->setPrev(0);
+		block->setNext(head);
+		if (head) {
+			dirty(ptr<FreeBlock*>(head))->setPrev(addr);
 		}
-	} else if (root->getId() < insertValue->getId()) {
-		if (root->getRight()) {
-			retval = insert(ptr<Inode*>(root->getRight()), insertValue);
+		m_header.setFreeList(sc, addr);
+	}
+}
+
+template<typename Header>
+void FileStore<Header>::unindexGap(Inode *inode) {
+	auto gap = gapAfter(inode);
+	if (gap >= sizeof(FreeBlock)) {
+		auto block = ptr<FreeBlock*>(endOf(inode));
+		if (block->getPrev()) {
+			dirty(ptr<FreeBlock*>(block->getPrev()))->setNext(block->getNext());
 		} else {
-			root->setRight(ptr(insertValue));
-			retval = true;
+			m_header.setFreeList(sizeClass(gap), block->getNext());
 		}
-	} else if (m_header.getRootInode() == 0) {
-		m_header.setRootInode(ptr(insertValue));
-		retval = true;
+		if (block->getNext()) {
+			dirty(ptr<FreeBlock*>(block->getNext()))->setPrev(block->getPrev());
+		}
+	}
+}
+
+template<typename Header>
+void FileStore<Header>::rebuildFreeLists() {
+	for (int i = 0; i < (int) Header::SIZE_CLASSES; i++) {
+		m_header.setFreeList(i, 0);
 	}
+	auto first = ptr<Inode*>(firstInode());
+	auto inode = first;
+	do {
+		indexGap(inode);
+		inode = ptr<Inode*>(inode->getNext());
+	} while (inode != first);
+}
 
+template<typename Header>
+int FileStore<Header>::sizeClass(typename Header::FsSize_t size) {
+	int retval = 0;
+	while (size >>= 1) {
+		retval++;
+	}
 	return retval;
 }
 
+template<typename Header>
+void FileStore<Header>::compact() {
+	auto first = ptr<Inode*>(firstInode());
+	// every inode's prev gets rewritten
+	dirty(firstInode(), lastInode() + ptr<Inode*>(lastInode())->size() - firstInode());
+	m_header.setMoves(m_header.getMoves() + 1);
+
+	// the inodes are in address order, so the new address of each is known
+	// up front, stash it in its prev, which gets rewritten during the move
+	typename Header::FsSize_t dest = firstInode();
+	auto inode = first;
+	do {
+		const auto next = ptr<Inode*>(inode->getNext());
+		inode->setPrev(dest);
+		dest = alignInode(dest + inode->size());
+		inode = next;
+	} while (inode != first);
+
+	// point the tree at the new addresses while every inode is still where
+	// its children's addresses say it is
+	do {
+		if (inode->getLeft()) {
+			inode->setLeft(ptr<Inode*>(inode->getLeft())->getPrev());
+		}
+		if (inode->getRight()) {
+			inode->setRight(ptr<Inode*>(inode->getRight())->getPrev());
+		}
+		auto links = typeLinks(inode);
+		if (links && links->getPrev()) {
+			links->setPrev(ptr<Inode*>(links->getPrev())->getPrev());
+		}
+		if (links && links->getNext()) {
+			links->setNext(ptr<Inode*>(links->getNext())->getPrev());
+		}
+		if (inode->getFlags() & InodeFlag_Extents) {
+			auto extents = (Extent*) inode->getData();
+			for (typename Header::FsSize_t i = 0; i < inode->getDataLen() / sizeof(Extent); i++) {
+				if (extents[i].getChunk()) {
+					extents[i].setChunk(ptr<Inode*>(extents[i].getChunk())->getPrev());
+				}
+			}
+		}
+		inode = ptr<Inode*>(inode->getNext());
+	} while (inode != first);
+	m_header.setRootInode(ptr<Inode*>(m_header.getRootInode())->getPrev());
+	if (m_header.getBlobRoot()) {
+		m_header.setBlobRoot(ptr<Inode*>(m_header.getBlobRoot())->getPrev());
+	}
+	if (m_header.getSlabRoot()) {
+		m_header.setSlabRoot(ptr<Inode*>(m_header.getSlabRoot())->getPrev());
+	}
+	for (int i = 0; i < (int) Header::TYPE_LISTS; i++) {
+		if (m_header.getTypeList(i)) {
+			m_header.setTypeList(i, ptr<Inode*>(m_header.getTypeList(i))->getPrev());
+		}
+	}
+
+	// each inode moves down, so moving them in order never overwrites one
+	// that has yet to move
+	auto prev = ptr(first);
+	inode = ptr<Inode*>(first->getNext());
+	first->setNext(inode->getPrev());
+	while (inode != first) {
+		const auto next = ptr<Inode*>(inode->getNext());
+		const auto addr = inode->getPrev();
+		const auto nextAddr = next == first ? firstInode() : next->getPrev();
+		ox_memmove(ptr<Inode*>(addr), inode, inode->size());
+		inode = ptr<Inode*>(addr);
+		inode->setPrev(prev);
+		inode->setNext(nextAddr);
+		prev = addr;
+		inode = next;
+	}
+	first->setPrev(prev);
+
+	// there are no gaps left
+	for (int i = 0; i < (int) Header::SIZE_CLASSES; i++) {
+		m_header.setFreeList(i, 0);
+	}
+	m_header.setCompactCursor(prev);
+}
+
+template<typename Header>
+bool FileStore<Header>::compactStep(typename Header::FsSize_t budget) {
+	typename Header::FsSize_t moved = 0;
+	auto current = ptr<Inode*>(m_header.getCompactCursor());
+	while (current->getNext() != firstInode() && moved < budget) {
+		if (gapAfter(current)) {
+			current = moveNext(current);
+			moved += current->size();
+		} else {
+			current = ptr<Inode*>(current->getNext());
+		}
+	}
+	m_header.setCompactCursor(ptr(current));
+	return current->getNext() == firstInode();
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::moveNext(Inode *inode) {
+	auto next = ptr<Inode*>(inode->getNext());
+	const auto src = ptr(next);
+	const auto dest = endOf(inode);
+	unindexGap(inode);
+	unindexGap(next);
+
+	const auto size = next->size();
+	dirty(dest, size);
+	ox_memmove(ptr<Inode*>(dest), next, size);
+	m_header.setMoves(m_header.getMoves() + 1);
+	next = ptr<Inode*>(dest);
+	dirty(inode)->setNext(dest);
+	dirty(ptr<Inode*>(next->getNext()))->setPrev(dest);
+	if (next->getFlags() & InodeFlag_Chunk) {
+		updateChunkAddress(next->getId(), src, dest);
+	} else if (next->getFlags() & (InodeFlag_Blob | InodeFlag_Slab)) {
+		updateTreeAddress(next, src, dest);
+	} else {
+		updateInodeAddress(next->getId(), src, dest);
+		updateTypeAddress(next, src, dest);
+	}
+
+	// the gap is now after the moved inode
+	indexGap(next);
+	return next;
+}
+
+template<typename Header>
+bool FileStore<Header>::insert(Inode *insertValue) {
+	auto inserted = false;
+	auto root = insert(node(rootOf(insertValue)), insertValue, &inserted);
+	if (ptr(root) != rootOf(insertValue)) {
+		setRootOf(insertValue, ptr(root));
+	}
+	if (inserted && !(insertValue->getFlags() & (InodeFlag_Blob | InodeFlag_Slab))) {
+		linkType(insertValue);
+	}
+	return inserted;
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::insert(Inode *root, Inode *insertValue, bool *inserted) {
+	if (!root) {
+		*inserted = true;
+		return insertValue;
+	}
+
+	if (keyOf(root) > keyOf(insertValue)) {
+		auto left = insert(node(root->getLeft()), insertValue, inserted);
+		if (ptr(left) != root->getLeft()) {
+			dirty(root)->setLeft(ptr(left));
+			if (higherPriority(left, root)) {
+				root = rotateRight(root);
+			}
+		}
+	} else if (keyOf(root) < keyOf(insertValue)) {
+		auto right = insert(node(root->getRight()), insertValue, inserted);
+		if (ptr(right) != root->getRight()) {
+			dirty(root)->setRight(ptr(right));
+			if (higherPriority(right, root)) {
+				root = rotateLeft(root);
+			}
+		}
+	}
+
+	return root;
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::rotateLeft(Inode *root) {
+	auto right = node(root->getRight());
+	dirty(root)->setRight(right->getLeft());
+	dirty(right)->setLeft(ptr(root));
+	return right;
+}
+
+template<typename Header>
+typename FileStore<Header>::Inode *FileStore<Header>::rotateRight(Inode *root) {
+	auto left = node(root->getLeft());
+	dirty(root)->setLeft(left->getRight());
+	dirty(left)->setRight(ptr(root));
+	return left;
+}
+
+template<typename Header>
+void FileStore<Header>::rebuildIndex() {
+	auto first = ptr<Inode*>(firstInode());
+	auto inode = first;
+	do {
+		dirty(inode)->setLeft(0);
+		inode->setRight(0);
+		inode = ptr<Inode*>(inode->getNext());
+	} while (inode != first);
+
+	m_header.setRootInode(0);
+	m_header.setBlobRoot(0);
+	m_header.setSlabRoot(0);
+	for (int i = 0; i < (int) Header::TYPE_LISTS; i++) {
+		m_header.setTypeList(i, 0);
+	}
+	do {
+		if (!(inode->getFlags() & InodeFlag_Chunk)) {
+			insert(inode);
+		}
+		inode = ptr<Inode*>(inode->getNext());
+	} while (inode != first);
+}
+
+template<typename Header>
+uint64_t FileStore<Header>::priority(uint64_t key) {
+	// SplitMix64 finalizer, ids are often sequential, so they need to be
+	// scattered for the tree to stay balanced
+	uint64_t h = key;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111eb;
+	return h ^ (h >> 31);
+}
+
+template<typename Header>
+bool FileStore<Header>::higherPriority(Inode *a, Inode *b) {
+	auto pa = priority(keyOf(a));
+	auto pb = priority(keyOf(b));
+	return pa > pb || (pa == pb && keyOf(a) < keyOf(b));
+}
+
+template<typename Header>
+uint64_t FileStore<Header>::keyOf(Inode *inode) {
+	if (inode->getFlags() & InodeFlag_Blob) {
+		return ((ContentHash*) inode->getData())->getHash();
+	}
+	return inode->getId();
+}
+
+template<typename Header>
+typename Header::FsSize_t FileStore<Header>::rootOf(Inode *inode) {
+	if (inode->getFlags() & InodeFlag_Blob) {
+		return m_header.getBlobRoot();
+	} else if (inode->getFlags() & InodeFlag_Slab) {
+		return m_header.getSlabRoot();
+	}
+	return m_header.getRootInode();
+}
+
+template<typename Header>
+void FileStore<Header>::setRootOf(Inode *inode, typename Header::FsSize_t root) {
+	if (inode->getFlags() & InodeFlag_Blob) {
+		m_header.setBlobRoot(root);
+	} else if (inode->getFlags() & InodeFlag_Slab) {
+		m_header.setSlabRoot(root);
+	} else {
+		m_header.setRootInode(root);
+	}
+}
+
 template<typename Header>
 typename Header::FsSize_t FileStore<Header>::ptr(void *ptr) {
 #ifdef _MSC_VER
 #pragma warning(disable:4244)
 #endif
-	return ((uint8_t*) ptr) - begin();
+	return ptr ? ((uint8_t*) ptr) - begin() : 0;
 #ifdef _MSC_VER
 #pragma warning(default:4244)
 #endif
@@ -884,34 +4203,183 @@ uint16_t FileStore<Header>::fsType() {
 	return m_header.getFsType();
 };
 
+template<typename Header>
+uint32_t FileStore<Header>::moves() {
+	return m_header.getMoves();
+}
+
 template<typename Header>
 uint16_t FileStore<Header>::version() {
 	return m_header.getVersion();
 };
 
+template<typename Header>
+template<typename Writer>
+int FileStore<Header>::flushDirty(Writer writer) {
+	// take the ranges out first, so that their record goes out clean
+	typename Header::FsSize_t ranges[Header::DIRTY_RANGES][2];
+	const auto count = m_header.dirtyCount();
+	for (int i = 0; i < count; i++) {
+		ranges[i][0] = m_header.dirtyStart(i);
+		ranges[i][1] = m_header.dirtyEnd(i);
+	}
+	m_header.clearDirty();
+
+	int err = 0;
+	for (int i = 0; !err && i < count; i++) {
+		err = writer(ranges[i][0], ptr<const uint8_t*>(ranges[i][0]), ranges[i][1] - ranges[i][0]);
+	}
+	const auto offset = m_header.dirtyRecordOffset();
+	const auto len = m_header.dirtyRecordLen(count);
+	bool written = false;
+	for (int i = 0; i < count; i++) {
+		written |= ranges[i][0] <= offset && ranges[i][1] >= offset + len;
+	}
+	if (!err && !written) {
+		err = writer(offset, ptr<const uint8_t*>(offset), len);
+	}
+
+	if (err) {
+		for (int i = 0; i < count; i++) {
+			m_header.markDirty(ranges[i][0], ranges[i][1]);
+		}
+	}
+	return err;
+}
+
+template<typename Header>
+int FileStore<Header>::upgrade() {
+	switch (m_header.getVersion()) {
+		case 7: {
+			// version 7 has a header that ends after m_rootInode, Inodes
+			// without m_flags, and an unbalanced tree
+			typedef typename Header::FsSize_t FsSize_t;
+			const auto oldFirst = (FsSize_t) (sizeof(uint16_t) * 2 + sizeof(FsSize_t) * 3);
+
+			// make sure the converted inodes will fit before touching anything
+			uint64_t newEnd = firstInode();
+			auto addr = oldFirst;
+			do {
+				auto inode = ptr<InodeV7*>(addr);
+				newEnd += sizeof(Inode) + bigEndianAdapt(inode->dataLen);
+				addr = bigEndianAdapt(inode->next);
+			} while (addr != oldFirst);
+			if (newEnd > m_header.getSize()) {
+				return 1;
+			}
+
+			// the dirty record overlaps the old inodes, so it cannot be
+			// marked until they are converted, but watchers must still hear
+			// of the change first
+			if (__atomic_load_n(&fileStoreWatchers, __ATOMIC_ACQUIRE)) {
+				fileStoreChanging((uint8_t*) &m_header, 0, newEnd);
+			}
+
+			// pack the old inodes together, after which every inode's new
+			// address is at or above its old one
+			FsSize_t dest = oldFirst;
+			FsSize_t prev = 0;
+			addr = oldFirst;
+			do {
+				auto inode = ptr<InodeV7*>(addr);
+				const auto next = bigEndianAdapt(inode->next);
+				const auto size = sizeof(InodeV7) + bigEndianAdapt(inode->dataLen);
+				ox_memmove(ptr<uint8_t*>(dest), inode, size);
+				ptr<InodeV7*>(dest)->prev = bigEndianAdapt(prev);
+				prev = dest;
+				dest += size;
+				addr = next;
+			} while (addr != oldFirst);
+
+			// convert the inodes from the last down, so that none overwrites
+			// one that has yet to be converted
+			FsSize_t newAddr = newEnd;
+			FsSize_t newNext = firstInode();
+			FsSize_t newLast = 0;
+			addr = prev;
+			while (true) {
+				auto old = ptr<InodeV7*>(addr);
+				const auto oldPrev = bigEndianAdapt(old->prev);
+				const auto dataLen = bigEndianAdapt(old->dataLen);
+				const auto id = bigEndianAdapt(old->id);
+				const auto links = bigEndianAdapt(old->links);
+				const auto fileType = bigEndianAdapt(old->fileType);
+				newAddr -= sizeof(Inode) + dataLen;
+				ox_memmove(ptr<uint8_t*>(newAddr + sizeof(Inode)), old + 1, dataLen);
+
+				auto inode = ptr<Inode*>(newAddr);
+				ox_memset(inode, 0, sizeof(Inode));
+				inode->setDataLen(dataLen);
+				inode->setId(id);
+				inode->setLinks(links);
+				inode->setFileType(fileType);
+				inode->updateChecksum();
+				inode->setNext(newNext);
+				if (newNext != firstInode()) {
+					ptr<Inode*>(newNext)->setPrev(newAddr);
+				} else {
+					newLast = newAddr;
+				}
+				newNext = newAddr;
+				if (addr == oldFirst) {
+					break;
+				}
+				addr = oldPrev;
+			}
+			ptr<Inode*>(firstInode())->setPrev(newLast);
+
+			// the new header fields, including the free lists, start empty,
+			// and the inodes are packed, so there are no gaps to list
+			ox_memset(ptr<uint8_t*>(oldFirst), 0, firstInode() - oldFirst);
+			m_header.setMemUsed(newEnd);
+			dirty(0, newEnd);
+			rebuildIndex();
+			m_header.setCompactCursor(newLast);
+			m_header.setVersion(VERSION);
+			return 0;
+		}
+		case VERSION:
+			return 0;
+		default:
+			return 1;
+	}
+}
+
 template<typename Header>
 void FileStore<Header>::walk(int(*cb)(const char*, uint64_t start, uint64_t end)) {
 	auto err = cb("Header", 0, sizeof(Header));
 	auto inode = ptr<Inode*>(firstInode());
 	do {
 		auto start = ptr(inode);
-		err = cb("Inode", start, start + inode->size());
+		const char *type = "Inode";
+		if (inode->getFlags() & InodeFlag_Chunk) {
+			type = "Chunk";
+		} else if (inode->getFlags() & InodeFlag_Blob) {
+			type = "Blob";
+		} else if (inode->getFlags() & InodeFlag_Slab) {
+			type = "Slab";
+		}
+		err = cb(type, start, start + inode->size());
 		inode = ptr<Inode*>(inode->getNext());
 	} while (!err && inode != ptr<Inode*>(firstInode()));
 }
 
 template<typename Header>
-uint8_t *FileStore<Header>::format(uint8_t *buffer, typename Header::FsSize_t size, uint16_t fsType) {
+uint8_t *FileStore<Header>::format(uint8_t *buffer, typename Header::FsSize_t size, uint16_t fsType, uint16_t options) {
 	ox_memset(buffer, 0, size);
 
 	auto *fs = (FileStore*) buffer;
 	fs->m_header.setFsType(fsType);
 	fs->m_header.setVersion(Header::VERSION);
 	fs->m_header.setSize(size);
-	fs->m_header.setMemUsed(sizeof(FileStore<Header>) + sizeof(Inode));
+	fs->m_header.setOptions(options);
+	fs->m_header.setMemUsed(fs->alignInode(sizeof(FileStore<Header>) + sizeof(Inode)));
 	fs->m_header.setRootInode(sizeof(FileStore<Header>));
+	fs->m_header.setCompactCursor(sizeof(FileStore<Header>));
 	((Inode*) (fs + 1))->setPrev(sizeof(FileStore<Header>));
 	((Inode*) (fs + 1))->setNext(sizeof(FileStore<Header>));
+	// none of it has been written anywhere yet
+	fs->dirty(0, size);
 
 	return (uint8_t*) buffer;
 }
@@ -16,6 +16,7 @@ FileSystem *createFileSystem(uint8_t *buff, size_t buffSize, bool ownsBuff) {
 	FileSystem *fs = nullptr;
 
 	switch (version) {
+		case 7:
 		case FileStore16::VERSION:
 			switch (type) {
 				case ox::OxFS_16:
@@ -38,6 +39,11 @@ FileSystem *createFileSystem(uint8_t *buff, size_t buffSize, bool ownsBuff) {
 		fs = nullptr;
 	}
 
+	if (fs && version != FileStore16::VERSION && fs->upgrade()) {
+		delete fs;
+		fs = nullptr;
+	}
+
 	return fs;
 }
 
@@ -31,6 +31,33 @@ struct FileStat {
 	uint8_t  fileType;
 };
 
+/**
+ * A file's data where it sits in the file system's buffer. It is only valid
+ * until the next call that changes the file system.
+ */
+struct FileView {
+	const uint8_t *data = nullptr;
+	uint64_t size = 0;
+	// kept in every build so that the layout does not depend on NDEBUG,
+	// only checked in debug builds
+	const uint64_t *fsGeneration = nullptr;
+	uint64_t generation = 0;
+
+	/**
+	 * Returns whether or not the view points at the file's data. In debug
+	 * builds, this is also false once the file system has been changed since
+	 * the view was taken.
+	 */
+	bool valid() const {
+#ifndef NDEBUG
+		if (fsGeneration && *fsGeneration != generation) {
+			return false;
+		}
+#endif
+		return data != nullptr;
+	}
+};
+
 template<typename String>
 struct DirectoryListing {
 	String name;
@@ -202,6 +229,10 @@ int Directory<InodeId_t, FsSize_t>::ls(List *list) {
 
 
 class FileSystem {
+	// forward readDirectory to the FileSystems they wrap
+	friend class ConcurrentFileSystem;
+	friend class MvccFileSystem;
+
 	public:
 		virtual ~FileSystem() {};
 
@@ -227,12 +258,28 @@ class FileSystem {
 
 		virtual uint8_t *read(uint64_t inode, size_t *size) = 0;
 
+		/**
+		 * Gets a view of the file at the given path without copying it. The
+		 * view is invalid if the file was not found or is spread over several
+		 * chunks, in which case it must be read with read.
+		 */
+		virtual FileView readView(const char *path) = 0;
+
+		virtual FileView readView(uint64_t inode) = 0;
+
 		virtual int remove(uint64_t inode, bool recursive = false) = 0;
 
 		virtual int remove(const char *path, bool recursive = false) = 0;
 
 		virtual void resize(uint64_t size = 0) = 0;
 
+		/**
+		 * Runs part of a compaction of the file system.
+		 * @param budget the number of bytes to move before returning
+		 * @return true if the file system is now fully compacted
+		 */
+		virtual bool compactStep(uint64_t budget) = 0;
+
 		virtual int write(const char *path, void *buffer, uint64_t size, uint8_t fileType = FileType_NormalFile) = 0;
 
 		virtual int write(uint64_t inode, void *buffer, uint64_t size, uint8_t fileType = FileType_NormalFile) = 0;
@@ -241,6 +288,16 @@ class FileSystem {
 
 		virtual FileStat stat(const char *path) = 0;
 
+		/**
+		 * Increments the link count of the given inode.
+		 */
+		virtual int incLinks(uint64_t inode) = 0;
+
+		/**
+		 * Decrements the link count of the given inode.
+		 */
+		virtual int decLinks(uint64_t inode) = 0;
+
 		virtual uint64_t spaceNeeded(uint64_t size) = 0;
 
 		virtual uint64_t available() = 0;
@@ -251,6 +308,41 @@ class FileSystem {
 
 		virtual void walk(int(*cb)(const char*, uint64_t, uint64_t)) = 0;
 
+		/**
+		 * Upgrades the underlying file store from an older format version.
+		 */
+		virtual int upgrade() = 0;
+
+		/**
+		 * Writes changes out to the file that backs the file system, for file
+		 * systems that have one.
+		 * @return 0 if the changes were written
+		 */
+		virtual int sync() = 0;
+
+		/**
+		 * Takes a snapshot of the file system, which keeps the state the file
+		 * system was in when it was taken while the file system goes on being
+		 * changed. It is to be treated as read only.
+		 * @return the snapshot, to be deleted by the caller, or nullptr if one
+		 * could not be taken
+		 */
+		virtual FileSystem *snapshot() = 0;
+
+		/**
+		 * Returns true if snapshot shares the file system's storage, so that
+		 * taking one costs about the same whatever the file system's size,
+		 * rather than copying the whole file system.
+		 */
+		virtual bool cheapSnapshots() = 0;
+
+		/**
+		 * Checks every file in the file system against its checksums.
+		 * @return the number of files that fail the check, or -1 if the file
+		 * system's structure is broken
+		 */
+		virtual int verify() = 0;
+
 	protected:
 		virtual int readDirectory(const char *path, Directory<uint64_t, uint64_t> *dirOut) = 0;
 };
@@ -287,6 +379,30 @@ class FileSystemTemplate: public FileSystem {
 	private:
 		FileStore *m_store = nullptr;
 		bool m_ownsBuff = false;
+		// incremented by every change, to catch FileViews used after one
+		uint64_t m_generation = 0;
+
+		const static int InodeCacheSets = 64;
+
+		/**
+		 * The address of an inode, as cached by inodeAddr. seq is odd while
+		 * the entry is being filled, so that readers filling the cache at
+		 * the same time do not see each other's half written entries.
+		 */
+		struct InodeCacheEntry {
+			uint32_t seq;
+			uint32_t generation;
+			typename FileStore::InodeId_t id;
+			typename FileStore::FsSize_t addr;
+		};
+
+		// a 2-way set associative cache of inode addresses, to skip the tree
+		// search for inodes that are used often
+		InodeCacheEntry m_inodeCache[InodeCacheSets][2];
+		// entries of any other generation are empty
+		uint32_t m_inodeCacheGeneration = 1;
+		// the store's moves count when the cache was last checked against it
+		uint32_t m_inodeCacheMoves = 0;
 
 	public:
 		// static members
@@ -310,8 +426,14 @@ class FileSystemTemplate: public FileSystem {
 
 		uint8_t *read(uint64_t inode, size_t *size) override;
 
+		FileView readView(const char *path) override;
+
+		FileView readView(uint64_t inode) override;
+
 		void resize(uint64_t size = 0) override;
 
+		bool compactStep(uint64_t budget) override;
+
 		int remove(uint64_t inode, bool recursive = false) override;
 
 		int remove(const char *path, bool recursive = false) override;
@@ -324,6 +446,10 @@ class FileSystemTemplate: public FileSystem {
 
 		FileStat stat(uint64_t inode) override;
 
+		int incLinks(uint64_t inode) override;
+
+		int decLinks(uint64_t inode) override;
+
 		uint64_t findInodeOf(const char *name);
 
 		uint64_t spaceNeeded(uint64_t size) override;
@@ -343,6 +469,22 @@ class FileSystemTemplate: public FileSystem {
 
 		void walk(int(*cb)(const char*, uint64_t, uint64_t)) override;
 
+		int upgrade() override;
+
+		int sync() override;
+
+		FileSystem *snapshot() override;
+
+		bool cheapSnapshots() override;
+
+		int verify() override;
+
+		/**
+		 * Returns true if the address of the given inode is in the inode
+		 * cache, without adding it.
+		 */
+		bool inodeCached(uint64_t inode);
+
 		static uint8_t *format(uint8_t *buffer, typename FileStore::FsSize_t size, bool useDirectories);
 
 	protected:
@@ -354,12 +496,49 @@ class FileSystemTemplate: public FileSystem {
 		int insertDirectoryEntry(const char *dirPath, const char *fileName, uint64_t inode);
 
 		void expand(uint64_t size);
+
+		/**
+		 * Returns the address of the inode of the given id, from the inode
+		 * cache if it is there, adding it to the cache otherwise.
+		 * @return the address, or 0 if there is no such inode
+		 */
+		typename FileStore::FsSize_t inodeAddr(uint64_t inode);
+
+		/**
+		 * Drops the given inode from the inode cache.
+		 */
+		void uncacheInode(uint64_t inode);
+
+		/**
+		 * Empties the inode cache, for changes that may have moved inodes.
+		 */
+		void clearInodeCache();
+
+		InodeCacheEntry *inodeCacheSet(uint64_t inode) {
+			return m_inodeCache[(uint32_t) ((inode * 0x9E3779B97F4A7C15ull) >> 32) % InodeCacheSets];
+		}
+
+		/**
+		 * Fills a cache entry, unless another thread is filling it.
+		 * @return true if the entry was filled
+		 */
+		bool fillInodeCacheEntry(InodeCacheEntry *entry, uint32_t generation,
+		                         typename FileStore::InodeId_t id, typename FileStore::FsSize_t addr);
+
+		/**
+		 * Marks the file system as changed, invalidating FileViews in debug
+		 * builds.
+		 */
+		void changed() {
+			m_generation++;
+		}
 };
 
 template<typename FileStore, FsType FS_TYPE>
 FileSystemTemplate<FileStore, FS_TYPE>::FileSystemTemplate(uint8_t *buff, bool ownsBuff) {
 	m_store = (FileStore*) buff;
 	m_ownsBuff = ownsBuff;
+	ox_memset(m_inodeCache, 0, sizeof(m_inodeCache));
 }
 
 template<typename FileStore, FsType FS_TYPE>
@@ -380,6 +559,8 @@ typename FileStore::InodeId_t FileSystemTemplate<FileStore, FS_TYPE>::INODE_RESE
 
 template<typename FileStore, FsType FS_TYPE>
 int FileSystemTemplate<FileStore, FS_TYPE>::stripDirectories() {
+	changed();
+	clearInodeCache();
 	return m_store->removeAllType(FileType::FileType_Directory);
 }
 
@@ -430,7 +611,7 @@ template<typename FileStore, FsType FS_TYPE>
 FileStat FileSystemTemplate<FileStore, FS_TYPE>::stat(const char *path) {
 	auto inode = findInodeOf(path);
 	FileStat stat;
-	auto s = m_store->stat(inode);
+	auto s = m_store->stat(inode, inodeAddr(inode));
 	stat.size = s.size;
 	stat.inode = s.inodeId;
 	stat.fileType = s.fileType;
@@ -443,7 +624,7 @@ FileStat FileSystemTemplate<FileStore, FS_TYPE>::stat(const char *path) {
 template<typename FileStore, FsType FS_TYPE>
 FileStat FileSystemTemplate<FileStore, FS_TYPE>::stat(uint64_t inode) {
 	FileStat stat;
-	auto s = m_store->stat(inode);
+	auto s = m_store->stat(inode, inodeAddr(inode));
 	stat.size = s.size;
 	stat.inode = s.inodeId;
 	stat.links = s.links;
@@ -480,9 +661,10 @@ int FileSystemTemplate<FileStore, FS_TYPE>::read(const char *path, void *buffer,
 #endif
 template<typename FileStore, FsType FS_TYPE>
 int FileSystemTemplate<FileStore, FS_TYPE>::read(uint64_t inode, void *buffer, size_t buffSize) {
-	auto stat = m_store->stat(inode);
+	const auto addr = inodeAddr(inode);
+	auto stat = m_store->stat(inode, addr);
 	if (stat.size <= buffSize) {
-		return m_store->read(inode, buffer, nullptr);
+		return m_store->read(inode, buffer, nullptr, addr);
 	}
 	return -1;
 }
@@ -497,11 +679,12 @@ template<typename FileStore, FsType FS_TYPE>
 int FileSystemTemplate<FileStore, FS_TYPE>::read(uint64_t inode, size_t readStart,
                                                  size_t readSize, void *buffer,
                                                  size_t *size) {
+	const auto addr = inodeAddr(inode);
 	if (size) {
-		auto stat = m_store->stat(inode);
+		auto stat = m_store->stat(inode, addr);
 		*size = stat.size;
 	}
-	return m_store->read(inode, readStart, readSize, buffer, nullptr);
+	return m_store->read(inode, readStart, readSize, buffer, nullptr, addr);
 }
 #ifdef _MSC_VER
 #pragma warning(disable:4244)
@@ -512,12 +695,13 @@ int FileSystemTemplate<FileStore, FS_TYPE>::read(uint64_t inode, size_t readStar
 #endif
 template<typename FileStore, FsType FS_TYPE>
 uint8_t *FileSystemTemplate<FileStore, FS_TYPE>::read(uint64_t inode, size_t *size) {
-	auto s = m_store->stat(inode);
+	const auto addr = inodeAddr(inode);
+	auto s = m_store->stat(inode, addr);
 	auto buff = new uint8_t[s.size];
 	if (size) {
 		*size = s.size;
 	}
-	if (m_store->read(inode, buff, nullptr)) {
+	if (m_store->read(inode, buff, nullptr, addr)) {
 		delete []buff;
 		buff = nullptr;
 	}
@@ -527,6 +711,29 @@ uint8_t *FileSystemTemplate<FileStore, FS_TYPE>::read(uint64_t inode, size_t *si
 #pragma warning(default:4244)
 #endif
 
+template<typename FileStore, FsType FS_TYPE>
+FileView FileSystemTemplate<FileStore, FS_TYPE>::readView(const char *path) {
+	auto inode = findInodeOf(path);
+	return inode ? readView(inode) : FileView();
+}
+
+#ifdef _MSC_VER
+#pragma warning(disable:4244)
+#endif
+template<typename FileStore, FsType FS_TYPE>
+FileView FileSystemTemplate<FileStore, FS_TYPE>::readView(uint64_t inode) {
+	auto v = m_store->view(inode, inodeAddr(inode));
+	FileView view;
+	view.data = v.data;
+	view.size = v.size;
+	view.fsGeneration = &m_generation;
+	view.generation = m_generation;
+	return view;
+}
+#ifdef _MSC_VER
+#pragma warning(default:4244)
+#endif
+
 template<typename FileStore, FsType FS_TYPE>
 int FileSystemTemplate<FileStore, FS_TYPE>::remove(const char *path, bool recursive) {
 	auto inode = findInodeOf(path);
@@ -542,8 +749,10 @@ int FileSystemTemplate<FileStore, FS_TYPE>::remove(const char *path, bool recurs
 #endif
 template<typename FileStore, FsType FS_TYPE>
 int FileSystemTemplate<FileStore, FS_TYPE>::remove(uint64_t inode, bool recursive) {
+	changed();
 	auto fileType = stat(inode).fileType;
 	if (fileType != FileType::FileType_Directory) {
+		uncacheInode(inode);
 		return m_store->remove(inode);
 	} else if (fileType == FileType::FileType_Directory && recursive) {
 		int err = 0;
@@ -568,6 +777,7 @@ int FileSystemTemplate<FileStore, FS_TYPE>::remove(uint64_t inode, bool recursiv
 		}
 
 		if (!err) {
+			uncacheInode(inode);
 			err |= m_store->remove(inode);
 		}
 
@@ -619,12 +829,19 @@ int FileSystemTemplate<FileStore, FS_TYPE>::write(const char *path, void *buffer
 #endif
 template<typename FileStore, FsType FS_TYPE>
 int FileSystemTemplate<FileStore, FS_TYPE>::write(uint64_t inode, void *buffer, uint64_t size, uint8_t fileType) {
+	changed();
 	if (m_ownsBuff) {
 		while (m_store->spaceNeeded(size) > m_store->available()) {
 			expand(this->size() * 2);
 		}
 	}
-	return m_store->write(inode, buffer, size, fileType);
+	const auto before = inodeAddr(inode);
+	auto err = m_store->write(inode, buffer, size, fileType);
+	if (err || m_store->find(inode) != before) {
+		// the inode was reallocated, which may have compacted the store
+		clearInodeCache();
+	}
+	return err;
 }
 #ifdef _MSC_VER
 #pragma warning(default:4244)
@@ -641,19 +858,22 @@ uint64_t FileSystemTemplate<FileStore, FS_TYPE>::findInodeOf(const char *path) {
 	uint64_t inode = INODE_ROOT_DIR;
 	while (it.hasNext() && it.next(fileName, pathLen) == 0 && ox_strlen(fileName)) {
 		auto dirStat = stat(inode);
-		if (dirStat.inode && dirStat.size >= sizeof(Directory<typename FileStore::InodeId_t, typename FileStore::FsSize_t>)) {
-			uint8_t dirBuffer[dirStat.size];
-			auto dir = (Directory<typename FileStore::InodeId_t, typename FileStore::FsSize_t>*) dirBuffer;
-			if (read(inode, dirBuffer, dirStat.size) == 0) {
-				if (dirStat.fileType == FileType::FileType_Directory) {
+		if (dirStat.inode && dirStat.fileType == FileType::FileType_Directory &&
+		    dirStat.size >= sizeof(Directory<typename FileStore::InodeId_t, typename FileStore::FsSize_t>)) {
+			// look the name up in place unless the directory is in chunks
+			auto view = m_store->view(inode, inodeAddr(inode));
+			if (view.data) {
+				auto dir = (Directory<typename FileStore::InodeId_t, typename FileStore::FsSize_t>*) view.data;
+				inode = dir->getFileInode(fileName);
+			} else {
+				uint8_t dirBuffer[dirStat.size];
+				auto dir = (Directory<typename FileStore::InodeId_t, typename FileStore::FsSize_t>*) dirBuffer;
+				if (read(inode, dirBuffer, dirStat.size) == 0) {
 					inode = dir->getFileInode(fileName);
 				} else {
 					inode = 0; // null out inode and break
 					break;
 				}
-			} else {
-				inode = 0; // null out inode and break
-				break;
 			}
 		} else {
 			inode = 0; // null out inode and break
@@ -668,9 +888,34 @@ uint64_t FileSystemTemplate<FileStore, FS_TYPE>::findInodeOf(const char *path) {
 
 template<typename FileStore, FsType FS_TYPE>
 void FileSystemTemplate<FileStore, FS_TYPE>::resize(uint64_t size) {
+	changed();
+	clearInodeCache();
 	return m_store->resize(size);
 }
 
+#ifdef _MSC_VER
+#pragma warning(disable:4244)
+#endif
+template<typename FileStore, FsType FS_TYPE>
+bool FileSystemTemplate<FileStore, FS_TYPE>::compactStep(uint64_t budget) {
+	changed();
+	clearInodeCache();
+	return m_store->compactStep(budget);
+}
+#ifdef _MSC_VER
+#pragma warning(default:4244)
+#endif
+
+template<typename FileStore, FsType FS_TYPE>
+int FileSystemTemplate<FileStore, FS_TYPE>::incLinks(uint64_t inode) {
+	return m_store->incLinks(inode, inodeAddr(inode));
+}
+
+template<typename FileStore, FsType FS_TYPE>
+int FileSystemTemplate<FileStore, FS_TYPE>::decLinks(uint64_t inode) {
+	return m_store->decLinks(inode, inodeAddr(inode));
+}
+
 template<typename FileStore, FsType FS_TYPE>
 uint64_t FileSystemTemplate<FileStore, FS_TYPE>::spaceNeeded(uint64_t size) {
 	return m_store->spaceNeeded(size);
@@ -738,21 +983,35 @@ uint64_t FileSystemTemplate<FileStore, FS_TYPE>::generateInodeId() {
 #endif
 template<typename FileStore, FsType FS_TYPE>
 int FileSystemTemplate<FileStore, FS_TYPE>::insertDirectoryEntry(const char *dirPath, const char *fileName, uint64_t inode) {
+	changed();
 	auto s = stat(dirPath);
 	if (s.inode) {
 		auto spaceNeeded = DirectoryEntry<typename FileStore::InodeId_t>::spaceNeeded(fileName);
-		size_t dirBuffSize = s.size + spaceNeeded;
-		uint8_t dirBuff[dirBuffSize];
-		int err = read(s.inode, dirBuff, dirBuffSize);
+		Directory<typename FileStore::InodeId_t, typename FileStore::FsSize_t> dir;
+		int err = m_store->read(s.inode, 0, sizeof(dir), &dir, nullptr);
 
 		if (!err) {
-			auto dir = (Directory<typename FileStore::InodeId_t, typename FileStore::FsSize_t>*) dirBuff;
-			dir->size += spaceNeeded;
-			dir->children++;
-			auto entry = (DirectoryEntry<typename FileStore::InodeId_t>*) &dirBuff[s.size];
+			if (m_ownsBuff) {
+				// make room in case the directory cannot grow in place
+				while (m_store->spaceNeeded(s.size + spaceNeeded) > m_store->available()) {
+					expand(this->size() * 2);
+				}
+			}
+
+			uint8_t entryBuff[spaceNeeded];
+			auto entry = (DirectoryEntry<typename FileStore::InodeId_t>*) entryBuff;
 			entry->inode = inode;
 			entry->setName(fileName);
-			err = write(s.inode, dirBuff, dirBuffSize, FileType_Directory);
+			dir.size += spaceNeeded;
+			dir.children++;
+			err = m_store->append(s.inode, entryBuff, spaceNeeded);
+			// the directory may have been moved to grow
+			clearInodeCache();
+			if (err) {
+				// the header must not claim an entry that is not there
+				return err;
+			}
+			err |= m_store->write(s.inode, 0, &dir, sizeof(dir));
 			err |= m_store->incLinks(inode);
 			return err;
 		} else {
@@ -848,6 +1107,11 @@ template<typename FileStore, FsType FS_TYPE>
 int FileSystemTemplate<FileStore, FS_TYPE>::readDirectory(const char *path, Directory<uint64_t, uint64_t> *dirOut) {
 	int err = 0;
 	auto inode = findInodeOf(path);
+	auto view = m_store->view(inode, inodeAddr(inode));
+	if (view.data && view.size >= sizeof(Directory<typename FileStore::InodeId_t, typename FileStore::FsSize_t>)) {
+		return ((Directory<typename FileStore::InodeId_t, typename FileStore::FsSize_t>*) view.data)->copy(dirOut);
+	}
+
 	auto dirStat = stat(inode);
 	auto dirBuffLen = dirStat.size;
 	uint8_t dirBuff[dirBuffLen];
@@ -863,6 +1127,7 @@ int FileSystemTemplate<FileStore, FS_TYPE>::readDirectory(const char *path, Dire
 
 template<typename FileStore, FsType FS_TYPE>
 void FileSystemTemplate<FileStore, FS_TYPE>::expand(uint64_t newSize) {
+	changed();
 	if (newSize > size()) {
 		auto newBuff = new uint8_t[newSize];
 		ox_memcpy(newBuff, m_store, m_store->size());
@@ -877,6 +1142,134 @@ void FileSystemTemplate<FileStore, FS_TYPE>::walk(int(*cb)(const char*, uint64_t
 	m_store->walk(cb);
 }
 
+template<typename FileStore, FsType FS_TYPE>
+int FileSystemTemplate<FileStore, FS_TYPE>::upgrade() {
+	changed();
+	clearInodeCache();
+	return m_store->upgrade();
+}
+
+template<typename FileStore, FsType FS_TYPE>
+int FileSystemTemplate<FileStore, FS_TYPE>::sync() {
+	// the buffer is all there is
+	return 0;
+}
+
+template<typename FileStore, FsType FS_TYPE>
+FileSystem *FileSystemTemplate<FileStore, FS_TYPE>::snapshot() {
+	// a plain buffer has nothing to share pages with, so copy it
+	auto buff = new uint8_t[size()];
+	ox_memcpy(buff, m_store, size());
+	return new FileSystemTemplate<FileStore, FS_TYPE>(buff, true);
+}
+
+template<typename FileStore, FsType FS_TYPE>
+bool FileSystemTemplate<FileStore, FS_TYPE>::cheapSnapshots() {
+	return false;
+}
+
+template<typename FileStore, FsType FS_TYPE>
+int FileSystemTemplate<FileStore, FS_TYPE>::verify() {
+	return m_store->verifyAll();
+}
+
+template<typename FileStore, FsType FS_TYPE>
+bool FileSystemTemplate<FileStore, FS_TYPE>::inodeCached(uint64_t inode) {
+	auto set = inodeCacheSet(inode);
+	for (int i = 0; i < 2; i++) {
+		if (set[i].generation == __atomic_load_n(&m_inodeCacheGeneration, __ATOMIC_RELAXED) && set[i].id == inode) {
+			return true;
+		}
+	}
+	return false;
+}
+
+template<typename FileStore, FsType FS_TYPE>
+typename FileStore::FsSize_t FileSystemTemplate<FileStore, FS_TYPE>::inodeAddr(uint64_t inode) {
+	// compaction, even when an allocation for another inode runs it, leaves
+	// the old copies of the inodes it moves where the cache still points
+	const auto moves = m_store->moves();
+	if (__atomic_load_n(&m_inodeCacheMoves, __ATOMIC_ACQUIRE) != moves) {
+		clearInodeCache();
+		__atomic_store_n(&m_inodeCacheMoves, moves, __ATOMIC_RELEASE);
+	}
+	const auto generation = __atomic_load_n(&m_inodeCacheGeneration, __ATOMIC_RELAXED);
+	auto set = inodeCacheSet(inode);
+	InodeCacheEntry found[2];
+	bool consistent[2];
+	bool stale[2];
+	for (int i = 0; i < 2; i++) {
+		auto e = &set[i];
+		auto seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+		found[i].generation = __atomic_load_n(&e->generation, __ATOMIC_RELAXED);
+		found[i].id = __atomic_load_n(&e->id, __ATOMIC_RELAXED);
+		found[i].addr = __atomic_load_n(&e->addr, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		consistent[i] = !(seq & 1) && __atomic_load_n(&e->seq, __ATOMIC_RELAXED) == seq;
+		if (consistent[i] && found[i].generation == generation && found[i].id == inode) {
+			return found[i].addr;
+		}
+		stale[i] = consistent[i] && found[i].generation != generation;
+	}
+
+	const auto addr = m_store->find(inode);
+	if (addr) {
+		if (stale[0]) {
+			fillInodeCacheEntry(&set[0], generation, inode, addr);
+		} else if (stale[1]) {
+			fillInodeCacheEntry(&set[1], generation, inode, addr);
+		} else if (consistent[0]) {
+			// the older of the two is in the second way
+			fillInodeCacheEntry(&set[1], found[0].generation, found[0].id, found[0].addr);
+			fillInodeCacheEntry(&set[0], generation, inode, addr);
+		}
+	}
+	return addr;
+}
+
+template<typename FileStore, FsType FS_TYPE>
+bool FileSystemTemplate<FileStore, FS_TYPE>::fillInodeCacheEntry(InodeCacheEntry *entry, uint32_t generation,
+                                                                 typename FileStore::InodeId_t id,
+                                                                 typename FileStore::FsSize_t addr) {
+	auto seq = __atomic_load_n(&entry->seq, __ATOMIC_RELAXED);
+	if ((seq & 1) || !__atomic_compare_exchange_n(&entry->seq, &seq, seq + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		return false;
+	}
+	__atomic_store_n(&entry->generation, generation, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->id, id, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->addr, addr, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+	return true;
+}
+
+template<typename FileStore, FsType FS_TYPE>
+void FileSystemTemplate<FileStore, FS_TYPE>::uncacheInode(uint64_t inode) {
+	auto set = inodeCacheSet(inode);
+	for (int i = 0; i < 2; i++) {
+		if (set[i].id == inode) {
+			fillInodeCacheEntry(&set[i], 0, 0, 0);
+		}
+	}
+}
+
+template<typename FileStore, FsType FS_TYPE>
+void FileSystemTemplate<FileStore, FS_TYPE>::clearInodeCache() {
+	// readers call this too, when they find the store has been compacted
+	if (__atomic_add_fetch(&m_inodeCacheGeneration, 1, __ATOMIC_RELAXED) == 0) {
+		// entries from before the wrap would look current again, so each is
+		// emptied the way it is filled, after any fill already under way
+		for (int i = 0; i < InodeCacheSets; i++) {
+			for (int j = 0; j < 2; j++) {
+				int spins = 0;
+				while (!fillInodeCacheEntry(&m_inodeCache[i][j], 0, 0, 0)) {
+					backOff(&spins);
+				}
+			}
+		}
+		__atomic_store_n(&m_inodeCacheGeneration, 1, __ATOMIC_RELEASE);
+	}
+}
+
 typedef FileSystemTemplate<FileStore16, OxFS_16> FileSystem16;
 typedef FileSystemTemplate<FileStore32, OxFS_32> FileSystem32;
 typedef FileSystemTemplate<FileStore64, OxFS_64> FileSystem64;
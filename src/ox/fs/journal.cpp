@@ -0,0 +1,302 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.hpp"
+
+namespace ox {
+
+enum JournalOp {
+	JournalOp_Write = 1,
+	JournalOp_Remove = 2,
+	JournalOp_Links = 3,
+	// ends a transaction, its inode is the checksum of the records of the
+	// transaction and its size is their length
+	JournalOp_Commit = 4,
+};
+
+/**
+ * The header of a journal record. A write record is followed by the data
+ * written, and a links record has the resulting link count as its size.
+ */
+struct __attribute__((packed)) JournalRecord {
+	private:
+		uint8_t m_op;
+		uint8_t m_fileType;
+		uint64_t m_inode;
+		uint64_t m_size;
+
+	public:
+		void setOp(uint8_t op) {
+			m_op = bigEndianAdapt(op);
+		}
+
+		uint8_t getOp() {
+			return bigEndianAdapt(m_op);
+		}
+
+		void setFileType(uint8_t fileType) {
+			m_fileType = bigEndianAdapt(fileType);
+		}
+
+		uint8_t getFileType() {
+			return bigEndianAdapt(m_fileType);
+		}
+
+		void setInode(uint64_t inode) {
+			m_inode = bigEndianAdapt(inode);
+		}
+
+		uint64_t getInode() {
+			return bigEndianAdapt(m_inode);
+		}
+
+		void setSize(uint64_t size) {
+			m_size = bigEndianAdapt(size);
+		}
+
+		uint64_t getSize() {
+			return bigEndianAdapt(m_size);
+		}
+
+		/**
+		 * Returns the length of the record with its data.
+		 */
+		uint64_t length() {
+			return sizeof(JournalRecord) + (getOp() == JournalOp_Write ? getSize() : 0);
+		}
+};
+
+const static uint64_t ChecksumSeed = 14695981039346656037ull;
+
+/**
+ * FNV-1a, enough to catch a transaction that was only partly written.
+ */
+static uint64_t checksum(uint64_t sum, const uint8_t *data, uint64_t len) {
+	for (uint64_t i = 0; i < len; i++) {
+		sum = (sum ^ data[i]) * 1099511628211ull;
+	}
+	return sum;
+}
+
+static int readFully(int fd, uint8_t *buff, uint64_t len) {
+	uint64_t done = 0;
+	while (done < len) {
+		auto n = pread(fd, buff + done, len - done, done);
+		if (n <= 0) {
+			return 1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+static int writeFully(int fd, const uint8_t *buff, uint64_t len, uint64_t offset) {
+	uint64_t done = 0;
+	while (done < len) {
+		auto n = pwrite(fd, buff + done, len - done, offset + done);
+		if (n <= 0) {
+			return 1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+Journal::Journal(FileSystem *fs) {
+	m_fs = fs;
+}
+
+Journal::~Journal() {
+	if (m_fd > -1) {
+		close(m_fd);
+	}
+}
+
+int Journal::open(const char *path, bool writable) {
+	m_fd = ::open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if (m_fd < 0) {
+		return 1;
+	}
+	m_writable = writable;
+
+	struct stat st;
+	if (fstat(m_fd, &st)) {
+		return 1;
+	}
+	const auto size = (uint64_t) st.st_size;
+	auto buff = new uint8_t[size];
+	if (readFully(m_fd, buff, size)) {
+		delete []buff;
+		return 1;
+	}
+
+	// find the end of the last transaction that was written in full
+	uint64_t pos = 0;
+	uint64_t txStart = 0;
+	auto sum = ChecksumSeed;
+	m_committed = 0;
+	while (pos + sizeof(JournalRecord) <= size) {
+		auto rec = (JournalRecord*) (buff + pos);
+		auto op = rec->getOp();
+		if (op == JournalOp_Commit) {
+			if (rec->getSize() != pos - txStart || rec->getInode() != sum) {
+				break;
+			}
+			pos += sizeof(JournalRecord);
+			m_committed = txStart = pos;
+			sum = ChecksumSeed;
+		} else if (op >= JournalOp_Write && op <= JournalOp_Links && rec->length() <= size - pos) {
+			sum = checksum(sum, buff + pos, rec->length());
+			pos += rec->length();
+		} else {
+			break;
+		}
+	}
+	delete []buff;
+
+	// drop what follows, so new records continue the committed ones
+	if (writable && m_committed < size && ftruncate(m_fd, m_committed)) {
+		return 1;
+	}
+	m_end = m_committed;
+	m_checksum = ChecksumSeed;
+	return 0;
+}
+
+int Journal::replay() {
+	int err = 0;
+	auto buff = new uint8_t[m_committed];
+	if (readFully(m_fd, buff, m_committed)) {
+		delete []buff;
+		return 1;
+	}
+
+	for (uint64_t pos = 0; pos < m_committed && !err; pos += ((JournalRecord*) (buff + pos))->length()) {
+		auto rec = (JournalRecord*) (buff + pos);
+		auto inode = rec->getInode();
+		switch (rec->getOp()) {
+			case JournalOp_Write:
+				err = m_fs->write(inode, buff + pos + sizeof(JournalRecord), rec->getSize(), rec->getFileType());
+				break;
+			case JournalOp_Remove:
+				// already gone if this record was folded before
+				if (m_fs->stat(inode).inode) {
+					err = m_fs->remove(inode);
+				}
+				break;
+			case JournalOp_Links:
+				{
+					auto links = m_fs->stat(inode).links;
+					for (; links < rec->getSize() && !err; links++) {
+						err = m_fs->incLinks(inode);
+					}
+					for (; links > rec->getSize() && !err; links--) {
+						err = m_fs->decLinks(inode);
+					}
+				}
+				break;
+		}
+	}
+
+	delete []buff;
+	return err;
+}
+
+int Journal::write(uint64_t inode, void *buffer, uint64_t size, uint8_t fileType) {
+	int err = m_fs->write(inode, buffer, size, fileType);
+	if (!err) {
+		err = append(JournalOp_Write, fileType, inode, size, buffer);
+	}
+	return err;
+}
+
+int Journal::remove(uint64_t inode) {
+	int err = m_fs->remove(inode);
+	if (!err) {
+		err = append(JournalOp_Remove, 0, inode, 0);
+	}
+	return err;
+}
+
+int Journal::incLinks(uint64_t inode) {
+	int err = m_fs->incLinks(inode);
+	if (!err) {
+		err = append(JournalOp_Links, 0, inode, m_fs->stat(inode).links);
+	}
+	return err;
+}
+
+int Journal::decLinks(uint64_t inode) {
+	int err = m_fs->decLinks(inode);
+	if (!err) {
+		err = append(JournalOp_Links, 0, inode, m_fs->stat(inode).links);
+	}
+	return err;
+}
+
+int Journal::commit() {
+	if (m_end == m_committed) {
+		return 0;
+	}
+	int err = append(JournalOp_Commit, 0, m_checksum, m_end - m_committed);
+	err = err || fsync(m_fd);
+	if (!err) {
+		m_committed = m_end;
+		m_checksum = ChecksumSeed;
+	}
+	return err;
+}
+
+int Journal::fold() {
+	if (!m_writable || m_fs->sync()) {
+		return 1;
+	}
+	if (ftruncate(m_fd, 0) || fsync(m_fd)) {
+		return 1;
+	}
+	m_committed = m_end = 0;
+	m_checksum = ChecksumSeed;
+	return 0;
+}
+
+bool Journal::empty() {
+	return m_committed == 0;
+}
+
+int Journal::append(uint8_t op, uint8_t fileType, uint64_t inode, uint64_t size, const void *data) {
+	if (!m_writable) {
+		return 1;
+	}
+
+	JournalRecord rec;
+	rec.setOp(op);
+	rec.setFileType(fileType);
+	rec.setInode(inode);
+	rec.setSize(size);
+	const auto dataLen = rec.length() - sizeof(rec);
+
+	int err = writeFully(m_fd, (uint8_t*) &rec, sizeof(rec), m_end);
+	err = err || writeFully(m_fd, (const uint8_t*) data, dataLen, m_end + sizeof(rec));
+	if (err) {
+		// leave the torn record to be overwritten by the next one
+		return 1;
+	}
+
+	if (op != JournalOp_Commit) {
+		m_checksum = checksum(m_checksum, (uint8_t*) &rec, sizeof(rec));
+		m_checksum = checksum(m_checksum, (const uint8_t*) data, dataLen);
+	}
+	m_end += sizeof(rec) + dataLen;
+	return 0;
+}
+
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "filesystem.hpp"
+
+namespace ox {
+
+/**
+ * A write-ahead journal of changes to a FileSystem, kept in a file next to
+ * its image. Changes made through the journal are applied to the FileSystem
+ * and appended to the journal, and commit makes them durable by syncing only
+ * the journal, so committing costs as much as the change rather than the
+ * whole image. fold brings the image up to date and empties the journal, and
+ * can be put off until the image is next opened.
+ *
+ * The image must not be written to until the changes are folded into it, so
+ * the FileSystem should be one that keeps its changes to itself, such as a
+ * read only mapFileSystem, and fold done on a writable one after replay.
+ *
+ * Records hold the state a change leaves an inode in rather than the change
+ * itself, so replaying a journal over an image it was already partly folded
+ * into gives the same result.
+ */
+class Journal {
+
+	private:
+		FileSystem *m_fs = nullptr;
+		int m_fd = -1;
+		bool m_writable = false;
+		// the end of the last committed transaction
+		uint64_t m_committed = 0;
+		// the end of the records written so far
+		uint64_t m_end = 0;
+		// the checksum of the records of the open transaction
+		uint64_t m_checksum = 0;
+
+	public:
+		explicit Journal(FileSystem *fs);
+
+		~Journal();
+
+		/**
+		 * Opens the journal file at the given path, creating it if it is
+		 * writable and does not exist. Records that were never committed or
+		 * were only partly written are dropped.
+		 * @param path the path of the journal file
+		 * @param writable whether or not changes will be made through the journal
+		 * @return 0 if the journal was opened
+		 */
+		int open(const char *path, bool writable = true);
+
+		/**
+		 * Applies the committed records of the journal to the FileSystem.
+		 */
+		int replay();
+
+		int write(uint64_t inode, void *buffer, uint64_t size, uint8_t fileType = FileType_NormalFile);
+
+		int remove(uint64_t inode);
+
+		int incLinks(uint64_t inode);
+
+		int decLinks(uint64_t inode);
+
+		/**
+		 * Makes the changes since the last commit durable.
+		 * @return 0 if the changes were written and synced to the journal
+		 */
+		int commit();
+
+		/**
+		 * Syncs the FileSystem to its image and empties the journal. The
+		 * committed records must have been replayed into the FileSystem first.
+		 */
+		int fold();
+
+		/**
+		 * Returns true if the journal has no committed records.
+		 */
+		bool empty();
+
+	private:
+		int append(uint8_t op, uint8_t fileType, uint64_t inode, uint64_t size, const void *data = nullptr);
+};
+
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mmapfs.hpp"
+
+namespace ox {
+
+/**
+ * Gives a snapshot its own copy of each page of its origin before the origin's
+ * FileStore first changes it.
+ */
+class CowWatcher: public FileStoreWatcher {
+
+	private:
+		uint8_t *m_snapshot = nullptr;
+		size_t m_pageSize = 0;
+		// a bit for each page the snapshot has its own copy of
+		uint8_t *m_copied = nullptr;
+
+	public:
+		CowWatcher(const uint8_t *origin, uint8_t *snapshot, size_t size) {
+			buffer = origin;
+			m_snapshot = snapshot;
+			m_pageSize = (size_t) sysconf(_SC_PAGESIZE);
+			const auto pages = (size + m_pageSize - 1) / m_pageSize;
+			m_copied = new uint8_t[(pages + 7) / 8];
+			ox_memset(m_copied, 0, (pages + 7) / 8);
+		}
+
+		~CowWatcher() {
+			delete[] m_copied;
+		}
+
+		void beforeChange(uint64_t start, uint64_t end) override {
+			for (auto page = start / m_pageSize; page <= (end - 1) / m_pageSize; page++) {
+				const uint8_t bit = 1 << (page % 8);
+				if (!(__atomic_fetch_or(&m_copied[page / 8], bit, __ATOMIC_ACQ_REL) & bit)) {
+					// writing to a page of a private mapping gives it its own
+					// copy of what the page holds now
+					auto p = (volatile uint8_t*) m_snapshot + page * m_pageSize;
+					*p = *p;
+				}
+			}
+		}
+};
+
+template<typename FileStore, FsType FS_TYPE>
+MappedFileSystem<FileStore, FS_TYPE>::MappedFileSystem(uint8_t *map, size_t mapSize, int fd, bool writable):
+FileSystemTemplate<FileStore, FS_TYPE>(map) {
+	m_map = map;
+	m_mapSize = mapSize;
+	m_fd = fd;
+	m_writable = writable;
+}
+
+template<typename FileStore, FsType FS_TYPE>
+MappedFileSystem<FileStore, FS_TYPE>::~MappedFileSystem() {
+	if (m_cow) {
+		unwatchFileStore(m_cow);
+		delete m_cow;
+	} else if (m_writable) {
+		// the snapshots keep whatever pages they have not copied yet
+		unwatchFileStore(m_map);
+	}
+	sync();
+	munmap(m_map, m_mapSize);
+	close(m_fd);
+}
+
+template<typename FileStore, FsType FS_TYPE>
+int MappedFileSystem<FileStore, FS_TYPE>::sync() {
+	// the kernel tracks which pages were changed, only those get written
+	return m_writable ? msync(m_map, m_mapSize, MS_SYNC) : 0;
+}
+
+template<typename FileStore, FsType FS_TYPE>
+FileSystem *MappedFileSystem<FileStore, FS_TYPE>::snapshot() {
+	if (!m_writable) {
+		// the pages of a private mapping cannot be shared
+		return FileSystemTemplate<FileStore, FS_TYPE>::snapshot();
+	}
+
+	// a private mapping of the image may see the writes made through the
+	// shared one, until the watcher gives it its own copy of a page
+	auto fd = dup(m_fd);
+	if (fd < 0) {
+		return nullptr;
+	}
+	auto map = (uint8_t*) mmap(nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return nullptr;
+	}
+
+	auto snapshot = new MappedFileSystem<FileStore, FS_TYPE>(map, m_mapSize, fd, false);
+	snapshot->m_cow = new CowWatcher(m_map, map, m_mapSize);
+	watchFileStore(snapshot->m_cow);
+	return snapshot;
+}
+
+template<typename FileStore, FsType FS_TYPE>
+bool MappedFileSystem<FileStore, FS_TYPE>::cheapSnapshots() {
+	return m_writable;
+}
+
+template class MappedFileSystem<FileStore16, OxFS_16>;
+template class MappedFileSystem<FileStore32, OxFS_32>;
+template class MappedFileSystem<FileStore64, OxFS_64>;
+
+FileSystem *mapFileSystem(const char *path, bool writable) {
+	auto fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd < 0) {
+		return nullptr;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) || (size_t) st.st_size < sizeof(FileStore16)) {
+		close(fd);
+		return nullptr;
+	}
+	const auto size = (size_t) st.st_size;
+
+	// a private mapping keeps changes, such as an upgrade, out of the file
+	auto map = (uint8_t*) mmap(nullptr, size, PROT_READ | PROT_WRITE,
+	                           writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return nullptr;
+	}
+
+	auto version = ((FileStore16*) map)->version();
+	auto type = ((FileStore16*) map)->fsType();
+	FileSystem *fs = nullptr;
+
+	switch (version) {
+		case 7:
+		case FileStore16::VERSION:
+			switch (type) {
+				case ox::OxFS_16:
+					fs = new MappedFileSystem16(map, size, fd, writable);
+					break;
+				case ox::OxFS_32:
+					fs = new MappedFileSystem32(map, size, fd, writable);
+					break;
+				case ox::OxFS_64:
+					fs = new MappedFileSystem64(map, size, fd, writable);
+					break;
+			}
+			break;
+		default:
+			break;
+	}
+
+	if (!fs) {
+		munmap(map, size);
+		close(fd);
+		return nullptr;
+	}
+
+	if (fs->size() > size || (version != FileStore16::VERSION && fs->upgrade())) {
+		delete fs;
+		fs = nullptr;
+	}
+
+	return fs;
+}
+
+}
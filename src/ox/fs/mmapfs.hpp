@@ -0,0 +1,77 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "filesystem.hpp"
+
+namespace ox {
+
+/**
+ * A FileSystem that runs directly on a memory mapping of its image file, so
+ * opening it does not read the image and syncing it only writes the pages
+ * that were changed. It cannot grow past the size of the file.
+ */
+template<typename FileStore, FsType FS_TYPE>
+class MappedFileSystem: public FileSystemTemplate<FileStore, FS_TYPE> {
+
+	private:
+		uint8_t *m_map = nullptr;
+		size_t m_mapSize = 0;
+		int m_fd = -1;
+		bool m_writable = false;
+		// keeps the pages of the origin a snapshot shares, if this is one
+		FileStoreWatcher *m_cow = nullptr;
+
+	public:
+		MappedFileSystem(uint8_t *map, size_t mapSize, int fd, bool writable);
+
+		/**
+		 * Syncs and unmaps the image file.
+		 */
+		~MappedFileSystem();
+
+		/**
+		 * Writes the changed pages of the mapping back to the image file.
+		 */
+		int sync() override;
+
+		/**
+		 * Takes a copy-on-write snapshot of a writable mapping. The snapshot
+		 * is a private mapping of the image, which shares its pages until
+		 * the FileStore is about to change one, when the snapshot is given
+		 * its own copy, so it is taken in constant time, and then costs a
+		 * page copy for each page changed while it exists. Changes made to
+		 * the image by other mappings or processes are not kept out of it.
+		 * Snapshots of read only mappings are copies.
+		 */
+		FileSystem *snapshot() override;
+
+		/**
+		 * Returns true for writable mappings, whose snapshots are
+		 * copy-on-write.
+		 */
+		bool cheapSnapshots() override;
+};
+
+typedef MappedFileSystem<FileStore16, OxFS_16> MappedFileSystem16;
+typedef MappedFileSystem<FileStore32, OxFS_32> MappedFileSystem32;
+typedef MappedFileSystem<FileStore64, OxFS_64> MappedFileSystem64;
+
+/**
+ * Maps the FileSystem image at the given path into memory and creates a
+ * FileSystem on the mapping. Changes go to the file if it is writable, and
+ * are never written back otherwise, including any format upgrade.
+ * @param path the path of the image file
+ * @param writable whether or not changes are to be written to the file
+ * @return the FileSystem, or nullptr if the file could not be mapped or is
+ * not a valid image
+ */
+FileSystem *mapFileSystem(const char *path, bool writable = true);
+
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "mvccfs.hpp"
+
+namespace ox {
+
+MvccFileSystem::MvccFileSystem(FileSystem *fs) {
+	m_fs = fs;
+}
+
+MvccFileSystem *MvccFileSystem::create(FileSystem *fs) {
+	// every change publishes a snapshot, which must not copy everything
+	if (!fs->cheapSnapshots()) {
+		return nullptr;
+	}
+	auto current = fs->snapshot();
+	if (!current) {
+		return nullptr;
+	}
+	auto mvcc = new MvccFileSystem(fs);
+	mvcc->m_current = current;
+	return mvcc;
+}
+
+MvccFileSystem::~MvccFileSystem() {
+	m_epoch++;
+	reclaim();
+	delete m_current;
+	delete m_fs;
+}
+
+int MvccFileSystem::stripDirectories() {
+	ExclusiveLock lock(&m_writeLock);
+	auto err = m_fs->stripDirectories();
+	return publish() | err;
+}
+
+int MvccFileSystem::mkdir(const char *path) {
+	ExclusiveLock lock(&m_writeLock);
+	auto err = m_fs->mkdir(path);
+	return publish() | err;
+}
+
+int MvccFileSystem::move(const char *src, const char *dest) {
+	ExclusiveLock lock(&m_writeLock);
+	auto err = m_fs->move(src, dest);
+	return publish() | err;
+}
+
+int MvccFileSystem::read(const char *path, void *buffer, size_t buffSize) {
+	int slot;
+	auto err = pin(&slot)->read(path, buffer, buffSize);
+	unpin(slot);
+	return err;
+}
+
+int MvccFileSystem::read(uint64_t inode, void *buffer, size_t size) {
+	int slot;
+	auto err = pin(&slot)->read(inode, buffer, size);
+	unpin(slot);
+	return err;
+}
+
+int MvccFileSystem::read(uint64_t inode, size_t readStart, size_t readSize, void *buffer, size_t *size) {
+	int slot;
+	auto err = pin(&slot)->read(inode, readStart, readSize, buffer, size);
+	unpin(slot);
+	return err;
+}
+
+uint8_t *MvccFileSystem::read(uint64_t inode, size_t *size) {
+	int slot;
+	auto data = pin(&slot)->read(inode, size);
+	unpin(slot);
+	return data;
+}
+
+FileView MvccFileSystem::readView(const char *path) {
+	int slot;
+	auto view = pin(&slot)->readView(path);
+	unpin(slot);
+	return view;
+}
+
+FileView MvccFileSystem::readView(uint64_t inode) {
+	int slot;
+	auto view = pin(&slot)->readView(inode);
+	unpin(slot);
+	return view;
+}
+
+int MvccFileSystem::remove(uint64_t inode, bool recursive) {
+	ExclusiveLock lock(&m_writeLock);
+	auto err = m_fs->remove(inode, recursive);
+	return publish() | err;
+}
+
+int MvccFileSystem::remove(const char *path, bool recursive) {
+	ExclusiveLock lock(&m_writeLock);
+	auto err = m_fs->remove(path, recursive);
+	return publish() | err;
+}
+
+void MvccFileSystem::resize(uint64_t size) {
+	ExclusiveLock lock(&m_writeLock);
+	m_fs->resize(size);
+	publish();
+}
+
+bool MvccFileSystem::compactStep(uint64_t budget) {
+	ExclusiveLock lock(&m_writeLock);
+	auto done = m_fs->compactStep(budget);
+	publish();
+	return done;
+}
+
+int MvccFileSystem::write(const char *path, void *buffer, uint64_t size, uint8_t fileType) {
+	ExclusiveLock lock(&m_writeLock);
+	auto err = m_fs->write(path, buffer, size, fileType);
+	return publish() | err;
+}
+
+int MvccFileSystem::write(uint64_t inode, void *buffer, uint64_t size, uint8_t fileType) {
+	ExclusiveLock lock(&m_writeLock);
+	auto err = m_fs->write(inode, buffer, size, fileType);
+	return publish() | err;
+}
+
+FileStat MvccFileSystem::stat(uint64_t inode) {
+	int slot;
+	auto stat = pin(&slot)->stat(inode);
+	unpin(slot);
+	return stat;
+}
+
+FileStat MvccFileSystem::stat(const char *path) {
+	int slot;
+	auto stat = pin(&slot)->stat(path);
+	unpin(slot);
+	return stat;
+}
+
+int MvccFileSystem::incLinks(uint64_t inode) {
+	ExclusiveLock lock(&m_writeLock);
+	auto err = m_fs->incLinks(inode);
+	return publish() | err;
+}
+
+int MvccFileSystem::decLinks(uint64_t inode) {
+	ExclusiveLock lock(&m_writeLock);
+	auto err = m_fs->decLinks(inode);
+	return publish() | err;
+}
+
+uint64_t MvccFileSystem::spaceNeeded(uint64_t size) {
+	return m_fs->spaceNeeded(size);
+}
+
+uint64_t MvccFileSystem::available() {
+	int slot;
+	auto available = pin(&slot)->available();
+	unpin(slot);
+	return available;
+}
+
+uint64_t MvccFileSystem::size() {
+	int slot;
+	auto size = pin(&slot)->size();
+	unpin(slot);
+	return size;
+}
+
+uint8_t *MvccFileSystem::buff() {
+	return m_fs->buff();
+}
+
+void MvccFileSystem::walk(int(*cb)(const char*, uint64_t, uint64_t)) {
+	int slot;
+	pin(&slot)->walk(cb);
+	unpin(slot);
+}
+
+int MvccFileSystem::upgrade() {
+	ExclusiveLock lock(&m_writeLock);
+	auto err = m_fs->upgrade();
+	return publish() | err;
+}
+
+int MvccFileSystem::sync() {
+	ExclusiveLock lock(&m_writeLock);
+	return m_fs->sync();
+}
+
+FileSystem *MvccFileSystem::snapshot() {
+	ExclusiveLock lock(&m_writeLock);
+	return m_fs->snapshot();
+}
+
+bool MvccFileSystem::cheapSnapshots() {
+	return m_fs->cheapSnapshots();
+}
+
+int MvccFileSystem::verify() {
+	int slot;
+	auto err = pin(&slot)->verify();
+	unpin(slot);
+	return err;
+}
+
+int MvccFileSystem::retired() {
+	ExclusiveLock lock(&m_writeLock);
+	int count = 0;
+	for (auto r = m_retired; r; r = r->next) {
+		count++;
+	}
+	return count;
+}
+
+int MvccFileSystem::readDirectory(const char *path, Directory<uint64_t, uint64_t> *dirOut) {
+	int slot;
+	auto err = pin(&slot)->readDirectory(path, dirOut);
+	unpin(slot);
+	return err;
+}
+
+FileSystem *MvccFileSystem::pin(int *slot) {
+	// start where other threads are unlikely to be
+	auto i = (int) (((size_t) slot >> 6) % ReaderSlots);
+	int spins = 0;
+	for (;; i = (i + 1) % ReaderSlots) {
+		uint64_t free = 0;
+		// the epoch may be stale by the time it is stored, which only makes
+		// the pin more cautious
+		auto epoch = __atomic_load_n(&m_epoch, __ATOMIC_SEQ_CST);
+		if (__atomic_compare_exchange_n(&m_readers[i].epoch, &free, epoch, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			break;
+		}
+		backOff(&spins);
+	}
+	*slot = i;
+	// a version loaded after the pin is only freed once the epoch has moved
+	// past the pinned one
+	return __atomic_load_n(&m_current, __ATOMIC_SEQ_CST);
+}
+
+void MvccFileSystem::unpin(int slot) {
+	__atomic_store_n(&m_readers[slot].epoch, 0, __ATOMIC_RELEASE);
+}
+
+int MvccFileSystem::publish() {
+	auto version = m_fs->snapshot();
+	if (!version) {
+		return 1;
+	}
+	auto old = __atomic_exchange_n(&m_current, version, __ATOMIC_SEQ_CST);
+	// readers that pin from here on cannot load old
+	auto epoch = __atomic_add_fetch(&m_epoch, 1, __ATOMIC_SEQ_CST);
+	m_retired = new Retired{old, epoch, m_retired};
+	reclaim();
+	return 0;
+}
+
+void MvccFileSystem::reclaim() {
+	auto oldest = __atomic_load_n(&m_epoch, __ATOMIC_SEQ_CST);
+	for (int i = 0; i < ReaderSlots; i++) {
+		auto epoch = __atomic_load_n(&m_readers[i].epoch, __ATOMIC_SEQ_CST);
+		if (epoch && epoch < oldest) {
+			oldest = epoch;
+		}
+	}
+
+	for (auto r = &m_retired; *r;) {
+		if ((*r)->epoch <= oldest) {
+			auto freed = *r;
+			*r = freed->next;
+			delete freed->version;
+			delete freed;
+		} else {
+			r = &(*r)->next;
+		}
+	}
+}
+
+}
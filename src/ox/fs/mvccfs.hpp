@@ -0,0 +1,164 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <ox/std/rwlock.hpp>
+
+#include "filesystem.hpp"
+
+namespace ox {
+
+/**
+ * A FileSystem whose readers never wait on its writers. Writers change the
+ * FileSystem it wraps one at a time and then publish a snapshot of it as the
+ * new version with an atomic swap. Readers pin the current epoch, read the
+ * version that was current without taking a lock, and unpin. A replaced
+ * version is freed once every reader that could still see it has unpinned.
+ *
+ * Versions are taken with FileSystem::snapshot after every change, so only
+ * FileSystems with cheap snapshots, such as writable mapFileSystems, can be
+ * wrapped, where publishing a version costs a page copy for each page changed.
+ *
+ * FileViews point into a version and are not kept alive by the epoch, they
+ * are only safe to use while no other thread makes changes.
+ */
+class MvccFileSystem: public FileSystem {
+
+	private:
+		const static int ReaderSlots = 64;
+
+		/**
+		 * A version that was replaced, to be freed once no reader can see it.
+		 */
+		struct Retired {
+			FileSystem *version;
+			// readers pinned before this epoch may still see the version
+			uint64_t epoch;
+			Retired *next;
+		};
+
+		/**
+		 * The epoch a reader is pinned at, or 0, padded out to a cache line so
+		 * that readers do not slow each other down.
+		 */
+		struct ReaderSlot {
+			uint64_t epoch = 0;
+			uint8_t padding[56];
+		};
+
+		FileSystem *m_fs = nullptr;
+		// the version readers are given
+		FileSystem *m_current = nullptr;
+		uint64_t m_epoch = 1;
+		ReaderSlot m_readers[ReaderSlots];
+		Retired *m_retired = nullptr;
+		// keeps writers from running at once
+		RwLock m_writeLock;
+
+		explicit MvccFileSystem(FileSystem *fs);
+
+	public:
+		/**
+		 * Wraps the given FileSystem.
+		 * @param fs the FileSystem to make changes to, which the MvccFileSystem
+		 * takes ownership of
+		 * @return the MvccFileSystem, or nullptr, leaving fs with the caller, if
+		 * fs does not have cheap snapshots or its first could not be taken
+		 */
+		static MvccFileSystem *create(FileSystem *fs);
+
+		~MvccFileSystem();
+
+		int stripDirectories() override;
+
+		int mkdir(const char *path) override;
+
+		int move(const char *src, const char *dest) override;
+
+		int read(const char *path, void *buffer, size_t buffSize) override;
+
+		int read(uint64_t inode, void *buffer, size_t size) override;
+
+		int read(uint64_t inode, size_t readStart, size_t readSize, void *buffer, size_t *size) override;
+
+		uint8_t *read(uint64_t inode, size_t *size) override;
+
+		FileView readView(const char *path) override;
+
+		FileView readView(uint64_t inode) override;
+
+		int remove(uint64_t inode, bool recursive = false) override;
+
+		int remove(const char *path, bool recursive = false) override;
+
+		void resize(uint64_t size = 0) override;
+
+		bool compactStep(uint64_t budget) override;
+
+		int write(const char *path, void *buffer, uint64_t size, uint8_t fileType = FileType_NormalFile) override;
+
+		int write(uint64_t inode, void *buffer, uint64_t size, uint8_t fileType = FileType_NormalFile) override;
+
+		FileStat stat(uint64_t inode) override;
+
+		FileStat stat(const char *path) override;
+
+		int incLinks(uint64_t inode) override;
+
+		int decLinks(uint64_t inode) override;
+
+		uint64_t spaceNeeded(uint64_t size) override;
+
+		uint64_t available() override;
+
+		uint64_t size() override;
+
+		uint8_t *buff() override;
+
+		void walk(int(*cb)(const char*, uint64_t, uint64_t)) override;
+
+		int upgrade() override;
+
+		int sync() override;
+
+		FileSystem *snapshot() override;
+
+		bool cheapSnapshots() override;
+
+		int verify() override;
+
+		/**
+		 * Returns the number of replaced versions not yet freed.
+		 */
+		int retired();
+
+	protected:
+		int readDirectory(const char *path, Directory<uint64_t, uint64_t> *dirOut) override;
+
+	private:
+		/**
+		 * Pins the current epoch and returns the current version.
+		 * @param slot set to the reader slot to pass to unpin
+		 */
+		FileSystem *pin(int *slot);
+
+		void unpin(int slot);
+
+		/**
+		 * Makes the changes so far visible to readers that pin after this,
+		 * and frees the versions no reader can see any more. Writers must
+		 * hold m_writeLock.
+		 * @return 0 if a new version was published
+		 */
+		int publish();
+
+		void reclaim();
+};
+
+}
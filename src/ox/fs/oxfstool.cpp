@@ -14,6 +14,8 @@
 #include <map>
 #include <ox/std/strops.hpp>
 #include <ox/fs/filesystem.hpp>
+#include <ox/fs/journal.hpp>
+#include <ox/fs/mmapfs.hpp>
 
 #include "toollib.hpp"
 
@@ -25,15 +27,19 @@
 using namespace ox;
 using namespace std;
 
-const static auto oxfstoolVersion = "1.4.0";
+const static auto oxfstoolVersion = "1.6.0";
 const static auto usage = "usage:\n"
 "\toxfs format [16,32,64] <size> <path>\n"
 "\toxfs read <FS file> <inode>\n"
 "\toxfs write <FS file> <inode> <insertion file>\n"
 "\toxfs write-expand <FS file> <inode> <insertion file>\n"
 "\toxfs rm <FS file> <inode>\n"
+"\toxfs jwrite <FS file> <inode> <insertion file>\n"
+"\toxfs jrm <FS file> <inode>\n"
+"\toxfs fold <FS file>\n"
 "\toxfs compact <FS file>\n"
 "\toxfs walk <FS file>\n"
+"\toxfs verify <FS file>\n"
 "\toxfs version\n";
 
 size_t bytes(const char *str) {
@@ -65,6 +71,47 @@ size_t bytes(const char *str) {
 	return ox_atoi(copy) * multiplier;
 }
 
+string journalPath(const char *fsPath) {
+	return string(fsPath) + ".journal";
+}
+
+/**
+ * Applies the committed changes in the journal of the given image to fs,
+ * without writing them to the image.
+ */
+int replayJournal(FileSystem *fs, const char *fsPath) {
+	Journal journal(fs);
+	if (journal.open(journalPath(fsPath).c_str(), false)) {
+		// no journal
+		return 0;
+	}
+	return journal.replay();
+}
+
+/**
+ * Folds the changes in the journal of the given image into the image, so
+ * that they cannot later be replayed over changes made without the journal.
+ */
+int foldJournal(const char *fsPath) {
+	auto path = journalPath(fsPath);
+	Journal probe(nullptr);
+	if (probe.open(path.c_str(), false) || probe.empty()) {
+		return 0;
+	}
+
+	auto err = 1;
+	auto fs = mapFileSystem(fsPath);
+	if (fs) {
+		Journal journal(fs);
+		err = journal.open(path.c_str()) || journal.replay() || journal.fold();
+		delete fs;
+	}
+	if (err) {
+		fprintf(stderr, "Could not fold journal into file system: %s\n", fsPath);
+	}
+	return err;
+}
+
 int format(int argc, char **args) {
 	printf("Creating file system...\n");
 	auto err = 0;
@@ -129,15 +176,14 @@ int read(int argc, char **args) {
 	if (argc >= 4) {
 		auto fsPath = args[2];
 		auto inode = ox_atoi(args[3]);
-		size_t fsSize;
 		size_t fileSize;
 
-		auto fsBuff = loadFileBuff(fsPath, &fsSize);
+		auto fs = mapFileSystem(fsPath, false);
 
-		if (fsBuff) {
-			auto fs = createFileSystem(fsBuff, fsSize);
-
-			if (fs) {
+		if (fs) {
+			if (replayJournal(fs, fsPath)) {
+				fprintf(stderr, "Could not replay journal of file system: %s\n", fsPath);
+			} else {
 				auto output = fs->read(inode, &fileSize);
 
 				if (output) {
@@ -145,91 +191,116 @@ int read(int argc, char **args) {
 					delete []output;
 					err = 0;
 				}
+			}
 
+			delete fs;
+		} else {
+			fprintf(stderr, "Could not open file system: %s\n", fsPath);
+		}
+	} else {
+		fprintf(stderr, "Insufficient arguments\n");
+	}
+	return err;
+}
+
+/**
+ * Writes the given file into the image at the given path through a copy of
+ * the whole image on the heap, growing the image to fit it.
+ */
+int writeExpand(const char *fsPath, int inode, uint8_t *srcBuff, size_t srcSize) {
+	auto err = 0;
+	auto fsFile = fopen(fsPath, "rb");
+	if (fsFile) {
+		fseek(fsFile, 0, SEEK_END);
+
+		auto fsSize = (size_t) ftell(fsFile);
+		rewind(fsFile);
+		auto fsBuff = new uint8_t[fsSize];
+		auto itemsRead = fread(fsBuff, fsSize, 1, fsFile);
+		fclose(fsFile);
+
+		if (itemsRead) {
+			auto fs = createFileSystem(fsBuff, fsSize);
+			if (fs) {
+				if (fs->available() <= srcSize) {
+					auto needed = fs->size() + fs->spaceNeeded(srcSize);
+					fsSize = needed;
+					fs = expandCopyCleanup(fs, needed);
+					fsBuff = fs->buff();
+				}
+				err |= fs->write(inode, srcBuff, srcSize);
+
+				if (err) {
+					fprintf(stderr, "Could not write to file system.\n");
+				}
 				delete fs;
-				delete []fsBuff;
 			} else {
 				fprintf(stderr, "Invalid file system type: %d.\n", *(uint32_t*) fsBuff);
+				err = 1;
+			}
+
+			if (!err) {
+				fsFile = fopen(fsPath, "wb");
+
+				if (fsFile) {
+					err = fwrite(fsBuff, fsSize, 1, fsFile) != 1;
+					err |= fclose(fsFile);
+					if (err) {
+						fprintf(stderr, "Could not write to file system file.\n");
+					}
+				} else {
+					err = 1;
+				}
 			}
 		} else {
-			fprintf(stderr, "Could not open file: %s\n", fsPath);
+			err = 1;
 		}
+
+		delete []fsBuff;
 	} else {
-		fprintf(stderr, "Insufficient arguments\n");
+		err = 1;
+		fprintf(stderr, "Could not open file system\n");
 	}
 	return err;
 }
 
 int write(int argc, char **args, bool expand) {
-	auto err = 0;
+	auto err = 1;
 	if (argc >= 5) {
 		auto fsPath = args[2];
 		auto inode = ox_atoi(args[3]);
 		auto srcPath = args[4];
 		size_t srcSize;
 
-		auto fsFile = fopen(fsPath, "rb");
-		if (fsFile) {
-			fseek(fsFile, 0, SEEK_END);
-
-			auto fsSize = (size_t) ftell(fsFile);
-			rewind(fsFile);
-			auto fsBuff = new uint8_t[fsSize];
-			auto itemsRead = fread(fsBuff, fsSize, 1, fsFile);
-			fclose(fsFile);
+		if (foldJournal(fsPath)) {
+			return 1;
+		}
 
-			if (itemsRead) {
-				auto srcBuff = loadFileBuff(srcPath, &srcSize);
-				if (srcBuff) {
-					auto expanded = false;
-					auto fs = createFileSystem(fsBuff, fsSize);
-					if (fs) {
-						if (expand && fs->available() <= srcSize) {
-							auto needed = fs->size() + fs->spaceNeeded(srcSize);
-							fsSize = needed;
-							fs = expandCopyCleanup(fs, needed);
-							fsBuff = fs->buff();
-						}
-						err |= fs->write(inode, srcBuff, srcSize);
-
-						// compact the file system if it was expanded
-						if (expanded) {
-							fs->resize();
-						}
-
-						if (err) {
-							fprintf(stderr, "Could not write to file system.\n");
-						}
-						delete fs;
-					} else {
-						fprintf(stderr, "Invalid file system type: %d.\n", *(uint32_t*) fsBuff);
-						err = 1;
-					}
+		auto srcBuff = loadFileBuff(srcPath, &srcSize);
+		if (!srcBuff) {
+			fprintf(stderr, "Could not load source file: %s.\n", srcPath);
+			return 1;
+		}
 
-					if (!err) {
-						fsFile = fopen(fsPath, "wb");
-
-						if (fsFile) {
-							err = fwrite(fsBuff, fsSize, 1, fsFile) != 1;
-							err |= fclose(fsFile);
-							if (err) {
-								fprintf(stderr, "Could not write to file system file.\n");
-							}
-						} else {
-							err = 1;
-						}
-					}
-					delete []srcBuff;
-				} else {
-					err = 1;
-					fprintf(stderr, "Could not load source file: %s.\n", srcPath);
-				}
+		// the change goes straight to the file, only the touched pages are
+		// written back, unless the image has to grow to take it
+		auto fs = mapFileSystem(fsPath);
+		if (fs && expand && fs->available() <= srcSize) {
+			delete fs;
+			err = writeExpand(fsPath, inode, srcBuff, srcSize);
+		} else if (fs) {
+			err = fs->write(inode, srcBuff, srcSize);
+			if (err) {
+				fprintf(stderr, "Could not write to file system.\n");
+			} else if (fs->sync()) {
+				err = 1;
+				fprintf(stderr, "Could not write to file system file.\n");
 			}
-
-			delete []fsBuff;
+			delete fs;
 		} else {
-			fprintf(stderr, "Could not open file system\n");
+			fprintf(stderr, "Could not open file system: %s\n", fsPath);
 		}
+		delete []srcBuff;
 	} else {
 		fprintf(stderr, "Insufficient arguments\n");
 	}
@@ -242,6 +313,10 @@ int compact(int argc, char **args) {
 		auto fsPath = args[2];
 		size_t fsSize;
 
+		if (foldJournal(fsPath)) {
+			return 1;
+		}
+
 		auto fsBuff = loadFileBuff(fsPath, &fsSize);
 		if (fsBuff) {
 			auto fs = createFileSystem(fsBuff, fsSize);
@@ -280,37 +355,88 @@ int remove(int argc, char **args) {
 	if (argc >= 4) {
 		auto fsPath = args[2];
 		auto inode = ox_atoi(args[3]);
-		size_t fsSize;
-
-		auto fsBuff = loadFileBuff(fsPath, &fsSize);
-		if (fsBuff) {
-			auto fs = createFileSystem(fsBuff, fsSize);
 
-			if (fs) {
-				err = fs->remove(inode);
-			} else {
-				fprintf(stderr, "Invalid file system.\n");
-			}
+		if (foldJournal(fsPath)) {
+			return 1;
+		}
 
+		// the change goes straight to the file, only the touched pages are
+		// written back
+		auto fs = mapFileSystem(fsPath);
+		if (fs) {
+			err = fs->remove(inode);
 			if (err) {
 				fprintf(stderr, "Could not write to file system.\n");
+			} else if (fs->sync()) {
+				err = 1;
+				fprintf(stderr, "Could not write to file system file.\n");
+			}
+			delete fs;
+		} else {
+			fprintf(stderr, "Could not open file system: %s\n", fsPath);
+		}
+	} else {
+		fprintf(stderr, "Insufficient arguments\n");
+	}
+	return err;
+}
+
+int journalWrite(int argc, char **args) {
+	auto err = 1;
+	if (argc >= 5) {
+		auto fsPath = args[2];
+		auto inode = ox_atoi(args[3]);
+		auto srcPath = args[4];
+		size_t srcSize;
+
+		// the image is only read, the change is committed to the journal
+		auto fs = mapFileSystem(fsPath, false);
+		if (fs) {
+			Journal journal(fs);
+			if (journal.open(journalPath(fsPath).c_str()) || journal.replay()) {
+				fprintf(stderr, "Could not open journal of file system: %s\n", fsPath);
 			} else {
-				auto fsFile = fopen(fsPath, "wb");
-				if (fsFile) {
-					err = fwrite(fsBuff, fsSize, 1, fsFile) != 1;
-					err |= fclose(fsFile);
+				auto srcBuff = loadFileBuff(srcPath, &srcSize);
+				if (srcBuff) {
+					err = journal.write(inode, srcBuff, srcSize) || journal.commit();
 					if (err) {
-						fprintf(stderr, "Could not write to file system file.\n");
+						fprintf(stderr, "Could not write to file system.\n");
 					}
+					delete []srcBuff;
 				} else {
-					err = 1;
+					fprintf(stderr, "Could not load source file: %s.\n", srcPath);
 				}
 			}
+			delete fs;
+		} else {
+			fprintf(stderr, "Could not open file system: %s\n", fsPath);
+		}
+	} else {
+		fprintf(stderr, "Insufficient arguments\n");
+	}
+	return err;
+}
+
+int journalRemove(int argc, char **args) {
+	auto err = 1;
+	if (argc >= 4) {
+		auto fsPath = args[2];
+		auto inode = ox_atoi(args[3]);
 
+		auto fs = mapFileSystem(fsPath, false);
+		if (fs) {
+			Journal journal(fs);
+			if (journal.open(journalPath(fsPath).c_str()) || journal.replay()) {
+				fprintf(stderr, "Could not open journal of file system: %s\n", fsPath);
+			} else {
+				err = journal.remove(inode) || journal.commit();
+				if (err) {
+					fprintf(stderr, "Could not write to file system.\n");
+				}
+			}
 			delete fs;
-			delete []fsBuff;
 		} else {
-			fprintf(stderr, "Could not open file: %s\n", fsPath);
+			fprintf(stderr, "Could not open file system: %s\n", fsPath);
 		}
 	} else {
 		fprintf(stderr, "Insufficient arguments\n");
@@ -318,37 +444,71 @@ int remove(int argc, char **args) {
 	return err;
 }
 
+int fold(int argc, char **args) {
+	if (argc >= 3) {
+		return foldJournal(args[2]);
+	} else {
+		fprintf(stderr, "Insufficient arguments\n");
+		return 1;
+	}
+}
+
 int walk(int argc, char **args) {
 	int err = 0;
-	size_t fsSize;
 	auto fsPath = args[2];
-	auto fsBuff = loadFileBuff(fsPath, &fsSize);
-	if (fsBuff) {
-		auto fs = createFileSystem(fsBuff, fsSize);
-		if (fs) {
-			cout << setw(9) << "Type |";
-			cout << setw(10) << "Start |";
-			cout << setw(10) << "End |";
-			cout << setw(8) << "Size";
+	auto fs = mapFileSystem(fsPath, false);
+	if (fs && replayJournal(fs, fsPath)) {
+		cerr << "Could not replay journal of file system.\n";
+		delete fs;
+		err = 1;
+	} else if (fs) {
+		cout << setw(9) << "Type |";
+		cout << setw(10) << "Start |";
+		cout << setw(10) << "End |";
+		cout << setw(8) << "Size";
+		cout << endl;
+		cout << "-------------------------------------";
+		cout << endl;
+		fs->walk([](const char *type, uint64_t start, uint64_t end) {
+			cout << setw(7) << type << " |";
+			cout << setw(8) << start << " |";
+			cout << setw(8) << end << " |";
+			cout << setw(8) << (end - start);
 			cout << endl;
-			cout << "-------------------------------------";
-			cout << endl;
-			fs->walk([](const char *type, uint64_t start, uint64_t end) {
-				cout << setw(7) << type << " |";
-				cout << setw(8) << start << " |";
-				cout << setw(8) << end << " |";
-				cout << setw(8) << (end - start);
-				cout << endl;
-				return 0;
-			});
+			return 0;
+		});
+		delete fs;
+	} else {
+		cerr << "Invalid file system.\n";
+		err = 1;
+	}
+	return err;
+}
+
+int verify(int argc, char **args) {
+	auto err = 1;
+	if (argc >= 3) {
+		auto fsPath = args[2];
+		auto fs = mapFileSystem(fsPath, false);
+		if (fs) {
+			if (replayJournal(fs, fsPath)) {
+				fprintf(stderr, "Could not replay journal of file system: %s\n", fsPath);
+			} else {
+				auto bad = fs->verify();
+				if (bad < 0) {
+					fprintf(stderr, "The inode list of the file system is broken: %s\n", fsPath);
+				} else if (bad) {
+					fprintf(stderr, "%d inodes failed their checksums: %s\n", bad, fsPath);
+				} else {
+					err = 0;
+				}
+			}
 			delete fs;
 		} else {
-			cerr << "Invalid file system.\n";
-			err = 1;
+			fprintf(stderr, "Could not open file system: %s\n", fsPath);
 		}
-		delete []fsBuff;
 	} else {
-		err = 2;
+		fprintf(stderr, "Insufficient arguments\n");
 	}
 	return err;
 }
@@ -373,7 +533,11 @@ int main(int argc, char **args) {
 		{ "write-expand", [](int argc, char **args) { return write(argc, args, true); } },
 		{ "compact", compact },
 		{ "rm", remove },
+		{ "jwrite", journalWrite },
+		{ "jrm", journalRemove },
+		{ "fold", fold },
 		{ "walk", walk },
+		{ "verify", verify },
 		{ "help", help },
 		{ "version", version },
 	};
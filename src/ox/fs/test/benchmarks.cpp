@@ -0,0 +1,633 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ox/fs/concurrentfs.hpp>
+#include <ox/fs/filesystem.hpp>
+#include <ox/std/std.hpp>
+
+using namespace std;
+using namespace ox;
+
+template<typename F>
+double timeMs(F f) {
+	auto start = chrono::steady_clock::now();
+	f();
+	chrono::duration<double, milli> d = chrono::steady_clock::now() - start;
+	return d.count();
+}
+
+/**
+ * Formats a FileStore64 with the given number of inodes, with every other
+ * one removed to leave a gap after each remaining inode.
+ */
+uint8_t *fragmentedStore(uint64_t inodes, size_t size) {
+	auto buff = new uint8_t[size];
+	FileStore64::format(buff, size);
+	auto fs = (FileStore64*) buff;
+	for (uint64_t i = 1; i <= inodes * 2; i++) {
+		fs->write(i, &i, sizeof(i));
+	}
+	for (uint64_t i = 1; i <= inodes * 2; i += 2) {
+		fs->remove(i);
+	}
+	return buff;
+}
+
+/**
+ * Reads the given data the way FileStore::read<T> did before it copied in
+ * bulk, building each T a byte at a time.
+ */
+template<typename T>
+void byteLoopRead(uint8_t *it, uint64_t readSize, T *data) {
+	readSize /= sizeof(T);
+	for (uint64_t i = 0; i < readSize; i++) {
+		T val;
+		for (size_t i = 0; i < sizeof(T); i++) {
+			((uint8_t*) (&val))[i] = *(it++);
+		}
+		*(data++) = val;
+	}
+}
+
+map<string, int(*)(string)> benchmarks = {
+	{
+		{
+			"FileStore64::read<uint32_t>",
+			[](string) {
+				const uint64_t values = 1024 * 1024;
+				const size_t size = values * sizeof(uint32_t) * 2;
+				auto buff = new uint8_t[size];
+				FileStore64::format(buff, size);
+				auto fs = (FileStore64*) buff;
+				auto in = new uint32_t[values];
+				auto out = new uint32_t[values];
+				for (uint64_t i = 0; i < values; i++) {
+					in[i] = i;
+				}
+				fs->write(1, in, values * sizeof(uint32_t));
+
+				auto bulk = timeMs([fs, out] {
+					for (int i = 0; i < 10; i++) {
+						fs->read(1, 0, values * sizeof(uint32_t), out, nullptr);
+					}
+				});
+				int err = ox_memcmp(in, out, values * sizeof(uint32_t)) != 0;
+
+				auto view = fs->view(1);
+				auto byteLoop = timeMs([view, out] {
+					for (int i = 0; i < 10; i++) {
+						byteLoopRead(view.data, view.size, out);
+					}
+				});
+
+				cout << "10 reads of " << values << " uint32_ts: bulk " << bulk
+				     << " ms, byte loop " << byteLoop << " ms\n";
+
+				delete []out;
+				delete []in;
+				delete []buff;
+				return err;
+			}
+		},
+		{
+			"FileStore64::compact",
+			[](string) {
+				for (uint64_t inodes : {10000, 100000}) {
+					const size_t size = inodes * 256;
+					auto src = fragmentedStore(inodes, size);
+					auto buff = new uint8_t[size];
+
+					ox_memcpy(buff, src, size);
+					auto single = timeMs([buff] {
+						((FileStore64*) buff)->compact();
+					});
+
+					ox_memcpy(buff, src, size);
+					auto perInode = timeMs([buff, size] {
+						((FileStore64*) buff)->compactStep(size);
+					});
+
+					cout << inodes << " inodes: compact " << single
+					     << " ms, compactStep (tree search per inode) " << perInode << " ms\n";
+
+					delete []buff;
+					delete []src;
+				}
+				return 0;
+			}
+		},
+		{
+			"FileSystem64::inodeCache",
+			[](string) {
+				const uint64_t inodes = 20000;
+				const uint64_t lookups = 2000000;
+				const size_t size = inodes * 128;
+				auto buff = new uint8_t[size];
+				FileSystem64::format(buff, size, true);
+				FileSystem64 fs(buff);
+				auto store = (FileStore64*) buff;
+				for (uint64_t i = 100; i < 100 + inodes; i++) {
+					fs.write(i, &i, sizeof(i));
+				}
+
+				// hot is the share of lookups that go to the 64 hottest inodes
+				for (int hot : {50, 90, 99}) {
+					RandomSeed seed = {1, 2};
+					Random rand(seed);
+					vector<uint64_t> ids(lookups);
+					for (auto &id : ids) {
+						const auto r = rand.gen();
+						id = 100 + ((int) (r % 100) < hot ? (r >> 8) % 64 : (r >> 8) % inodes);
+					}
+
+					uint64_t hits = 0;
+					for (auto id : ids) {
+						hits += fs.inodeCached(id);
+						fs.stat(id);
+					}
+
+					uint64_t sink = 0;
+					auto cached = timeMs([&] {
+						for (auto id : ids) {
+							sink += fs.stat(id).size;
+						}
+					});
+					auto uncached = timeMs([&] {
+						for (auto id : ids) {
+							sink += store->stat(id).size;
+						}
+					});
+					cout << hot << "% of lookups on 64 inodes: hit rate " << 100.0 * hits / lookups
+					     << "%, stat with cache " << cached << " ms, tree search " << uncached
+					     << " ms (" << sink % 2 << ")\n";
+				}
+
+				delete []buff;
+				return 0;
+			}
+		},
+		{
+			"ConcurrentFileSystem::read",
+			[](string) {
+				const size_t size = 1024 * 1024;
+				const int files = 64;
+				const uint64_t reads = 100000;
+				auto buff = new uint8_t[size];
+				FileSystem64::format(buff, size, true);
+				FileSystem64 plain(buff);
+				ConcurrentFileSystem concurrent(new FileSystem64(buff));
+				mutex globalLock;
+
+				vector<string> paths;
+				plain.mkdir("/dir");
+				for (int i = 0; i < files; i++) {
+					uint8_t data[256] = {};
+					paths.push_back("/dir/file" + to_string(i));
+					plain.write(paths.back().c_str(), data, sizeof(data));
+				}
+
+				// reads of random files from each thread, serialized by one mutex
+				// or run side by side under the ConcurrentFileSystem's lock
+				auto run = [&](unsigned threads, bool serialized) {
+					return timeMs([&] {
+						vector<thread> workers;
+						for (unsigned t = 0; t < threads; t++) {
+							workers.emplace_back([&, t] {
+								uint8_t out[256];
+								for (uint64_t i = 0; i < reads; i++) {
+									auto path = paths[(i * 7 + t) % files].c_str();
+									if (serialized) {
+										lock_guard<mutex> lock(globalLock);
+										plain.read(path, out, sizeof(out));
+									} else {
+										concurrent.read(path, out, sizeof(out));
+									}
+								}
+							});
+						}
+						for (auto &w : workers) {
+							w.join();
+						}
+					});
+				};
+
+				const auto maxThreads = max(thread::hardware_concurrency(), 4u);
+				for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+					const auto total = (double) reads * threads;
+					auto mutexMs = run(threads, true);
+					auto rwMs = run(threads, false);
+					cout << threads << " threads: global mutex " << total / mutexMs / 1000
+					     << " M reads/s, ConcurrentFileSystem " << total / rwMs / 1000 << " M reads/s\n";
+				}
+
+				delete []buff;
+				return 0;
+			}
+		},
+		{
+			"FileStore64::verifyAll",
+			[](string) {
+				const uint64_t files = 1024;
+				const uint64_t fileSize = 64 * 1024;
+				const size_t size = files * fileSize + 1024 * 1024;
+				auto buff = new uint8_t[size];
+				FileStore64::format(buff, size);
+				auto fs = (FileStore64*) buff;
+				auto data = new uint8_t[fileSize];
+				for (uint64_t i = 0; i < fileSize; i++) {
+					data[i] = i * 31;
+				}
+				for (uint64_t i = 1; i <= files; i++) {
+					data[0] = i;
+					fs->write(i, data, fileSize);
+				}
+				const double mb = files * fileSize / (1024. * 1024.);
+
+				int bad = 0;
+				auto verifyMs = timeMs([&]() {
+					for (int i = 0; i < 10; i++) {
+						bad |= fs->verifyAll();
+					}
+				});
+				uint32_t crc = 0;
+				auto tableMs = timeMs([&]() {
+					for (uint64_t i = 1; i <= files; i++) {
+						auto v = fs->view(i);
+						crc ^= ox_crc32cTable(v.data, v.size);
+					}
+				}) * 10;
+				auto copyMs = timeMs([&]() {
+					for (int r = 0; r < 10; r++) {
+						for (uint64_t i = 1; i <= files; i++) {
+							auto v = fs->view(i);
+							ox_memcpy(data, v.data, v.size);
+						}
+					}
+				});
+				cout << "verifyAll: " << mb * 10 / verifyMs << " MB/ms, table CRC32C: " << mb * 10 / tableMs
+				     << " MB/ms, ox_memcpy: " << mb * 10 / copyMs << " MB/ms (" << crc << ")\n";
+
+				delete []data;
+				delete []buff;
+				return bad;
+			}
+		},
+		{
+			"FileStore64::write(compressed)",
+			[](string) {
+				const uint64_t files = 512;
+				const uint64_t fileSize = 16 * 1024;
+				const size_t size = files * fileSize * 2;
+				auto buff = new uint8_t[size];
+				FileStore64::format(buff, size, 0, FileStoreOption_Compress);
+				auto fs = (FileStore64*) buff;
+
+				// text made of words drawn from a small vocabulary
+				const char *words[] = {
+					"inode", "store", "file", "the", "of", "write", "read", "block",
+					"data", "and", "compress", "size", "a", "to", "offset", "chunk",
+				};
+				uint64_t x = 88172645463325252ull;
+				auto data = new uint8_t[files * fileSize];
+				for (uint64_t i = 0; i < files * fileSize;) {
+					x ^= x << 13;
+					x ^= x >> 7;
+					x ^= x << 17;
+					auto word = words[x % 16];
+					for (auto c = word; *c && i < files * fileSize; c++) {
+						data[i++] = *c;
+					}
+					if (i < files * fileSize) {
+						data[i++] = x % 7 ? ' ' : '\n';
+					}
+				}
+
+				const auto available = fs->available();
+				auto writeMs = timeMs([&]() {
+					for (uint64_t i = 0; i < files; i++) {
+						fs->write(i + 1, data + i * fileSize, fileSize);
+					}
+				});
+				const double mb = files * fileSize / (1024. * 1024.);
+				const double used = (available - fs->available()) / (1024. * 1024.);
+
+				auto out = new uint8_t[fileSize];
+				int err = 0;
+				auto readMs = timeMs([&]() {
+					for (int r = 0; r < 10; r++) {
+						for (uint64_t i = 0; i < files; i++) {
+							err |= fs->read(i + 1, out, nullptr);
+						}
+					}
+				});
+				auto rangeMs = timeMs([&]() {
+					for (int r = 0; r < 10; r++) {
+						for (uint64_t i = 0; i < files; i++) {
+							err |= fs->read(i + 1, (i * 97) % fileSize, 64, out, nullptr);
+						}
+					}
+				});
+				err |= ox_memcmp(out, data + (files - 1) * fileSize + ((files - 1) * 97) % fileSize, 64) != 0;
+				cout << mb << " MB stored in " << used << " MB, written at " << mb / writeMs
+				     << " MB/ms, read at " << mb * 10 / readMs << " MB/ms, "
+				     << files * 10 / rangeMs << " 64 byte ranged reads/ms\n";
+
+				delete []out;
+				delete []data;
+				delete []buff;
+				return err;
+			}
+		},
+		{
+			"FileStore64::write(dedup)",
+			[](string) {
+				// assets where each file is one of a few images
+				const uint64_t files = 2048;
+				const uint64_t images = 64;
+				const uint64_t fileSize = 16 * 1024;
+				const size_t size = files * (fileSize + 256);
+				auto buff = new uint8_t[size];
+				auto data = new uint8_t[images * fileSize];
+				uint64_t x = 88172645463325252ull;
+				for (uint64_t i = 0; i < images * fileSize; i++) {
+					x ^= x << 13;
+					x ^= x >> 7;
+					x ^= x << 17;
+					data[i] = (uint8_t) x;
+				}
+
+				int err = 0;
+				auto out = new uint8_t[fileSize];
+				const double mb = files * fileSize / (1024. * 1024.);
+				for (auto dedup : {false, true}) {
+					FileStore64::format(buff, size);
+					auto fs = (FileStore64*) buff;
+					fs->setDedup(dedup);
+					const auto available = fs->available();
+					auto writeMs = timeMs([&]() {
+						for (uint64_t i = 0; i < files; i++) {
+							err |= fs->write(i + 1, data + (i * 7 % images) * fileSize, fileSize);
+						}
+					});
+					auto readMs = timeMs([&]() {
+						for (uint64_t i = 0; i < files; i++) {
+							err |= fs->read(i + 1, out, nullptr);
+						}
+					});
+					err |= ox_memcmp(out, data + ((files - 1) * 7 % images) * fileSize, fileSize) != 0;
+					const double used = (available - fs->available()) / (1024. * 1024.);
+					cout << (dedup ? "dedup: " : "plain: ") << mb << " MB stored in " << used
+					     << " MB, saved " << fs->dedupSaved() / (1024. * 1024.) << " MB, written at "
+					     << mb / writeMs << " MB/ms, read at " << mb / readMs << " MB/ms\n";
+				}
+
+				delete []out;
+				delete []data;
+				delete []buff;
+				return err;
+			}
+		},
+		{
+			"FileStore64::write(slabs)",
+			[](string) {
+				// config values and names, a few bytes each
+				const uint64_t files = 64 * 1024;
+				const uint64_t fileSize = 16;
+				const size_t size = files * 128;
+				auto buff = new uint8_t[size];
+
+				int err = 0;
+				uint8_t data[fileSize];
+				uint8_t out[fileSize];
+				for (auto slabs : {false, true}) {
+					FileStore64::format(buff, size);
+					auto fs = (FileStore64*) buff;
+					fs->setSlabs(slabs);
+					const auto available = fs->available();
+					auto writeMs = timeMs([&]() {
+						for (uint64_t i = 0; i < files; i++) {
+							ox_memcpy(data, &i, sizeof(i));
+							ox_memcpy(data + sizeof(i), &i, sizeof(i));
+							err |= fs->write(i + 1, data, fileSize);
+						}
+					});
+					auto readMs = timeMs([&]() {
+						for (uint64_t i = 0; i < files; i++) {
+							err |= fs->read(i + 1, out, nullptr);
+						}
+					});
+					err |= ox_memcmp(out, data, fileSize) != 0;
+					const double used = (available - fs->available()) / 1024.;
+					cout << (slabs ? "slabs: " : "plain: ") << files << " files stored in " << used
+					     << " KB, saved " << fs->slabSaved() / 1024. << " KB, written in "
+					     << writeMs << " ms, read in " << readMs << " ms\n";
+				}
+
+				delete []buff;
+				return err;
+			}
+		},
+		{
+			"FileStore64::view(aligned)",
+			[](string) {
+				// arrays of doubles, summed where they are or after a copy
+				const uint64_t files = 4096;
+				const uint64_t maxValues = 96;
+				const uint64_t passes = 64;
+				const size_t size = files * (maxValues * sizeof(double) + 128);
+				auto buff = new uint8_t[size];
+				// random, so that the files are not compressed
+				double values[maxValues];
+				uint64_t x = 88172645463325252ull;
+				for (uint64_t i = 0; i < maxValues; i++) {
+					x ^= x << 13;
+					x ^= x >> 7;
+					x ^= x << 17;
+					values[i] = (x >> 11) * (1. / (1ull << 53));
+				}
+
+				int err = 0;
+				for (auto aligned : {false, true}) {
+					FileStore64::format(buff, size, 0, aligned ? FileStoreOption_Aligned : 0);
+					auto fs = (FileStore64*) buff;
+					const auto available = fs->available();
+					for (uint64_t i = 0; i < files; i++) {
+						// odd lengths, so that nothing lines up by chance
+						err |= fs->write(i + 1, values, (i % maxValues + 1) * sizeof(double) - i % 3);
+					}
+					double sum = 0;
+					auto ms = timeMs([&]() {
+						double copy[maxValues];
+						for (uint64_t p = 0; p < passes; p++) {
+							for (uint64_t i = 0; i < files; i++) {
+								const double *data = copy;
+								FileStore64::FsSize_t n = 0;
+								if (aligned) {
+									auto view = fs->view(i + 1);
+									data = (double*) view.data;
+									n = view.size;
+								} else {
+									err |= fs->read(i + 1, copy, &n);
+								}
+								for (uint64_t v = 0; v < n / sizeof(double); v++) {
+									sum += data[v];
+								}
+							}
+						}
+					});
+					const double used = (available - fs->available()) / 1024.;
+					cout << (aligned ? "aligned, in place: " : "packed, copied: ") << files << " files in "
+					     << used << " KB, summed " << passes << " times in " << ms << " ms (" << sum << ")\n";
+				}
+
+				delete []buff;
+				return err;
+			}
+		},
+		{
+			"FileStore64::removeIf",
+			[](string) {
+				// temp files torn down at once, from a store half full of them
+				// and from one with a few among many other files
+				const uint64_t files = 64 * 1024;
+				const uint64_t fileSize = 64;
+				const size_t size = files * 256;
+				auto buff = new uint8_t[size];
+
+				int err = 0;
+				uint8_t data[fileSize];
+				ox_memset(data, 0, fileSize);
+				for (uint64_t every : {2, 64}) {
+					for (auto bulk : {false, true}) {
+						FileStore64::format(buff, size);
+						auto fs = (FileStore64*) buff;
+						const auto available = fs->available();
+						for (uint64_t i = 0; i < files; i++) {
+							ox_memcpy(data, &i, sizeof(i));
+							err |= fs->write(i + 1, data, fileSize, i % every ? 1 : 2);
+						}
+						auto removeMs = timeMs([&]() {
+							if (bulk) {
+								err |= fs->removeAllType(2);
+							} else {
+								for (uint64_t i = 0; i < files; i += every) {
+									err |= fs->remove(i + 1);
+								}
+							}
+						});
+						err |= fs->verifyAll();
+						const double used = (available - fs->available()) / 1024.;
+						cout << (bulk ? "removeIf: " : "remove: ") << files / every << " of " << files
+						     << " files removed in " << removeMs << " ms, " << used << " KB left in use\n";
+					}
+				}
+
+				delete []buff;
+				return err;
+			}
+		},
+		{
+			"FileStore64::forEachOfType",
+			[](string) {
+				// a few directories among many assets
+				const uint64_t files = 64 * 1024;
+				const uint64_t dirs = 64;
+				const uint64_t fileSize = 64;
+				const uint64_t passes = 1000;
+				const size_t size = files * 256;
+				auto buff = new uint8_t[size];
+
+				int err = 0;
+				uint8_t data[fileSize];
+				ox_memset(data, 0, fileSize);
+				for (auto indexed : {false, true}) {
+					FileStore64::format(buff, size, 0, indexed ? FileStoreOption_TypeIndex : 0);
+					auto fs = (FileStore64*) buff;
+					for (uint64_t i = 0; i < files; i++) {
+						ox_memcpy(data, &i, sizeof(i));
+						err |= fs->write(i + 1, data, fileSize, i % (files / dirs) ? 1 : 2);
+					}
+					uint64_t found = 0;
+					auto visitMs = timeMs([&]() {
+						for (uint64_t p = 0; p < passes; p++) {
+							fs->forEachOfType(2, [&found](const FileStore64::StatInfo&) {
+								found++;
+								return 0;
+							});
+						}
+					});
+					err |= found != dirs * passes;
+					auto removeMs = timeMs([&]() {
+						err |= fs->removeAllType(2);
+					});
+					cout << (indexed ? "indexed: " : "scanned: ") << passes << " visits of " << dirs << " of "
+					     << files << " files in " << visitMs << " ms, removed in " << removeMs << " ms\n";
+				}
+
+				delete []buff;
+				return err;
+			}
+		},
+		{
+			"FileStore64::append",
+			[](string) {
+				// a log file that grows a record at a time
+				const uint64_t records = 64 * 1024;
+				const uint64_t recordSize = 64;
+				const uint64_t stretches = 8;
+				const size_t size = records * recordSize * 2;
+				auto buff = new uint8_t[size];
+				FileStore64::format(buff, size);
+				auto fs = (FileStore64*) buff;
+
+				int err = fs->write(1, nullptr, 0);
+				uint8_t record[recordSize];
+				ox_memset(record, 'r', recordSize);
+				for (uint64_t s = 0; s < stretches; s++) {
+					auto appendMs = timeMs([&]() {
+						for (uint64_t i = 0; i < records / stretches; i++) {
+							err |= fs->append(1, record, recordSize);
+						}
+					});
+					cout << records / stretches << " appends to a " << fs->stat(1).size / 1024
+					     << " KB file in " << appendMs << " ms\n";
+				}
+				err |= fs->verifyAll() != 0;
+
+				delete []buff;
+				return err;
+			}
+		},
+	},
+};
+
+int main(int argc, const char **args) {
+	int retval = 0;
+	if (argc > 1) {
+		auto benchmarkName = args[1];
+		if (benchmarks.find(benchmarkName) != benchmarks.end()) {
+			retval = benchmarks[benchmarkName]("");
+		} else {
+			retval = -1;
+		}
+	} else {
+		for (auto &b : benchmarks) {
+			cout << b.first << endl;
+			retval |= b.second("");
+		}
+	}
+	return retval;
+}
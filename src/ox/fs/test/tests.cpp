@@ -6,12 +6,21 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <assert.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <map>
 #include <vector>
 #include <string>
+#include <thread>
 #include <ox/fs/filesystem.hpp>
+#include <ox/fs/concurrentfs.hpp>
+#include <ox/fs/journal.hpp>
+#include <ox/fs/mmapfs.hpp>
+#include <ox/fs/mvccfs.hpp>
 #include <ox/fs/pathiterator.hpp>
 #include <ox/std/std.hpp>
 
@@ -327,6 +336,1917 @@ map<string, int(*)(string)> tests = {
 				return retval;
 			}
 		},
+		{
+			"FileSystem32::readView",
+			[](string) {
+				int retval = 0;
+				auto dataIn = "test string";
+				const auto size = 1024 * 64;
+				auto buff = new uint8_t[size];
+				FileSystem32::format(buff, (FileStore32::FsSize_t) size, true);
+				auto fs = (FileSystem32*) createFileSystem(buff, size);
+
+				retval |= fs->mkdir("/usr");
+				retval |= fs->write("/usr/a.txt", (void*) dataIn, ox_strlen(dataIn) + 1);
+
+				auto view = fs->readView("/usr/a.txt");
+				retval |= !view.valid();
+				retval |= view.size != (uint64_t) ox_strlen(dataIn) + 1;
+				retval |= ox_strcmp((const char*) view.data, dataIn) != 0;
+				retval |= view.data < buff || view.data >= buff + size;
+
+				retval |= fs->readView("/usr/b.txt").valid();
+
+				retval |= fs->write("/usr/b.txt", (void*) dataIn, ox_strlen(dataIn) + 1);
+#ifndef NDEBUG
+				// the write may have moved a.txt
+				retval |= view.valid();
+#endif
+				retval |= !fs->readView("/usr/a.txt").valid();
+
+				delete fs;
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"mapFileSystem",
+			[](string) {
+				int retval = 0;
+				auto path = "mapFileSystem.oxfs";
+				auto dataIn = "test string";
+				const auto size = 1024 * 64;
+				auto buff = new uint8_t[size];
+				char out[32];
+				FileSystem32::format(buff, (FileStore32::FsSize_t) size, true);
+				auto file = fopen(path, "wb");
+				retval |= !file || fwrite(buff, size, 1, file) != 1 || fclose(file);
+
+				auto fs = mapFileSystem(path);
+				retval |= !fs;
+				if (fs) {
+					retval |= fs->mkdir("/usr");
+					retval |= fs->write("/usr/a.txt", (void*) dataIn, ox_strlen(dataIn) + 1);
+					retval |= fs->sync();
+					delete fs;
+				}
+
+				// changes to a read only mapping stay out of the file
+				fs = mapFileSystem(path, false);
+				retval |= !fs;
+				if (fs) {
+					retval |= fs->read("/usr/a.txt", out, sizeof(out)) || ox_strcmp(out, dataIn) != 0;
+					retval |= fs->remove("/usr/a.txt");
+					delete fs;
+				}
+
+				file = fopen(path, "rb");
+				retval |= !file || fread(buff, size, 1, file) != 1 || fclose(file);
+				fs = createFileSystem(buff, size);
+				retval |= !fs || fs->read("/usr/a.txt", out, sizeof(out)) || ox_strcmp(out, dataIn) != 0;
+
+				retval |= mapFileSystem("mapFileSystem.missing") != nullptr;
+
+				delete fs;
+				delete []buff;
+				remove(path);
+
+				return retval;
+			}
+		},
+		{
+			"FileSystem::snapshot",
+			[](string) {
+				int retval = 0;
+				auto path = "snapshot.oxfs";
+				auto dataIn = "test string";
+				auto dataIn2 = "other string";
+				const auto size = 1024 * 256;
+				auto buff = new uint8_t[size];
+				char out[32];
+				FileSystem32::format(buff, (FileStore32::FsSize_t) size, true);
+				auto file = fopen(path, "wb");
+				retval |= !file || fwrite(buff, size, 1, file) != 1 || fclose(file);
+
+				auto fs = mapFileSystem(path);
+				retval |= !fs;
+				if (fs) {
+					retval |= fs->mkdir("/usr");
+					retval |= fs->write("/usr/a.txt", (void*) dataIn, ox_strlen(dataIn) + 1);
+					auto snap1 = fs->snapshot();
+					retval |= !snap1;
+
+					// enough writes to touch most of the pages
+					retval |= fs->write("/usr/a.txt", (void*) dataIn2, ox_strlen(dataIn2) + 1);
+					retval |= fs->write("/usr/b.txt", (void*) dataIn, ox_strlen(dataIn) + 1);
+					for (uint64_t i = 100; i < 200; i++) {
+						uint8_t data[1024];
+						ox_memset(data, (int) i, sizeof(data));
+						retval |= fs->write(i, data, sizeof(data));
+					}
+					auto snap2 = fs->snapshot();
+					retval |= !snap2;
+					for (uint64_t i = 100; i < 200; i += 2) {
+						retval |= fs->remove(i);
+					}
+					while (!fs->compactStep(4096));
+
+					retval |= !snap1 || snap1->read("/usr/a.txt", out, sizeof(out)) || ox_strcmp(out, dataIn) != 0;
+					retval |= !snap1 || snap1->stat("/usr/b.txt").inode != 0 || snap1->stat(100).inode != 0;
+					delete snap1;
+
+					retval |= fs->write(300, (void*) dataIn, ox_strlen(dataIn) + 1);
+					retval |= fs->read("/usr/a.txt", out, sizeof(out)) || ox_strcmp(out, dataIn2) != 0;
+					retval |= fs->stat(101).inode != 101 || fs->stat(100).inode != 0;
+					delete fs;
+
+					// a snapshot outlives the file system it was taken of
+					retval |= !snap2 || snap2->read("/usr/a.txt", out, sizeof(out)) || ox_strcmp(out, dataIn2) != 0;
+					for (uint64_t i = 100; snap2 && i < 200; i++) {
+						uint8_t data[1024];
+						retval |= snap2->read(i, data, sizeof(data)) || data[0] != (uint8_t) i || data[1023] != (uint8_t) i;
+					}
+					retval |= !snap2 || snap2->stat(300).inode != 0;
+					delete snap2;
+				}
+
+				// the changes made while the snapshots existed reached the image
+				file = fopen(path, "rb");
+				retval |= !file || fread(buff, size, 1, file) != 1 || fclose(file);
+				fs = createFileSystem(buff, size);
+				retval |= !fs || fs->stat(300).inode != 300 || fs->stat(100).inode != 0;
+
+				// snapshots of plain buffers are copies
+				auto snap = fs ? fs->snapshot() : nullptr;
+				retval |= !snap || fs->remove(300) || snap->stat(300).inode != 300;
+
+				delete snap;
+				delete fs;
+				delete []buff;
+				remove(path);
+
+				return retval;
+			}
+		},
+		{
+			"Journal",
+			[](string) {
+				int retval = 0;
+				auto path = "Journal.oxj";
+				auto dataIn = "test string";
+				const auto size = 1024 * 64;
+				auto image = new uint8_t[size];
+				auto buff = new uint8_t[size];
+				char out[32];
+				FileSystem32::format(image, (FileStore32::FsSize_t) size, true);
+				remove(path);
+
+				ox_memcpy(buff, image, size);
+				auto fs = createFileSystem(buff, size);
+				{
+					Journal journal(fs);
+					retval |= journal.open(path) || !journal.empty();
+					retval |= journal.write(100, (void*) dataIn, ox_strlen(dataIn) + 1);
+					retval |= journal.write(101, (void*) dataIn, ox_strlen(dataIn) + 1);
+					retval |= journal.incLinks(100);
+					retval |= journal.incLinks(100);
+					retval |= journal.commit();
+					retval |= journal.remove(101);
+					retval |= journal.decLinks(100);
+					retval |= journal.commit();
+					// never committed, so dropped on open
+					retval |= journal.write(102, (void*) dataIn, ox_strlen(dataIn) + 1);
+				}
+				delete fs;
+
+				// a torn transaction is dropped too
+				auto file = fopen(path, "ab");
+				retval |= !file || fwrite(dataIn, ox_strlen(dataIn), 1, file) != 1 || fclose(file);
+
+				// replaying twice, as after an interrupted fold, changes nothing
+				ox_memcpy(buff, image, size);
+				fs = createFileSystem(buff, size);
+				for (int i = 0; i < 2; i++) {
+					Journal journal(fs);
+					retval |= journal.open(path) || journal.empty();
+					retval |= journal.replay();
+					retval |= fs->read(100, out, sizeof(out)) || ox_strcmp(out, dataIn) != 0;
+					retval |= fs->stat(100).links != 1;
+					retval |= fs->stat(101).inode != 0;
+					retval |= fs->stat(102).inode != 0;
+				}
+
+				// new records follow the committed ones
+				{
+					Journal journal(fs);
+					retval |= journal.open(path);
+					retval |= journal.write(103, (void*) dataIn, ox_strlen(dataIn) + 1);
+					retval |= journal.commit();
+				}
+				ox_memcpy(buff, image, size);
+				{
+					Journal journal(fs);
+					retval |= journal.open(path) || journal.replay();
+					retval |= fs->stat(100).links != 1 || fs->stat(103).inode != 103;
+					retval |= journal.fold() || !journal.empty();
+				}
+				{
+					Journal journal(fs);
+					retval |= journal.open(path, false) || !journal.empty();
+				}
+
+				delete fs;
+				delete []buff;
+				delete []image;
+				remove(path);
+
+				return retval;
+			}
+		},
+		{
+			"ConcurrentFileSystem",
+			[](string) {
+				const auto size = 1024 * 256;
+				const uint64_t files = 8;
+				auto buff = new uint8_t[size];
+				FileSystem32::format(buff, (FileStore32::FsSize_t) size, true);
+				ConcurrentFileSystem fs(new FileSystem32(buff, true));
+
+				// each file is filled with the byte v and is 64 * v bytes long
+				auto writeFile = [&fs](uint64_t inode, uint8_t v) {
+					uint8_t data[64 * 255];
+					ox_memset(data, v, 64 * v);
+					return fs.write(inode, data, 64 * v);
+				};
+				int retval = 0;
+				for (uint64_t i = 0; i < files; i++) {
+					retval |= writeFile(100 + i, 1);
+				}
+
+				bool done = false;
+				int readErrors = 0;
+				vector<thread> readers;
+				for (int t = 0; t < 4; t++) {
+					readers.emplace_back([&fs, &done, &readErrors, files] {
+						int errors = 0;
+						for (uint64_t i = 0; !__atomic_load_n(&done, __ATOMIC_ACQUIRE); i++) {
+							size_t dataSize = 0;
+							auto data = fs.read(100 + i % files, &dataSize);
+							if (!data || !dataSize || dataSize != (size_t) 64 * data[0]) {
+								errors++;
+							} else {
+								for (size_t j = 0; j < dataSize; j++) {
+									errors += data[j] != data[0];
+								}
+							}
+							delete []data;
+						}
+						__atomic_fetch_add(&readErrors, errors, __ATOMIC_RELAXED);
+					});
+				}
+
+				// files change size, so they move, and compaction moves the rest
+				for (int i = 0; i < 2000 && !retval; i++) {
+					retval |= writeFile(100 + i % files, 1 + i % 50);
+					if (i % 100 == 0) {
+						fs.compactStep(4096);
+					}
+				}
+				__atomic_store_n(&done, true, __ATOMIC_RELEASE);
+				for (auto &t : readers) {
+					t.join();
+				}
+
+				return retval | (readErrors != 0);
+			}
+		},
+		{
+			"MvccFileSystem",
+			[](string) {
+				int retval = 0;
+				auto path = "MvccFileSystem.oxfs";
+				const auto size = 1024 * 256;
+				const uint64_t files = 8;
+				auto buff = new uint8_t[size];
+				FileSystem32::format(buff, (FileStore32::FsSize_t) size, true);
+				auto file = fopen(path, "wb");
+				retval |= !file || fwrite(buff, size, 1, file) != 1 || fclose(file);
+
+				// a version of a plain buffer would be a copy of all of it
+				auto plain = createFileSystem(buff, size);
+				retval |= !plain || MvccFileSystem::create(plain) != nullptr;
+				delete plain;
+				delete []buff;
+
+				auto mapped = mapFileSystem(path);
+				auto fs = mapped ? MvccFileSystem::create(mapped) : nullptr;
+				if (!fs) {
+					delete mapped;
+					return 1;
+				}
+
+				// each file is filled with the byte v and is 64 * v bytes long
+				auto writeFile = [fs](uint64_t inode, uint8_t v) {
+					uint8_t data[64 * 255];
+					ox_memset(data, v, 64 * v);
+					return fs->write(inode, data, 64 * v);
+				};
+				for (uint64_t i = 0; i < files; i++) {
+					retval |= writeFile(100 + i, 1);
+				}
+
+				bool done = false;
+				int readErrors = 0;
+				vector<thread> readers;
+				for (int t = 0; t < 4; t++) {
+					readers.emplace_back([fs, &done, &readErrors, files] {
+						int errors = 0;
+						for (uint64_t i = 0; !__atomic_load_n(&done, __ATOMIC_ACQUIRE); i++) {
+							size_t dataSize = 0;
+							auto data = fs->read(100 + i % files, &dataSize);
+							if (!data || !dataSize || dataSize != (size_t) 64 * data[0]) {
+								errors++;
+							} else {
+								for (size_t j = 0; j < dataSize; j++) {
+									errors += data[j] != data[0];
+								}
+							}
+							delete []data;
+						}
+						__atomic_fetch_add(&readErrors, errors, __ATOMIC_RELAXED);
+					});
+				}
+
+				for (int i = 0; i < 500 && !retval; i++) {
+					retval |= writeFile(100 + i % files, 1 + i % 50);
+					if (i % 100 == 0) {
+						fs->compactStep(4096);
+					}
+				}
+				__atomic_store_n(&done, true, __ATOMIC_RELEASE);
+				for (auto &t : readers) {
+					t.join();
+				}
+				retval |= readErrors != 0;
+
+				// with no readers left, the next change frees every old version
+				retval |= writeFile(100, 2);
+				retval |= fs->retired() != 0;
+				delete fs;
+
+				// the changes went to the image
+				auto check = mapFileSystem(path, false);
+				retval |= !check || check->stat(100).size != 128;
+				delete check;
+				remove(path);
+
+				return retval;
+			}
+		},
+		{
+			"FileSystem32::inodeCache",
+			[](string) {
+				int retval = 0;
+				const auto size = 1024 * 256;
+				const uint64_t files = 500;
+				auto buff = new uint8_t[size];
+				FileSystem32::format(buff, (FileStore32::FsSize_t) size, true);
+				FileSystem32 fs(buff);
+
+				for (uint64_t i = 100; i < 100 + files; i++) {
+					retval |= fs.write(i, &i, sizeof(i));
+				}
+				for (uint64_t i = 100; i < 100 + files; i++) {
+					uint64_t out = 0;
+					retval |= fs.read(i, &out, sizeof(out)) || out != i;
+				}
+				retval |= !fs.inodeCached(100 + files - 1);
+
+				// growing an inode moves it, removing and compacting move others
+				uint64_t big[16] = {};
+				for (uint64_t i = 100; i < 100 + files; i += 7) {
+					big[0] = i;
+					retval |= fs.write(i, big, sizeof(big));
+				}
+				for (uint64_t i = 101; i < 100 + files; i += 5) {
+					retval |= fs.remove(i);
+					retval |= fs.inodeCached(i);
+				}
+				for (uint64_t i = 100; i < 100 + files; i++) {
+					uint64_t out = 0;
+					fs.read(i, &out, sizeof(out));
+				}
+				while (!fs.compactStep(1024));
+				retval |= fs.inodeCached(100 + files - 1);
+
+				for (uint64_t i = 100; i < 100 + files; i++) {
+					uint64_t out[16] = {};
+					const auto removed = i >= 101 && (i - 101) % 5 == 0;
+					const auto grown = !removed && (i - 100) % 7 == 0;
+					auto s = fs.stat(i);
+					if (removed) {
+						retval |= s.inode != 0;
+					} else {
+						retval |= s.inode != i || s.size != (grown ? sizeof(big) : sizeof(i));
+						retval |= fs.read(i, out, sizeof(out)) || out[0] != i;
+					}
+				}
+
+				delete []buff;
+				return retval;
+			}
+		},
+		{
+			"FileSystem32::inodeCache(slabs)",
+			[](string) {
+				int retval = 0;
+				const auto size = 1024 * 16;
+				auto buff = new uint8_t[size];
+				FileSystem32::format(buff, (FileStore32::FsSize_t) size, true);
+				auto store = (FileStore32*) buff;
+				store->setSlabs(true);
+				FileSystem32 fs(buff);
+
+				// fill the store with files too big for slabs, then leave gaps
+				// too small for a growing slab, so its allocation compacts
+				uint8_t big[300] = {};
+				uint64_t bigs = 100;
+				while (fs.write(bigs, big, sizeof(big)) == 0) {
+					bigs++;
+				}
+				for (uint64_t i = 100; i < bigs; i += 2) {
+					retval |= fs.remove(i);
+				}
+				for (uint64_t i = 101; i < bigs; i += 2) {
+					retval |= fs.stat(i).inode != i || !fs.inodeCached(i);
+				}
+				const auto moves = store->moves();
+				uint8_t small[20] = {};
+				for (uint64_t i = 1000; store->moves() == moves && fs.write(i, small, sizeof(small)) == 0; i++);
+				retval |= store->moves() == moves;
+
+				// the links must land on the inodes where they are now
+				for (uint64_t i = 101; i < bigs; i += 2) {
+					retval |= fs.incLinks(i);
+					retval |= store->stat(i).links != 1 || fs.stat(i).links != 1;
+				}
+				retval |= fs.verify() != 0;
+
+				delete []buff;
+				return retval;
+			}
+		},
+		{
+			"FileStore64::write(sequential)",
+			[](string) {
+				int retval = 0;
+				const uint64_t inodes = 100000;
+				const auto size = 1024 * 1024 * 16;
+				auto buff = new uint8_t[size];
+				FileStore64::format(buff, size);
+				auto fs = (FileStore64*) buff;
+
+				// sequential ids are the worst case for an unbalanced tree
+				for (uint64_t i = 1; i <= inodes && !retval; i++) {
+					retval |= fs->write(i, &i, sizeof(i));
+				}
+
+				for (uint64_t i = 2; i <= inodes && !retval; i += 2) {
+					retval |= fs->remove(i);
+				}
+
+				for (uint64_t i = 1; i <= inodes && !retval; i++) {
+					uint64_t out = 0;
+					auto err = fs->read(i, &out, nullptr);
+					if (i % 2) {
+						retval |= err || out != i;
+					} else {
+						retval |= err == 0;
+					}
+				}
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::upgrade",
+			[](string) {
+				int retval = 0;
+				// the version 7 layout of a FileStore32
+				struct __attribute__((packed)) HeaderV7 {
+					uint16_t version;
+					uint16_t fsType;
+					uint32_t size;
+					uint32_t memUsed;
+					uint32_t rootInode;
+				};
+				struct __attribute__((packed)) InodeV7 {
+					uint32_t prev;
+					uint32_t next;
+					uint32_t dataLen;
+					uint16_t id;
+					uint16_t links;
+					uint8_t fileType;
+					uint32_t left;
+					uint32_t right;
+				};
+
+				const auto size = 4096;
+				auto buff = new uint8_t[size];
+				ox_memset(buff, 0, size);
+				auto header = (HeaderV7*) buff;
+				auto first = sizeof(HeaderV7);
+				auto hello = first + sizeof(InodeV7);
+				// leave a gap between hello and world
+				auto world = hello + sizeof(InodeV7) + 6 + 30;
+				header->version = bigEndianAdapt((uint16_t) 7);
+				header->size = bigEndianAdapt((uint32_t) size);
+				header->memUsed = bigEndianAdapt((uint32_t) (sizeof(HeaderV7) + 3 * sizeof(InodeV7) + 12));
+				header->rootInode = bigEndianAdapt((uint32_t) first);
+
+				auto inode = (InodeV7*) &buff[first];
+				inode->prev = bigEndianAdapt((uint32_t) world);
+				inode->next = bigEndianAdapt((uint32_t) hello);
+				inode->right = bigEndianAdapt((uint32_t) hello);
+
+				inode = (InodeV7*) &buff[hello];
+				inode->prev = bigEndianAdapt((uint32_t) first);
+				inode->next = bigEndianAdapt((uint32_t) world);
+				inode->dataLen = bigEndianAdapt((uint32_t) 6);
+				inode->id = bigEndianAdapt((uint16_t) 5);
+				inode->right = bigEndianAdapt((uint32_t) world);
+				ox_memcpy(inode + 1, "Hello", 6);
+
+				inode = (InodeV7*) &buff[world];
+				inode->prev = bigEndianAdapt((uint32_t) hello);
+				inode->next = bigEndianAdapt((uint32_t) first);
+				inode->dataLen = bigEndianAdapt((uint32_t) 6);
+				inode->id = bigEndianAdapt((uint16_t) 9);
+				ox_memcpy(inode + 1, "World", 6);
+
+				auto fs = (FileStore32*) buff;
+				char out[6];
+				retval |= fs->upgrade();
+				retval |= fs->version() != FileStore32::VERSION;
+				retval |= fs->read(5, out, nullptr) || ox_strcmp(out, "Hello") != 0;
+				retval |= fs->read(9, out, nullptr) || ox_strcmp(out, "World") != 0;
+				retval |= fs->write(7, (void*) "Ox", 3);
+				retval |= fs->read(7, out, nullptr) || ox_strcmp(out, "Ox") != 0;
+				retval |= fs->read(9, out, nullptr) || ox_strcmp(out, "World") != 0;
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::write(hole reuse)",
+			[](string) {
+				int retval = 0;
+				static vector<uint64_t> inodes;
+				const auto size = 4096;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+
+				retval |= fs->write(1, (void*) "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", 33);
+				retval |= fs->write(2, (void*) "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb", 33);
+				retval |= fs->write(3, (void*) "cccccccccccccccccccccccccccccccc", 33);
+				fs->walk([](const char*, uint64_t start, uint64_t) {
+					inodes.push_back(start);
+					return 0;
+				});
+				auto holeAddr = inodes[3];
+				inodes.clear();
+
+				// 2 should land in the hole it leaves, not after 3
+				retval |= fs->remove(2);
+				retval |= fs->write(2, (void*) "dddddddddddddddd", 17);
+				fs->walk([](const char*, uint64_t start, uint64_t) {
+					inodes.push_back(start);
+					return 0;
+				});
+				retval |= inodes[3] != holeAddr;
+
+				char out[33];
+				retval |= fs->read(2, out, nullptr) || ox_strcmp(out, "dddddddddddddddd") != 0;
+				retval |= fs->read(3, out, nullptr) || ox_strcmp(out, "cccccccccccccccccccccccccccccccc") != 0;
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::write(random)",
+			[](string) {
+				int retval = 0;
+				map<uint16_t, string> files;
+				Random rand;
+				const auto size = 1024 * 16;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+
+				for (int i = 0; i < 20000 && !retval; i++) {
+					uint16_t id = rand.gen() % 200 + 1;
+					if (rand.gen() % 4 == 0) {
+						auto err = fs->remove(id);
+						retval |= (err == 0) != (files.erase(id) == 1);
+					} else {
+						string data(rand.gen() % 200 + 1, 'a' + id % 26);
+						if (fs->write(id, (void*) data.c_str(), data.size()) == 0) {
+							files[id] = data;
+						}
+					}
+				}
+
+				for (auto &f : files) {
+					char out[200];
+					FileStore32::FsSize_t outSize = 0;
+					retval |= fs->read(f.first, out, &outSize);
+					retval |= string(out, outSize) != f.second;
+				}
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::compactStep",
+			[](string) {
+				int retval = 0;
+				static vector<pair<uint64_t, uint64_t>> inodes;
+				const auto size = 1024 * 64;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+
+				for (uint16_t i = 1; i <= 100; i++) {
+					string data(i, 'a' + i % 26);
+					retval |= fs->write(i, (void*) data.c_str(), data.size());
+				}
+				for (uint16_t i = 1; i <= 100; i += 3) {
+					retval |= fs->remove(i);
+				}
+
+				// every file must be intact between steps
+				auto done = false;
+				for (int step = 0; !done && !retval; step++) {
+					done = fs->compactStep(256);
+					for (uint16_t i = 1; i <= 100; i++) {
+						char out[100];
+						FileStore32::FsSize_t outSize = 0;
+						auto err = fs->read(i, out, &outSize);
+						if (i % 3 == 1) {
+							retval |= err == 0;
+						} else {
+							retval |= err || string(out, outSize) != string(i, 'a' + i % 26);
+						}
+					}
+				}
+
+				fs->walk([](const char*, uint64_t start, uint64_t end) {
+					inodes.push_back(make_pair(start, end));
+					return 0;
+				});
+				for (size_t i = 1; i < inodes.size(); i++) {
+					retval |= inodes[i - 1].second != inodes[i].first;
+				}
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::compact",
+			[](string) {
+				int retval = 0;
+				static vector<pair<uint64_t, uint64_t>> inodes;
+				const auto size = 1024 * 64;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+
+				for (uint16_t i = 1; i <= 100; i++) {
+					string data(i, 'a' + i % 26);
+					retval |= fs->write(i, (void*) data.c_str(), data.size());
+				}
+				for (uint16_t i = 1; i <= 100; i += 3) {
+					retval |= fs->remove(i);
+				}
+
+				fs->compact();
+
+				for (uint16_t i = 1; i <= 100; i++) {
+					char out[100];
+					FileStore32::FsSize_t outSize = 0;
+					auto err = fs->read(i, out, &outSize);
+					if (i % 3 == 1) {
+						retval |= err == 0;
+					} else {
+						retval |= err || string(out, outSize) != string(i, 'a' + i % 26);
+					}
+				}
+
+				fs->walk([](const char*, uint64_t start, uint64_t end) {
+					inodes.push_back(make_pair(start, end));
+					return 0;
+				});
+				for (size_t i = 1; i < inodes.size(); i++) {
+					retval |= inodes[i - 1].second != inodes[i].first;
+				}
+
+				// the store must still work after the move
+				retval |= fs->write(1, (void*) "Hello", 6);
+				retval |= fs->remove(2);
+				char out[6];
+				retval |= fs->read(1, out, nullptr) || ox_strcmp(out, "Hello") != 0;
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::write(in place)",
+			[](string) {
+				int retval = 0;
+				static vector<uint64_t> inodes;
+				auto walk = [](FileStore32 *fs) {
+					inodes.clear();
+					fs->walk([](const char*, uint64_t start, uint64_t) {
+						inodes.push_back(start);
+						return 0;
+					});
+					return inodes;
+				};
+				const auto size = 4096;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+				char out[33];
+
+				retval |= fs->write(1, (void*) "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", 33);
+				retval |= fs->write(2, (void*) "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb", 33);
+				retval |= fs->incLinks(1);
+				auto before = walk(fs);
+
+				// same size and smaller writes stay put and keep their links
+				retval |= fs->write(1, (void*) "cccccccccccccccccccccccccccccccc", 33);
+				retval |= walk(fs) != before;
+				retval |= fs->write(1, (void*) "dddd", 5);
+				retval |= walk(fs) != before;
+				retval |= fs->read(1, out, nullptr) || ox_strcmp(out, "dddd") != 0;
+				retval |= fs->stat(1).links != 1;
+
+				// growing back into the slack also stays put
+				retval |= fs->write(1, (void*) "eeeeeeeeeeeeeeeeeeeeeeeeeeeeeeee", 33);
+				retval |= walk(fs) != before;
+				retval |= fs->read(1, out, nullptr) || ox_strcmp(out, "eeeeeeeeeeeeeeeeeeeeeeeeeeeeeeee") != 0;
+				retval |= fs->read(2, out, nullptr) || ox_strcmp(out, "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb") != 0;
+
+				// the last inode can grow into the space after it
+				retval |= fs->write(2, (void*) "ffffffffffffffffffffffffffffffffffffffffffffffff", 49);
+				retval |= walk(fs) != before;
+				retval |= fs->available() != size - before[3] - fs->spaceNeeded(49);
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::write(offset)",
+			[](string) {
+				int retval = 0;
+				const auto size = 4096;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+				char out[32];
+				FileStore32::FsSize_t outSize = 0;
+
+				retval |= fs->write(1, (void*) "Hello World", 12);
+				retval |= fs->write(2, (void*) "Ox", 3);
+				retval |= fs->write(1, (FileStore32::FsSize_t) 6, (void*) "Ox!!!", 5);
+				retval |= fs->read(1, out, &outSize) || outSize != 12 || ox_strcmp(out, "Hello Ox!!!") != 0;
+
+				// running past the end grows the file, 1 cannot grow in place
+				retval |= fs->write(1, (FileStore32::FsSize_t) 11, (void*) " and more", 10);
+				retval |= fs->read(1, out, &outSize) || outSize != 21;
+				retval |= string(out, outSize) != string("Hello Ox!!! and more", 21);
+				retval |= fs->read(2, out, nullptr) || ox_strcmp(out, "Ox") != 0;
+
+				// writes to missing files fail
+				retval |= fs->write(3, (FileStore32::FsSize_t) 0, (void*) "Ox", 3) == 0;
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::append",
+			[](string) {
+				int retval = 0;
+				const auto size = 1024 * 64;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+				string expected;
+
+				retval |= fs->write(1, nullptr, 0);
+				retval |= fs->write(2, nullptr, 0);
+				for (int i = 0; i < 1000; i++) {
+					char c = 'a' + i % 26;
+					retval |= fs->append(1, &c, 1);
+					if (i % 100 == 0) {
+						retval |= fs->append(2, &c, 1);
+					}
+					expected += c;
+				}
+
+				char out[1000];
+				FileStore32::FsSize_t outSize = 0;
+				retval |= fs->read(1, out, &outSize);
+				retval |= string(out, outSize) != expected;
+				retval |= fs->stat(2).size != 10;
+				retval |= fs->append(3, (void*) "a", 1) == 0;
+
+				// appends carry the checksum on rather than recompute it
+				retval |= fs->write(2, 20, (void*) "z", 1);
+				retval |= fs->read(2, out, &outSize);
+				retval |= outSize != 21 || out[10] != 0 || out[19] != 0 || out[20] != 'z';
+				retval |= fs->verifyAll() != 0;
+				((uint8_t*) fs->view(1).data)[500] ^= 1;
+				retval |= fs->verify(1) != 2;
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::write(extents)",
+			[](string) {
+				int retval = 0;
+				static vector<uint64_t> inodes;
+				static int chunks = 0;
+				const auto size = 1024 * 8;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+
+				// fill the store, then punch holes too small for the big file
+				char small[200];
+				ox_memset(small, 's', sizeof(small));
+				FileStore32::InodeId_t ids = 0;
+				while (fs->available() > 300) {
+					retval |= fs->write(++ids, small, sizeof(small));
+				}
+				for (FileStore32::InodeId_t i = 2; i <= ids; i += 2) {
+					retval |= fs->remove(i);
+				}
+				const auto available = fs->available();
+				fs->walk([](const char*, uint64_t start, uint64_t) {
+					inodes.push_back(start);
+					return 0;
+				});
+				auto before = inodes;
+				inodes.clear();
+
+				string expected;
+				for (int i = 0; i < 1000; i++) {
+					expected += 'a' + i % 26;
+				}
+				retval |= fs->write(1000, (void*) expected.data(), expected.size());
+
+				// nothing moved to make room
+				fs->walk([](const char *type, uint64_t start, uint64_t) {
+					inodes.push_back(start);
+					chunks += ox_strcmp(type, "Chunk") == 0;
+					return 0;
+				});
+				for (auto addr : before) {
+					retval |= find(inodes.begin(), inodes.end(), addr) == inodes.end();
+				}
+				retval |= chunks < 2;
+
+				char out[1300];
+				FileStore32::FsSize_t outSize = 0;
+				retval |= fs->stat(1000).size != expected.size();
+				retval |= fs->read(1000, out, &outSize);
+				retval |= string(out, outSize) != expected;
+				retval |= fs->read(1000, 150, 500, out, &outSize);
+				retval |= string(out, outSize) != expected.substr(150, 500);
+
+				retval |= fs->write(1000, 990, (void*) "0123456789", 10);
+				expected.replace(990, 10, "0123456789");
+				retval |= fs->append(1000, (void*) "tail", 4);
+				expected += "tail";
+
+				fs->compact();
+				retval |= fs->read(1000, out, &outSize);
+				retval |= string(out, outSize) != expected;
+				retval |= fs->read(1, out, &outSize);
+				retval |= string(out, outSize) != string(small, sizeof(small));
+
+				retval |= fs->remove(1000);
+				retval |= fs->available() != available;
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::write(compressed)",
+			[](string) {
+				int retval = 0;
+				const auto size = 1024 * 64;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+				auto out = new char[size];
+				FileStore32::FsSize_t outSize = 0;
+
+				string text;
+				while (text.size() < 20000) {
+					text += "line " + to_string(text.size() % 1000) + " of a file that repeats itself\n";
+				}
+
+				// compression is off unless asked for
+				retval |= fs->compress();
+				retval |= fs->write(1, (void*) text.data(), text.size());
+				retval |= fs->view(1).data == nullptr;
+				retval |= fs->remove(1);
+				fs->setCompress(true);
+				retval |= !fs->compress();
+
+				auto available = fs->available();
+				retval |= fs->write(1, (void*) text.data(), text.size());
+				retval |= available - fs->available() > text.size() / 2;
+				retval |= fs->stat(1).size != text.size();
+				retval |= fs->view(1).data != nullptr;
+				retval |= fs->read(1, out, &outSize);
+				retval |= string(out, outSize) != text;
+				// ranges within, across, and at the ends of the blocks
+				for (FileStore32::FsSize_t start : {0, 1, 4095, 4096, 5000, 19990}) {
+					for (FileStore32::FsSize_t len : {1, 10, 4096, 9000}) {
+						retval |= fs->read(1, start, len, out, &outSize);
+						retval |= string(out, outSize) != text.substr(start, len);
+					}
+				}
+				retval |= fs->verifyAll();
+
+				// data that does not compress, and small files, are kept as is
+				uint8_t noise[2000];
+				uint32_t x = 2463534242;
+				for (auto &b : noise) {
+					x ^= x << 13;
+					x ^= x >> 17;
+					x ^= x << 5;
+					b = (uint8_t) x;
+				}
+				available = fs->available();
+				retval |= fs->write(2, noise, sizeof(noise));
+				retval |= available - fs->available() < sizeof(noise);
+				retval |= fs->view(2).data == nullptr;
+				retval |= fs->write(3, (void*) text.data(), 100);
+				retval |= fs->view(3).data == nullptr;
+
+				// changing part of a compressed file decompresses it
+				auto expected = text;
+				retval |= fs->write(1, 100, (void*) "0123456789", 10);
+				expected.replace(100, 10, "0123456789");
+				retval |= fs->append(1, (void*) "tail", 4);
+				expected += "tail";
+				retval |= fs->view(1).data == nullptr;
+				retval |= fs->read(1, out, &outSize);
+				retval |= string(out, outSize) != expected;
+
+				// a rewrite that fits where the file is goes there as is
+				retval |= fs->write(1, (void*) text.data(), text.size());
+				retval |= fs->view(1).data == nullptr;
+				retval |= fs->remove(1);
+				retval |= fs->write(1, (void*) text.data(), text.size());
+				retval |= fs->view(1).data != nullptr;
+				fs->compact();
+				retval |= fs->read(1, out, &outSize);
+				retval |= string(out, outSize) != text;
+				retval |= fs->read(2, out, &outSize);
+				retval |= ox_memcmp(out, noise, sizeof(noise)) != 0;
+				retval |= fs->verifyAll();
+
+				// a small write can reuse the compressed file's inode
+				retval |= fs->write(1, (void*) "small", 6);
+				retval |= fs->read(1, out, &outSize);
+				retval |= outSize != 6 || ox_strcmp(out, "small") != 0;
+				retval |= fs->view(1).data == nullptr;
+
+				// a block that does not decompress fails the read, even the
+				// partial reads that do not check the checksums
+				retval |= fs->remove(1);
+				retval |= fs->write(1, (void*) text.data(), text.size());
+				static uint64_t start = 0;
+				static uint64_t end = 0;
+				start = fs->find(1);
+				fs->walk([](const char*, uint64_t s, uint64_t e) {
+					if (s == start) {
+						end = e;
+					}
+					return 0;
+				});
+				retval |= fs->view(1).data != nullptr || end < start + 1000;
+				ox_memset(buff + end - 1000, 0xff, 1000);
+				retval |= fs->read(1, 19990, 10, out, &outSize) != 2;
+				retval |= fs->read(1, out, &outSize) != 2;
+
+				delete []out;
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::write(batch)",
+			[](string) {
+				int retval = 0;
+				static vector<uint64_t> inodes;
+				const auto size = 1024 * 16;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+
+				retval |= fs->write(1, (void*) "old", 4);
+				retval |= fs->incLinks(1);
+				retval |= fs->write(2, (void*) "gap", 4);
+				retval |= fs->remove(2);
+
+				const int count = 100;
+				char data[count][8];
+				FileStore32::BatchEntry entries[count];
+				for (int i = 0; i < count; i++) {
+					ox_memcpy(data[i], "file 00", 8);
+					data[i][5] += i / 10;
+					data[i][6] += i % 10;
+					entries[i].id = i + 1;
+					entries[i].data = data[i];
+					entries[i].dataLen = 8;
+					entries[i].fileType = 3;
+				}
+				// the last one wins, as with separate writes
+				entries[count - 1].id = 50;
+				retval |= fs->write(entries, count);
+
+				char out[8];
+				for (int i = 0; i < count - 1; i++) {
+					auto id = entries[i].id;
+					auto expected = id == 50 ? data[count - 1] : data[i];
+					retval |= fs->read(id, out, nullptr) || ox_memcmp(out, expected, 8) != 0;
+					retval |= fs->stat(id).fileType != 3;
+				}
+				retval |= fs->stat(1).links != 1;
+
+				// the batch went in as one block, not into the small gap
+				fs->walk([](const char*, uint64_t start, uint64_t end) {
+					inodes.push_back(start);
+					inodes.push_back(end);
+					return 0;
+				});
+				// only the first 50 left a hole in it
+				int holes = 0;
+				for (size_t i = 6; i < inodes.size(); i += 2) {
+					holes += inodes[i] != inodes[i - 1];
+				}
+				retval |= holes != 1;
+
+				FileStore32::BatchEntry tooBig = {200, data, size, 0};
+				retval |= fs->write(&tooBig, 1) == 0;
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::flushDirty",
+			[](string) {
+				int retval = 0;
+				const auto size = 1024 * 128;
+				auto buff = new uint8_t[size];
+				static uint8_t *copy = new uint8_t[size];
+				static uint64_t flushed = 0;
+				auto flush = [](uint64_t offset, const uint8_t *data, uint64_t len) {
+					ox_memcpy(copy + offset, data, len);
+					flushed += len;
+					return 0;
+				};
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+				retval |= fs->flushDirty(flush);
+				retval |= flushed != size;
+
+				// whatever happens, the flushed copy must match the buffer
+				srand(3);
+				for (int i = 0; i < 2000 && !retval; i++) {
+					const FileStore32::InodeId_t id = 1 + rand() % 50;
+					char data[600];
+					ox_memset(data, 'a' + i % 26, sizeof(data));
+					switch (rand() % 6) {
+						case 0:
+						case 1:
+							fs->write(id, data, rand() % sizeof(data));
+							break;
+						case 2:
+							fs->append(id, data, rand() % 100);
+							break;
+						case 3:
+							fs->remove(id);
+							break;
+						case 4:
+							fs->compactStep(rand() % 1000);
+							break;
+						case 5:
+							fs->incLinks(id);
+							break;
+					}
+					if (i % 100 == 99) {
+						fs->compact();
+					}
+					retval |= fs->flushDirty(flush);
+					retval |= ox_memcmp(buff, copy, size) != 0;
+				}
+
+				// a small change costs a small flush
+				fs->write(1, (void*) "a", 1);
+				retval |= fs->flushDirty(flush);
+				flushed = 0;
+				retval |= fs->incLinks(1);
+				retval |= fs->flushDirty(flush);
+				// the inode and the record of the one range
+				retval |= flushed > 64 || flushed == 0;
+				retval |= ox_memcmp(buff, copy, size) != 0;
+
+				// more scattered changes than there are ranges are merged, not
+				// lost
+				for (FileStore32::InodeId_t id = 1; id <= 50; id++) {
+					fs->incLinks(id);
+				}
+				flushed = 0;
+				retval |= fs->flushDirty(flush);
+				retval |= ox_memcmp(buff, copy, size) != 0;
+				retval |= flushed > size / 2;
+
+				// nothing changed, only the empty record goes out
+				flushed = 0;
+				retval |= fs->flushDirty(flush);
+				retval |= flushed != sizeof(uint16_t);
+
+				// shrinking compacts the store, growing it again adds space that
+				// has never been flushed
+				fs->resize(size / 2);
+				retval |= fs->flushDirty(flush);
+				retval |= ox_memcmp(buff, copy, fs->size()) != 0;
+				fs->resize(size);
+				retval |= fs->flushDirty(flush);
+				retval |= ox_memcmp(buff, copy, size) != 0;
+
+				delete []copy;
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::verifyAll",
+			[](string) {
+				int retval = 0;
+				static uint64_t chunkEnd = 0;
+				const auto size = 1024 * 8;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+
+				// spread a file over chunks the way write(extents) does
+				char small[200];
+				ox_memset(small, 's', sizeof(small));
+				FileStore32::InodeId_t ids = 0;
+				while (fs->available() > 300) {
+					retval |= fs->write(++ids, small, sizeof(small));
+				}
+				for (FileStore32::InodeId_t i = 2; i <= ids; i += 2) {
+					retval |= fs->remove(i);
+				}
+				string big(1000, 'b');
+				retval |= fs->write(1000, (void*) big.data(), big.size());
+				retval |= fs->write(1000, 500, (void*) "0123456789", 10);
+				retval |= fs->append(1000, (void*) "tail", 4);
+				retval |= fs->write(1, 100, (void*) "0123456789", 10);
+				FileStore32::BatchEntry batch[] = {
+					{1001, small, 50, 0},
+					{1002, small, 60, 0},
+				};
+				retval |= fs->write(batch, 2);
+				retval |= fs->verifyAll() != 0;
+				retval |= fs->verify(1000) != 0;
+				retval |= fs->verify(1) != 0;
+				retval |= fs->verify(2) != 1;
+
+				// compaction moves inodes without changing their data
+				fs->compact();
+				retval |= fs->verifyAll() != 0;
+
+				char out[1100];
+				auto data = (uint8_t*) fs->view(3).data;
+				data[7] ^= 1;
+				retval |= fs->verify(3) != 2;
+				retval |= fs->read(3, out, nullptr) != 2;
+				retval |= fs->verifyAll() != 1;
+				// partial reads do not check
+				retval |= fs->read(3, 0, 10, out, nullptr);
+				retval |= fs->write(3, small, sizeof(small));
+				retval |= fs->verifyAll() != 0;
+
+				fs->walk([](const char *type, uint64_t, uint64_t end) {
+					if (!chunkEnd && ox_strcmp(type, "Chunk") == 0) {
+						chunkEnd = end;
+					}
+					return 0;
+				});
+				if (chunkEnd) {
+					buff[chunkEnd - 1] ^= 1;
+					retval |= fs->read(1000, out, nullptr) != 2;
+					retval |= fs->verifyAll() != 1;
+					buff[chunkEnd - 1] ^= 1;
+					retval |= fs->read(1000, out, nullptr);
+				} else {
+					retval |= 1;
+				}
+
+				// point an inode's next, which follows its prev, out of bounds
+				const uint32_t next = 0xffffffff;
+				ox_memcpy(&buff[fs->find(1001) + sizeof(uint32_t)], &next, sizeof(next));
+				retval |= fs->verifyAll() != -1;
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::dedup",
+			[](string) {
+				int retval = 0;
+				static int blobs = 0;
+				const auto size = 1024 * 32;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+				const auto empty = fs->available();
+				char out[2000];
+				FileStore32::FsSize_t outSize = 0;
+
+				// data that does not compress, so that only sharing shrinks it
+				uint8_t a[1000], b[1000];
+				uint64_t x = 88172645463325252ull;
+				for (size_t i = 0; i < sizeof(a); i++) {
+					x ^= x << 13;
+					x ^= x >> 7;
+					x ^= x << 17;
+					a[i] = (uint8_t) x;
+					b[i] = (uint8_t) (x >> 8);
+				}
+
+				// without dedup every copy is stored
+				retval |= fs->dedup();
+				retval |= fs->write(1, a, sizeof(a));
+				retval |= fs->write(2, a, sizeof(a));
+				retval |= fs->view(1).data == fs->view(2).data;
+				retval |= fs->dedupSaved() != 0;
+				retval |= fs->remove(1) || fs->remove(2);
+
+				fs->setDedup(true);
+				retval |= !fs->dedup();
+				retval |= fs->write(1, a, sizeof(a), 5);
+				auto available = fs->available();
+				retval |= fs->write(2, a, sizeof(a));
+				retval |= fs->write(3, a, sizeof(a));
+				retval |= fs->write(4, b, sizeof(b));
+				// the copies cost no more than their inodes
+				retval |= available - fs->available() > 2 * sizeof(a) - 2 * 900 + sizeof(b) + 100;
+				retval |= fs->dedupSaved() < (int64_t) (2 * 900);
+				retval |= fs->view(1).data != fs->view(2).data || fs->view(1).data != fs->view(3).data;
+				retval |= fs->view(1).data == fs->view(4).data;
+				retval |= fs->stat(1).size != sizeof(a) || fs->stat(1).fileType != 5;
+				for (FileStore32::InodeId_t id = 1; id <= 3; id++) {
+					retval |= fs->read(id, out, &outSize);
+					retval |= outSize != sizeof(a) || ox_memcmp(out, a, sizeof(a)) != 0;
+				}
+				retval |= fs->read(2, 10, 20, out, &outSize);
+				retval |= outSize != 20 || ox_memcmp(out, a + 10, 20) != 0;
+				retval |= fs->verifyAll();
+				fs->walk([](const char *type, uint64_t, uint64_t) {
+					blobs += ox_strcmp(type, "Blob") == 0;
+					return 0;
+				});
+				retval |= blobs != 2;
+
+				// the shared data outlives the files that wrote it, and goes
+				// with the last of them
+				retval |= fs->remove(1);
+				retval |= fs->write(2, b, sizeof(b));
+				retval |= fs->read(3, out, &outSize);
+				retval |= outSize != sizeof(a) || ox_memcmp(out, a, sizeof(a)) != 0;
+				retval |= fs->view(2).data != fs->view(4).data;
+				retval |= fs->write(3, 10, (void*) "0123456789", 10);
+				retval |= fs->view(3).data == fs->view(2).data;
+				retval |= fs->read(3, out, &outSize);
+				retval |= ox_memcmp(out, a, 10) != 0 || ox_memcmp(out + 10, "0123456789", 10) != 0;
+				retval |= fs->remove(3);
+				retval |= fs->remove(2);
+				retval |= fs->read(4, out, &outSize);
+				retval |= ox_memcmp(out, b, sizeof(b)) != 0;
+				retval |= fs->remove(4);
+				retval |= fs->available() != empty;
+
+				// compaction moves the shared data with the files
+				retval |= fs->write(10, b, 100);
+				retval |= fs->write(11, a, sizeof(a), 7);
+				retval |= fs->write(12, b, 200);
+				retval |= fs->write(13, a, sizeof(a), 7);
+				retval |= fs->remove(10);
+				retval |= fs->compactStep(size) != true;
+				retval |= fs->remove(12);
+				fs->compact();
+				retval |= fs->read(11, out, &outSize);
+				retval |= ox_memcmp(out, a, sizeof(a)) != 0;
+				retval |= fs->verify(13);
+				retval |= fs->verifyAll();
+
+				// a copy of the store shares the same way
+				auto copyBuff = new uint8_t[size];
+				FileStore32::format(copyBuff, size);
+				auto copy = (FileStore32*) copyBuff;
+				retval |= fs->dumpTo(copy);
+				retval |= !copy->dedup();
+				retval |= copy->view(11).data != copy->view(13).data;
+				retval |= copy->read(13, out, &outSize);
+				retval |= ox_memcmp(out, a, sizeof(a)) != 0;
+				delete []copyBuff;
+
+				retval |= fs->removeAllType(7);
+				retval |= fs->available() != empty;
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::slabs",
+			[](string) {
+				int retval = 0;
+				static int slabs = 0;
+				static int inodes = 0;
+				const auto size = 1024 * 32;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+				const auto empty = fs->available();
+				char out[200];
+				FileStore32::FsSize_t outSize = 0;
+
+				fs->setSlabs(true);
+				retval |= !fs->slabs();
+				// the small files of nearby ids share a slab
+				for (FileStore32::InodeId_t id = 1; id <= 40; id++) {
+					auto data = "file " + to_string(id);
+					retval |= fs->write(id, (void*) data.c_str(), data.size() + 1, id % 2 ? 5 : 7);
+				}
+				retval |= fs->write(41, (void*) "", 0);
+				fs->walk([](const char *type, uint64_t, uint64_t) {
+					slabs += ox_strcmp(type, "Slab") == 0;
+					inodes += ox_strcmp(type, "Inode") == 0;
+					return 0;
+				});
+				// the only inode is the one the store starts with
+				retval |= slabs != 1 || inodes != 1;
+				retval |= fs->slabSaved() <= 0;
+				retval |= fs->find(3) != 0;
+				retval |= fs->read(17, out, &outSize);
+				retval |= outSize != 8 || ox_strcmp(out, "file 17") != 0;
+				retval |= fs->read(23, 5, 2, out, &outSize);
+				retval |= outSize != 2 || ox_memcmp(out, "23", 2) != 0;
+				retval |= ox_strcmp((const char*) fs->view(9).data, "file 9") != 0;
+				retval |= fs->stat(9).size != 7 || fs->stat(9).fileType != 5 || fs->stat(10).fileType != 7;
+				retval |= fs->stat(41).size != 0;
+				retval |= fs->stat(42).inodeId != 0;
+				retval |= fs->incLinks(4) || fs->stat(4).links != 1;
+				retval |= fs->decLinks(4) || fs->stat(4).links != 0;
+				retval |= fs->verify(4) || fs->verifyAll();
+
+				// rewrites that stay small stay in the slab
+				retval |= fs->write(5, (void*) "five", 5, 5);
+				retval |= fs->read(5, out, &outSize) || ox_strcmp(out, "five") != 0;
+				retval |= fs->read(6, out, &outSize) || ox_strcmp(out, "file 6") != 0;
+				retval |= fs->remove(7);
+				retval |= fs->stat(7).inodeId != 0;
+				retval |= fs->read(8, out, &outSize) || ox_strcmp(out, "file 8") != 0;
+
+				// files written to in part or grown large get their own inode
+				retval |= fs->write(8, 6, (void*) "!", 2);
+				retval |= fs->find(8) == 0;
+				retval |= fs->read(8, out, &outSize) || ox_strcmp(out, "file 8!") != 0;
+				char big[150];
+				ox_memset(big, 'b', sizeof(big));
+				retval |= fs->incLinks(12);
+				retval |= fs->write(12, big, sizeof(big), 7);
+				retval |= fs->find(12) == 0 || fs->stat(12).links != 1;
+				retval |= fs->read(12, out, &outSize);
+				retval |= outSize != sizeof(big) || ox_memcmp(out, big, sizeof(big)) != 0;
+				retval |= fs->read(11, out, &outSize) || ox_strcmp(out, "file 11") != 0;
+
+				// compaction moves the slab with the inodes
+				retval |= fs->remove(8);
+				retval |= fs->compactStep(size) != true;
+				fs->compact();
+				retval |= fs->read(13, out, &outSize) || ox_strcmp(out, "file 13") != 0;
+				retval |= fs->read(12, out, &outSize) || ox_memcmp(out, big, sizeof(big)) != 0;
+				retval |= fs->verifyAll();
+
+				// a copy of the store keeps the small files
+				auto copyBuff = new uint8_t[size];
+				FileStore32::format(copyBuff, size);
+				auto copy = (FileStore32*) copyBuff;
+				retval |= fs->dumpTo(copy);
+				retval |= copy->read(13, out, &outSize) || ox_strcmp(out, "file 13") != 0;
+				retval |= copy->stat(14).fileType != 7;
+				delete []copyBuff;
+
+				retval |= fs->removeAllType(5);
+				retval |= fs->stat(13).inodeId != 0;
+				retval |= fs->read(14, out, &outSize) || ox_strcmp(out, "file 14") != 0;
+				retval |= fs->removeAllType(7);
+				retval |= fs->remove(41);
+				retval |= fs->available() != empty;
+
+				// a small file grown large goes straight to an inode of its new
+				// size, so it needs no room for one of its old size, here a gap
+				// that would keep it from growing in place
+				FileStore32::format(buff, size, 0, FileStoreOption_Slabs);
+				retval |= fs->write(1, big, 40) || fs->write(2, big, 40);
+				retval |= fs->incLinks(1);
+				fs->setSlabs(false);
+				retval |= fs->write(50, big, 40);
+				// data that does not compress, to leave too little at the end
+				vector<uint8_t> filler(fs->available() - fs->spaceNeeded(0) - 110);
+				uint32_t seed = 1;
+				for (auto &b : filler) {
+					seed = seed * 1103515245 + 12345;
+					b = seed >> 24;
+				}
+				retval |= fs->write(100, filler.data(), filler.size());
+				retval |= fs->remove(50);
+				retval |= fs->available() != fs->spaceNeeded(sizeof(big));
+				fs->setSlabs(true);
+				retval |= fs->write(1, big, sizeof(big));
+				retval |= fs->find(1) == 0 || fs->stat(1).links != 1;
+				retval |= fs->read(1, out, &outSize) || outSize != sizeof(big);
+				retval |= fs->read(2, out, &outSize) || outSize != 40;
+				retval |= fs->verifyAll();
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::aligned",
+			[](string) {
+				int retval = 0;
+				const auto size = 1024 * 16;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size, 0, FileStoreOption_Aligned);
+				auto fs = (FileStore32*) buff;
+				const auto empty = fs->available();
+				// alignment is from the start of the buffer
+				auto misaligned = [buff, fs]() {
+					int count = 0;
+					for (FileStore32::InodeId_t id = 1; id <= 202; id++) {
+						auto data = fs->view(id).data;
+						count += data && (data - buff) % FileStore32::PAYLOAD_ALIGN != 0;
+					}
+					return count;
+				};
+
+				// data of any length starts aligned
+				for (FileStore32::InodeId_t id = 1; id <= 40; id++) {
+					string data(id * 3, 'a' + id % 26);
+					retval |= fs->write(id, (void*) data.data(), data.size());
+				}
+				retval |= misaligned();
+
+				// so it can be used in place
+				double values[5] = {1.5, 2.5, 3.5, 4.5, 5.5};
+				retval |= fs->write(100, values, sizeof(values));
+				auto view = fs->view(100);
+				retval |= (view.data - buff) % alignof(double) != 0;
+				retval |= ((double*) view.data)[3] != 4.5;
+
+				// gaps are filled at aligned addresses
+				for (FileStore32::InodeId_t id = 1; id <= 40; id += 2) {
+					retval |= fs->remove(id);
+				}
+				for (FileStore32::InodeId_t id = 41; id <= 60; id++) {
+					string data(id % 7 + 1, 'x');
+					retval |= fs->write(id, (void*) data.data(), data.size());
+				}
+				FileStore32::BatchEntry entries[3] = {
+					{200, (void*) "a", 1, 0},
+					{201, (void*) "abcdefghijklmnopq", 17, 0},
+					{202, (void*) "abc", 3, 0},
+				};
+				retval |= fs->write(entries, 3);
+				retval |= misaligned();
+
+				// compaction keeps the alignment
+				retval |= fs->remove(42) || fs->remove(201);
+				fs->compactStep(64);
+				retval |= misaligned();
+				fs->compact();
+				retval |= misaligned();
+				retval |= fs->read(202, values, nullptr) || ox_memcmp(values, "abc", 3) != 0;
+				retval |= ((double*) fs->view(100).data)[4] != 5.5;
+				retval |= fs->verifyAll();
+
+				// the padding is given back with the files
+				for (FileStore32::InodeId_t id = 1; id <= 202; id++) {
+					fs->remove(id);
+				}
+				retval |= fs->available() != empty;
+
+				delete []buff;
+
+				return retval;
+			}
+		},
+		{
+			"FileStore32::removeIf",
+			[](string) {
+				int retval = 0;
+				const auto size = 1024 * 64;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+				fs->setDedup(true);
+				fs->setSlabs(true);
+				fs->setCompress(true);
+				const auto empty = fs->available();
+				char out[400];
+				FileStore32::FsSize_t outSize = 0;
+
+				// data that does not compress or share by accident
+				uint8_t data[100];
+				uint64_t x = 88172645463325252ull;
+				auto fill = [&data, &x]() {
+					for (size_t i = 0; i < sizeof(data); i++) {
+						x ^= x << 13;
+						x ^= x >> 7;
+						x ^= x << 17;
+						data[i] = (uint8_t) x;
+					}
+				};
+				char compressible[300];
+				ox_memset(compressible, 'c', sizeof(compressible));
+
+				// the files kept, one of each kind
+				for (FileStore32::InodeId_t id = 1; id <= 100; id += 2) {
+					fill();
+					retval |= fs->write(id, data, sizeof(data), 7);
+				}
+				uint8_t shared[sizeof(data)];
+				ox_memcpy(shared, data, sizeof(data));
+				retval |= fs->write(302, shared, sizeof(shared), 7);
+				retval |= fs->write(400, (void*) "kept", 5, 7);
+				retval |= fs->write(500, compressible, sizeof(compressible), 7);
+				const auto kept = fs->available();
+
+				// the files removed, which share a blob and a slab with kept
+				// files and fill a slab of their own
+				for (FileStore32::InodeId_t id = 2; id <= 100; id += 2) {
+					fill();
+					retval |= fs->write(id, data, sizeof(data), 5);
+				}
+				retval |= fs->write(301, shared, sizeof(shared), 5);
+				retval |= fs->write(401, (void*) "gone", 5, 5);
+				for (FileStore32::InodeId_t id = 448; id < 460; id++) {
+					retval |= fs->write(id, (void*) "gone", 5, 5);
+				}
+				retval |= fs->write(501, compressible, sizeof(compressible), 5);
+				retval |= fs->available() >= kept;
+
+				retval |= fs->removeIf([](const FileStore32::StatInfo &stat) {
+					return stat.fileType == 5;
+				});
+				retval |= fs->available() != kept;
+				retval |= fs->verifyAll();
+				for (FileStore32::InodeId_t id = 1; id <= 100; id++) {
+					retval |= (fs->stat(id).inodeId != 0) != (id % 2 == 1);
+				}
+				retval |= fs->stat(301).inodeId != 0 || fs->stat(401).inodeId != 0;
+				retval |= fs->stat(448).inodeId != 0 || fs->stat(501).inodeId != 0;
+				retval |= fs->read(302, out, &outSize) || ox_memcmp(out, shared, sizeof(shared)) != 0;
+				retval |= fs->read(400, out, &outSize) || ox_strcmp(out, "kept") != 0;
+				retval |= fs->read(500, out, &outSize) || outSize != sizeof(compressible);
+
+				// removing by id, and the rest by type
+				retval |= fs->removeIf([](const FileStore32::StatInfo &stat) {
+					return stat.inodeId < 50;
+				});
+				retval |= fs->stat(49).inodeId != 0 || fs->stat(51).inodeId == 0;
+				retval |= fs->verifyAll();
+				retval |= fs->removeAllType(7);
+				retval |= fs->available() != empty;
+				retval |= fs->verifyAll();
+
+				delete []buff;
+				return retval;
+			}
+		},
+		{
+			"FileStore32::typeIndex",
+			[](string) {
+				int retval = 0;
+				const auto size = 1024 * 32;
+				auto buff = new uint8_t[size];
+				FileStore32::format(buff, size);
+				auto fs = (FileStore32*) buff;
+				fs->setSlabs(true);
+				char big[100];
+				ox_memset(big, 'b', sizeof(big));
+
+				// counts the files of a type and sums their ids
+				uint64_t count = 0;
+				uint64_t sum = 0;
+				auto tally = [fs, &count, &sum](uint8_t fileType) {
+					count = 0;
+					sum = 0;
+					return fs->forEachOfType(fileType, [&count, &sum, fileType](const FileStore32::StatInfo &stat) {
+						count++;
+						sum += stat.inodeId;
+						return (int) (stat.fileType != fileType);
+					});
+				};
+
+				// files written before the index is turned on get indexed,
+				// 33 shares a list with 1
+				for (FileStore32::InodeId_t id = 1; id <= 30; id++) {
+					big[0] = (char) id;
+					retval |= fs->write(id, big, sizeof(big), id % 3 == 0 ? 33 : 1);
+				}
+				retval |= fs->typeIndex();
+				fs->setTypeIndex(true);
+				retval |= !fs->typeIndex();
+				for (FileStore32::InodeId_t id = 31; id <= 40; id++) {
+					big[0] = (char) id;
+					retval |= fs->write(id, big, sizeof(big), 2);
+				}
+				// a file sharing a blob, and small files in a slab
+				fs->setDedup(true);
+				retval |= fs->write(41, big, sizeof(big), 2);
+				fs->setDedup(false);
+				retval |= fs->write(100, (void*) "small", 6, 2);
+				retval |= fs->write(101, (void*) "small", 6, 1);
+				retval |= tally(1) || count != 21 || sum != 401;
+				retval |= tally(33) || count != 10 || sum != 165;
+				retval |= tally(2) || count != 12 || sum != 496;
+				retval |= tally(3) || count != 0;
+				retval |= fs->verifyAll();
+
+				// the callback can stop the walk
+				retval |= fs->forEachOfType(33, [](const FileStore32::StatInfo&) {
+					return 5;
+				}) != 5;
+
+				// rewrites that change the type move the file between lists,
+				// in place or not
+				retval |= fs->write(31, big, sizeof(big), 1);
+				retval |= fs->write(32, big, sizeof(big) - 10, 33);
+				char bigger[200];
+				ox_memset(bigger, 'b', sizeof(bigger));
+				retval |= fs->write(3, bigger, sizeof(bigger), 2);
+				fs->setDedup(true);
+				retval |= fs->write(41, big, sizeof(big), 33);
+				fs->setDedup(false);
+				retval |= tally(1) || count != 22 || sum != 432;
+				retval |= tally(2) || count != 10 || sum != 395;
+				retval |= tally(33) || count != 11 || sum != 235;
+
+				// the lists follow the files as they are moved
+				for (FileStore32::InodeId_t id = 1; id <= 30; id += 2) {
+					retval |= fs->remove(id);
+				}
+				fs->compactStep(1024);
+				retval |= tally(1) || count != 12 || sum != 282;
+				fs->compact();
+				retval |= tally(2) || count != 9 || sum != 392;
+				retval |= fs->verifyAll();
+
+				// removing a type only visits its list
+				retval |= fs->removeAllType(2);
+				retval |= tally(2) || count != 0;
+				retval |= fs->stat(100).inodeId != 0 || fs->stat(35).inodeId != 0;
+				retval |= tally(33) || count != 7 || sum != 163;
+				retval |= tally(1) || count != 12 || sum != 282;
+				retval |= fs->verifyAll();
+
+				// without the index, the same files are found the slow way, and
+				// the 18 files with an Inode give back their TypeLinks
+				const auto indexed = fs->available();
+				retval |= fs->setTypeIndex(false);
+				retval |= fs->available() != indexed + 18 * 2 * sizeof(FileStore32::FsSize_t);
+				retval |= tally(33) || count != 7 || sum != 163;
+				retval |= fs->verifyAll();
+				retval |= fs->setTypeIndex(true);
+				retval |= fs->available() != indexed;
+				retval |= tally(1) || count != 12 || sum != 282;
+				retval |= fs->verifyAll();
+
+				// a full store cannot take the TypeLinks, and is left as it was
+				retval |= fs->setTypeIndex(false);
+				FileStore32::InodeId_t id = 200;
+				while (!fs->write(id, big, sizeof(big), 1)) {
+					id++;
+				}
+				const auto full = fs->available();
+				retval |= fs->setTypeIndex(true) != 3;
+				retval |= fs->typeIndex();
+				retval |= fs->available() != full;
+				retval |= tally(1) || count != 12u + id - 200;
+				retval |= fs->verifyAll();
+
+				delete []buff;
+				return retval;
+			}
+		},
+		{
+			"FileSystem32::mkdir(full)",
+			[](string) {
+				int retval = 0;
+				const auto size = 1024 * 4;
+				auto buff = new uint8_t[size];
+				FileSystem32::format(buff, (FileStore32::FsSize_t) size, true);
+				auto fs = (FileSystem32*) createFileSystem(buff, size);
+
+				// a store that cannot grow runs out of room part way through
+				// adding directory entries
+				int made = 0;
+				while (made < 1000 && !fs->mkdir(("/dir" + to_string(made)).c_str())) {
+					made++;
+				}
+				retval |= made == 1000;
+				retval |= fs->write("/file", (void*) "data", 5) == 0 && made < 1000;
+
+				// every directory header still matches its entries
+				for (int i = -1; i < made; i++) {
+					auto path = i < 0 ? string("/") : "/dir" + to_string(i);
+					auto stat = fs->stat(path.c_str());
+					Directory<FileStore32::InodeId_t, FileStore32::FsSize_t> dir;
+					retval |= fs->read(stat.inode, 0, sizeof(dir), &dir, nullptr);
+					retval |= sizeof(dir) + dir.size != stat.size;
+					vector<DirectoryListing<string>> files;
+					fs->ls(path.c_str(), &files);
+					retval |= files.size() != dir.children;
+				}
+
+				delete fs;
+				delete []buff;
+				return retval;
+			}
+		},
+		{
+			"FileSystem::snapshot(foreign fault)",
+			[](string) {
+				int retval = 0;
+				auto path = "snapshotForeignFault.oxfs";
+				auto dataIn = "test string";
+				auto dataIn2 = "other string";
+				const auto size = 1024 * 64;
+				auto buff = new uint8_t[size];
+				char out[32];
+				FileSystem32::format(buff, (FileStore32::FsSize_t) size, true);
+				auto file = fopen(path, "wb");
+				retval |= !file || fwrite(buff, size, 1, file) != 1 || fclose(file);
+
+				// a handler of the process's own that recovers from faults
+				static sigjmp_buf recover;
+				static bool expected = false;
+				struct sigaction action;
+				ox_memset(&action, 0, sizeof(action));
+				action.sa_handler = [](int sig) {
+					if (expected) {
+						siglongjmp(recover, 1);
+					}
+					signal(sig, SIG_DFL);
+				};
+				sigemptyset(&action.sa_mask);
+				sigaction(SIGSEGV, &action, nullptr);
+				auto guard = (volatile uint8_t*) mmap(nullptr, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+				auto fs = mapFileSystem(path);
+				retval |= !fs;
+				if (fs) {
+					retval |= fs->write("/a.txt", (void*) dataIn, ox_strlen(dataIn) + 1);
+					auto snap1 = fs->snapshot();
+					retval |= !snap1;
+
+					// a fault that is not in a mapping reaches the handler
+					volatile bool recovered = false;
+					expected = true;
+					if (sigsetjmp(recover, 1)) {
+						recovered = true;
+					} else {
+						*guard = 1;
+					}
+					expected = false;
+					retval |= !recovered;
+					delete snap1;
+
+					// and later snapshots are still kept apart
+					auto snap2 = fs->snapshot();
+					retval |= !snap2;
+					retval |= fs->write("/a.txt", (void*) dataIn2, ox_strlen(dataIn2) + 1);
+					retval |= !snap2 || snap2->read("/a.txt", out, sizeof(out)) || ox_strcmp(out, dataIn) != 0;
+					retval |= fs->read("/a.txt", out, sizeof(out)) || ox_strcmp(out, dataIn2) != 0;
+					delete snap2;
+					delete fs;
+				}
+
+				munmap((void*) guard, 4096);
+				delete []buff;
+				remove(path);
+				return retval;
+			}
+		},
+		{
+			"FileSystem::snapshot(random)",
+			[](string) {
+				int retval = 0;
+				auto path = "snapshotRandom.oxfs";
+				const auto size = 1024 * 128;
+				auto buff = new uint8_t[size];
+				auto copy = new uint8_t[size];
+				FileStore32::format(buff, size, OxFS_32, FileStoreOption_Dedup | FileStoreOption_Slabs | FileStoreOption_TypeIndex);
+				auto file = fopen(path, "wb");
+				retval |= !file || fwrite(buff, size, 1, file) != 1 || fclose(file);
+
+				// whatever the file system does, its snapshots must keep every
+				// byte it held when they were taken
+				auto fs = mapFileSystem(path);
+				retval |= !fs;
+				srand(5);
+				for (int round = 0; fs && round < 10 && !retval; round++) {
+					ox_memcpy(copy, fs->buff(), size);
+					auto snap = fs->snapshot();
+					retval |= !snap;
+					for (int i = 0; i < 300; i++) {
+						const uint64_t id = 1000 + rand() % 60;
+						uint8_t data[2000];
+						ox_memset(data, 'a' + i % 26, sizeof(data));
+						switch (rand() % 5) {
+							case 0:
+							case 1:
+								fs->write(id, data, rand() % sizeof(data));
+								break;
+							case 2:
+								fs->remove(id);
+								break;
+							case 3:
+								fs->compactStep(rand() % 2000);
+								break;
+							case 4:
+								fs->incLinks(id);
+								break;
+						}
+					}
+					retval |= !snap || ox_memcmp(snap->buff(), copy, size) != 0;
+					delete snap;
+				}
+
+				delete fs;
+				delete []copy;
+				delete []buff;
+				remove(path);
+				return retval;
+			}
+		},
 	},
 };
 
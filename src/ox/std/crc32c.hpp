@@ -0,0 +1,24 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+
+#include "types.hpp"
+
+/**
+ * Computes the CRC32C (Castagnoli) of the given data, with the CPU's CRC32
+ * instruction where there is one.
+ * @param crc the CRC32C of the data that comes before this data, to compute
+ * the CRC32C of both together, or 0
+ */
+uint32_t ox_crc32c(const void *data, size_t len, uint32_t crc = 0);
+
+/**
+ * Computes the CRC32C of the given data a byte at a time from a table, as
+ * ox_crc32c does on CPUs without a CRC32 instruction.
+ */
+uint32_t ox_crc32cTable(const void *data, size_t len, uint32_t crc = 0);
@@ -0,0 +1,249 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "memops.hpp"
+#include "lz4.hpp"
+
+// 4 and 8 bytes that may be unaligned and may alias the bytes they are read
+// from
+typedef uint32_t __attribute__((may_alias, aligned(1))) Quad;
+typedef uint64_t __attribute__((may_alias, aligned(1))) Octet;
+
+const static int MinMatch = 4;
+// the last match must start at least this far from the end of the data
+const static size_t MatchFromEnd = 12;
+// and end at least this far from it
+const static size_t LiteralsAtEnd = 5;
+const static size_t MaxOffset = 65535;
+const static int HashLog = 12;
+
+static uint32_t hash(uint32_t quad) {
+	return (quad * 2654435761u) >> (32 - HashLog);
+}
+
+/**
+ * Copies len bytes 8 at a time, so it may write up to 7 bytes past dest + len
+ * and read up to 7 past src + len. Ranges that overlap must be at least 8
+ * bytes apart, with src first.
+ */
+static void wildCopy(uint8_t *dest, const uint8_t *src, size_t len) {
+	for (size_t i = 0; i < len; i += 8) {
+		*(Octet*) (dest + i) = *(const Octet*) (src + i);
+	}
+}
+
+/**
+ * Returns the number of bytes that a and b have in common from the start,
+ * stopping at aEnd.
+ */
+static size_t commonLength(const uint8_t *a, const uint8_t *b, const uint8_t *aEnd) {
+	size_t len = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (a + len + 8 <= aEnd) {
+		const auto diff = *(const Octet*) (a + len) ^ *(const Octet*) (b + len);
+		if (diff) {
+			// the lowest bits of the difference are from the first byte
+			return len + __builtin_ctzll(diff) / 8;
+		}
+		len += 8;
+	}
+#endif
+	while (a + len < aEnd && a[len] == b[len]) {
+		len++;
+	}
+	return len;
+}
+
+/**
+ * Writes a length that did not fit in its token nibble, as a run of 255s
+ * and the rest.
+ * @return the end of the length, or nullptr if it does not fit before end
+ */
+static uint8_t *writeLength(uint8_t *op, uint8_t *end, size_t len) {
+	for (; len >= 255; len -= 255) {
+		if (op == end) {
+			return nullptr;
+		}
+		*op++ = 255;
+	}
+	if (op == end) {
+		return nullptr;
+	}
+	*op++ = (uint8_t) len;
+	return op;
+}
+
+/**
+ * Writes a sequence, the given literals followed by a match, or just the
+ * literals if matchLen is 0.
+ * @return the end of the sequence, or nullptr if it does not fit before end
+ */
+static uint8_t *writeSequence(uint8_t *op, uint8_t *end, const uint8_t *literals, size_t litLen,
+                              size_t offset, size_t matchLen) {
+	if (op == end) {
+		return nullptr;
+	}
+	auto token = op++;
+	*token = (uint8_t) ((litLen < 15 ? litLen : 15) << 4);
+	if (litLen >= 15 && !(op = writeLength(op, end, litLen - 15))) {
+		return nullptr;
+	}
+	if ((size_t) (end - op) < litLen) {
+		return nullptr;
+	}
+	if (matchLen && (size_t) (end - op) >= litLen + 8) {
+		// literals before a match are followed by at least MatchFromEnd
+		// bytes of source, so they can be copied past their end
+		wildCopy(op, literals, litLen);
+	} else {
+		ox_memcpy(op, literals, litLen);
+	}
+	op += litLen;
+
+	if (matchLen) {
+		if (end - op < 2) {
+			return nullptr;
+		}
+		*op++ = (uint8_t) offset;
+		*op++ = (uint8_t) (offset >> 8);
+		matchLen -= MinMatch;
+		*token |= matchLen < 15 ? matchLen : 15;
+		if (matchLen >= 15 && !(op = writeLength(op, end, matchLen - 15))) {
+			return nullptr;
+		}
+	}
+	return op;
+}
+
+/**
+ * Reads a length that did not fit in its token nibble.
+ * @return false if the length runs past end
+ */
+static bool readLength(const uint8_t **ip, const uint8_t *end, size_t *len) {
+	uint8_t b;
+	do {
+		if (*ip == end) {
+			return false;
+		}
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+size_t ox_lz4Compress(const void *srcIn, size_t srcLen, void *destIn, size_t destLen) {
+	auto src = (const uint8_t*) srcIn;
+	auto op = (uint8_t*) destIn;
+	const auto opEnd = op + destLen;
+	const auto end = src + srcLen;
+	auto anchor = src;
+
+	if (srcLen > MatchFromEnd) {
+		// where in src the last sequence to hash each value was seen
+		uint32_t table[1 << HashLog];
+		ox_memset(table, 0, sizeof(table));
+		const auto matchLimit = end - LiteralsAtEnd;
+		const auto searchEnd = end - MatchFromEnd;
+		auto ip = src;
+		// searches since the last match, which speed up the scan of data that
+		// does not compress
+		size_t misses = 0;
+		while (ip < searchEnd) {
+			const auto quad = *(const Quad*) ip;
+			const auto h = hash(quad);
+			auto ref = src + table[h];
+			table[h] = (uint32_t) (ip - src);
+			if (ref >= ip || (size_t) (ip - ref) > MaxOffset || *(const Quad*) ref != quad) {
+				ip += 1 + (misses++ >> 6);
+				continue;
+			}
+			misses = 0;
+
+			// the match may have started before the hashed bytes
+			while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+				ip--;
+				ref--;
+			}
+			const size_t matchLen = MinMatch + commonLength(ip + MinMatch, ref + MinMatch, matchLimit);
+
+			op = writeSequence(op, opEnd, anchor, ip - anchor, ip - ref, matchLen);
+			if (!op) {
+				return 0;
+			}
+			ip += matchLen;
+			anchor = ip;
+			// the end of a match is a likely start of another
+			if (ip < searchEnd) {
+				table[hash(*(const Quad*) (ip - 2))] = (uint32_t) (ip - 2 - src);
+			}
+		}
+	}
+
+	op = writeSequence(op, opEnd, anchor, end - anchor, 0, 0);
+	return op ? op - (uint8_t*) destIn : 0;
+}
+
+int64_t ox_lz4Decompress(const void *srcIn, size_t srcLen, void *destIn, size_t destLen) {
+	auto ip = (const uint8_t*) srcIn;
+	const auto end = ip + srcLen;
+	const auto dest = (uint8_t*) destIn;
+	auto op = dest;
+	const auto opEnd = dest + destLen;
+
+	while (ip < end) {
+		const auto token = *ip++;
+		size_t litLen = token >> 4;
+		if (litLen == 15 && !readLength(&ip, end, &litLen)) {
+			return -1;
+		}
+		if (litLen > (size_t) (end - ip) || litLen > (size_t) (opEnd - op)) {
+			return -1;
+		}
+		if (litLen <= 16 && end - ip >= 16 && opEnd - op >= 16) {
+			// short runs are copied whole, past their ends, which later
+			// sequences overwrite
+			wildCopy(op, ip, 16);
+		} else {
+			ox_memcpy(op, ip, litLen);
+		}
+		op += litLen;
+		ip += litLen;
+		if (ip == end) {
+			// the last sequence has no match
+			break;
+		}
+
+		if (end - ip < 2) {
+			return -1;
+		}
+		const size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		size_t matchLen = token & 15;
+		if (matchLen == 15 && !readLength(&ip, end, &matchLen)) {
+			return -1;
+		}
+		matchLen += MinMatch;
+		if (!offset || offset > (size_t) (op - dest) || matchLen > (size_t) (opEnd - op)) {
+			return -1;
+		}
+		auto ref = op - offset;
+		if (offset >= 8 && (size_t) (opEnd - op) >= matchLen + 16) {
+			// like the literals, short matches are copied whole
+			wildCopy(op, ref, matchLen <= 16 ? 16 : matchLen);
+			op += matchLen;
+		} else if (offset >= matchLen) {
+			ox_memcpy(op, ref, matchLen);
+			op += matchLen;
+		} else {
+			// the match repeats bytes it is still producing
+			for (size_t i = 0; i < matchLen; i++) {
+				*op++ = *ref++;
+			}
+		}
+	}
+	return op - dest;
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+
+#include "types.hpp"
+
+/**
+ * Compresses the given data into an LZ4 block, the format of the LZ4 block
+ * API, favoring speed over ratio.
+ * @param dest where to put the block
+ * @param destLen the most bytes to put in dest
+ * @return the size of the block, or 0 if it does not fit in destLen bytes
+ */
+size_t ox_lz4Compress(const void *src, size_t srcLen, void *dest, size_t destLen);
+
+/**
+ * Decompresses an LZ4 block. Malformed blocks are rejected without reading
+ * or writing out of bounds.
+ * @param destLen the most bytes to put in dest
+ * @return the number of bytes put in dest, or -1 if the block is malformed
+ * or decompresses to more than destLen bytes
+ */
+int64_t ox_lz4Decompress(const void *src, size_t srcLen, void *dest, size_t destLen);
@@ -24,14 +24,44 @@ int ox_memcmp(const void *ptr1, const void *ptr2, size_t size) {
 }
 
 void *ox_memcpy(void *dest, const void *src, int64_t size) {
+	// a machine word that may alias the bytes it is copied from
+	typedef size_t __attribute__((may_alias)) Word;
+	const int64_t wordSize = sizeof(Word);
 	char *srcBuf = (char*) src;
 	char *dstBuf = (char*) dest;
-	for (int64_t i = 0; i < size; i++) {
+	int64_t i = 0;
+
+	// if the buffers line up, copy a word at a time once they are aligned
+	if (((size_t) srcBuf & (wordSize - 1)) == ((size_t) dstBuf & (wordSize - 1))) {
+		for (; i < size && ((size_t) (dstBuf + i) & (wordSize - 1)); i++) {
+			dstBuf[i] = (char) srcBuf[i];
+		}
+		for (; i + wordSize <= size; i += wordSize) {
+			*((Word*) (dstBuf + i)) = *((Word*) (srcBuf + i));
+		}
+	}
+
+	for (; i < size; i++) {
 		dstBuf[i] = (char) srcBuf[i];
 	}
 	return dest;
 }
 
+void *ox_memmove(void *dest, const void *src, int64_t size) {
+	char *srcBuf = (char*) src;
+	char *dstBuf = (char*) dest;
+	if (dstBuf < srcBuf) {
+		for (int64_t i = 0; i < size; i++) {
+			dstBuf[i] = (char) srcBuf[i];
+		}
+	} else {
+		for (int64_t i = size - 1; i >= 0; i--) {
+			dstBuf[i] = (char) srcBuf[i];
+		}
+	}
+	return dest;
+}
+
 void *ox_memset(void *ptr, int val, int64_t size) {
 	char *buf = (char*) ptr;
 	for (int64_t i = 0; i < size; i++) {
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "types.hpp"
+
+// without the std lib there is nothing to hand the CPU to
+#if defined(OX_USE_STDLIB) && defined(__has_include)
+#if __has_include(<sched.h>)
+#include <sched.h>
+#define OX_SCHED_YIELD
+#endif
+#endif
+
+namespace ox {
+
+/**
+ * Tells the CPU that the calling thread is spinning on another.
+ */
+inline void cpuRelax() {
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+/**
+ * Waits before a spinning thread tries again. The first few waits are short,
+ * after which the thread gives up the CPU, as whatever it waits on is likely
+ * held by a thread that is not running.
+ * @param spins the number of times the caller has waited so far, which this
+ * increments
+ */
+inline void backOff(int *spins) {
+	const int SpinLimit = 100;
+	if (*spins < SpinLimit) {
+		(*spins)++;
+		cpuRelax();
+	} else {
+#ifdef OX_SCHED_YIELD
+		sched_yield();
+#else
+		cpuRelax();
+#endif
+	}
+}
+
+/**
+ * A reader-writer spin lock, which any number of readers can hold at once.
+ * A writer waiting for it keeps new readers out, so a steady stream of reads
+ * cannot starve writers. Waiters spin briefly and then yield. It is not
+ * recursive.
+ */
+class RwLock {
+
+	private:
+		const static uint32_t Writer = 0x80000000;
+		// the number of readers holding the lock, with Writer set while a
+		// writer holds or waits for it
+		uint32_t m_state = 0;
+
+	public:
+		void lockShared() {
+			int spins = 0;
+			for (;;) {
+				auto state = __atomic_load_n(&m_state, __ATOMIC_RELAXED);
+				if (!(state & Writer) &&
+				    __atomic_compare_exchange_n(&m_state, &state, state + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+					return;
+				}
+				backOff(&spins);
+			}
+		}
+
+		void unlockShared() {
+			__atomic_fetch_sub(&m_state, 1, __ATOMIC_RELEASE);
+		}
+
+		void lock() {
+			int spins = 0;
+			for (;;) {
+				auto state = __atomic_load_n(&m_state, __ATOMIC_RELAXED);
+				if (!(state & Writer) &&
+				    __atomic_compare_exchange_n(&m_state, &state, state | Writer, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+					break;
+				}
+				backOff(&spins);
+			}
+			// wait for the readers that got in first
+			while (__atomic_load_n(&m_state, __ATOMIC_ACQUIRE) != Writer) {
+				backOff(&spins);
+			}
+		}
+
+		void unlock() {
+			__atomic_store_n(&m_state, 0, __ATOMIC_RELEASE);
+		}
+};
+
+/**
+ * Holds a RwLock shared for as long as it exists.
+ */
+class SharedLock {
+
+	private:
+		RwLock *m_lock;
+
+	public:
+		explicit SharedLock(RwLock *lock) {
+			m_lock = lock;
+			m_lock->lockShared();
+		}
+
+		~SharedLock() {
+			m_lock->unlockShared();
+		}
+};
+
+/**
+ * Holds a RwLock exclusively for as long as it exists.
+ */
+class ExclusiveLock {
+
+	private:
+		RwLock *m_lock;
+
+	public:
+		explicit ExclusiveLock(RwLock *lock) {
+			m_lock = lock;
+			m_lock->lock();
+		}
+
+		~ExclusiveLock() {
+			m_lock->unlock();
+		}
+};
+
+}
@@ -9,8 +9,12 @@
 
 #include "bitops.hpp"
 #include "byteswap.hpp"
+#include "crc32c.hpp"
+#include "lz4.hpp"
 #include "memops.hpp"
 #include "random.hpp"
+#include "rwlock.hpp"
 #include "strops.hpp"
 #include "string.hpp"
 #include "types.hpp"
+#include "xxhash.hpp"
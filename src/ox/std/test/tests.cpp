@@ -8,6 +8,8 @@
 #include <iostream>
 #include <map>
 #include <functional>
+#include <string>
+#include <vector>
 #include <ox/std/std.hpp>
 
 using namespace std;
@@ -37,6 +39,128 @@ map<string, function<int()>> tests = {
 			return !(ox_memcmp("ABCDEFGHI", "ABCDEFG", 7) == 0);
 		}
 	},
+	{
+		"ox_memcpy alignments",
+		[]() {
+			int retval = 0;
+			uint8_t src[100];
+			for (int i = 0; i < 100; i++) {
+				src[i] = i;
+			}
+			for (int srcOff = 0; srcOff < 8; srcOff++) {
+				for (int destOff = 0; destOff < 8; destOff++) {
+					for (int len = 0; len < 80; len++) {
+						uint8_t dest[100] = {};
+						ox_memcpy(dest + destOff, src + srcOff, len);
+						retval |= ox_memcmp(dest + destOff, src + srcOff, len) != 0;
+						retval |= destOff + len < 100 && dest[destOff + len] != 0;
+					}
+				}
+			}
+			return retval;
+		}
+	},
+	{
+		"ox_crc32c",
+		[]() {
+			int retval = 0;
+			retval |= ox_crc32c("123456789", 9) != 0xe3069283;
+			retval |= ox_crc32cTable("123456789", 9) != 0xe3069283;
+			retval |= ox_crc32c("", 0) != 0;
+			uint8_t data[100];
+			for (int i = 0; i < 100; i++) {
+				data[i] = i * 7;
+			}
+			// the instruction and the table agree at any alignment, and
+			// CRCs can be continued
+			for (int off = 0; off < 8; off++) {
+				for (int len = 0; len + off <= 100; len++) {
+					auto crc = ox_crc32cTable(data + off, len);
+					retval |= ox_crc32c(data + off, len) != crc;
+					retval |= ox_crc32c(data + off + len / 3, len - len / 3, ox_crc32c(data + off, len / 3)) != crc;
+				}
+			}
+			return retval;
+		}
+	},
+	{
+		"ox_lz4",
+		[]() {
+			int retval = 0;
+			uint8_t out[20000];
+			uint8_t block[20000];
+
+			// a block as the LZ4 reference implementation lays it out
+			const uint8_t ref[] = {0x35, 'a', 'b', 'c', 3, 0, 0x50, 'x', 'y', 'z', 'z', 'y'};
+			retval |= ox_lz4Decompress(ref, sizeof(ref), out, sizeof(out)) != 17;
+			retval |= ox_memcmp(out, "abcabcabcabcxyzzy", 17) != 0;
+			// too little room, a match before the start, a cut off block
+			retval |= ox_lz4Decompress(ref, sizeof(ref), out, 16) != -1;
+			const uint8_t early[] = {0x15, 'a', 4, 0, 0x50, 'x', 'y', 'z', 'z', 'y'};
+			retval |= ox_lz4Decompress(early, sizeof(early), out, sizeof(out)) != -1;
+			retval |= ox_lz4Decompress(ref, 5, out, sizeof(out)) != -1;
+
+			string text;
+			while (text.size() < 10000) {
+				text += "the quick brown fox jumps over the lazy dog " + to_string(text.size() % 97) + "\n";
+			}
+			uint8_t noise[10000];
+			uint64_t x = 88172645463325252ull;
+			for (auto &b : noise) {
+				x ^= x << 13;
+				x ^= x >> 7;
+				x ^= x << 17;
+				b = (uint8_t) x;
+			}
+			vector<pair<const uint8_t*, size_t>> inputs = {
+				{(const uint8_t*) text.data(), text.size()},
+				{noise, sizeof(noise)},
+			};
+			for (size_t len = 0; len < 40; len++) {
+				inputs.push_back({(const uint8_t*) text.data(), len});
+				inputs.push_back({noise, len});
+			}
+			for (auto &in : inputs) {
+				auto len = ox_lz4Compress(in.first, in.second, block, sizeof(block));
+				retval |= len == 0;
+				retval |= ox_lz4Decompress(block, len, out, sizeof(out)) != (int64_t) in.second;
+				retval |= ox_memcmp(out, in.first, in.second) != 0;
+			}
+			auto len = ox_lz4Compress(text.data(), text.size(), block, sizeof(block));
+			retval |= len > text.size() / 3;
+			// blocks that do not fit are not made
+			retval |= ox_lz4Compress(noise, sizeof(noise), block, sizeof(noise)) != 0;
+			return retval;
+		}
+	},
+	{
+		"ox_xxh64",
+		[]() {
+			int retval = 0;
+			// hashes from the xxHash reference implementation
+			retval |= ox_xxh64("", 0) != 0xef46db3751d8e999ull;
+			retval |= ox_xxh64("abc", 3) != 0x44bc2cf5ad770999ull;
+			retval |= ox_xxh64("", 0, 1) == ox_xxh64("", 0);
+			uint8_t data[100];
+			for (int i = 0; i < 100; i++) {
+				data[i] = i * 7;
+			}
+			// the hash does not depend on alignment, and any changed byte
+			// changes it
+			for (int len = 0; len <= 90; len++) {
+				auto h = ox_xxh64(data, len);
+				uint8_t moved[100];
+				ox_memcpy(moved + 3, data, len);
+				retval |= ox_xxh64(moved + 3, len) != h;
+				for (int i = 0; i < len; i++) {
+					moved[3 + i] ^= 1;
+					retval |= ox_xxh64(moved + 3, len) == h;
+					moved[3 + i] ^= 1;
+				}
+			}
+			return retval;
+		}
+	},
 };
 
 int main(int argc, const char **args) {
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "bitops.hpp"
+#include "byteswap.hpp"
+#include "xxhash.hpp"
+
+// 4 and 8 bytes that may be unaligned and may alias the bytes they are read
+// from
+typedef uint32_t __attribute__((may_alias, aligned(1))) Quad;
+typedef uint64_t __attribute__((may_alias, aligned(1))) Octet;
+
+const static uint64_t Prime1 = 11400714785074694791ull;
+const static uint64_t Prime2 = 14029467366897019727ull;
+const static uint64_t Prime3 = 1609587929392839161ull;
+const static uint64_t Prime4 = 9650029242287828579ull;
+const static uint64_t Prime5 = 2870177450012600261ull;
+
+// XXH64 reads its input as little endian
+static uint64_t read64(const uint8_t *p) {
+	return ox::bigEndianAdapt((uint64_t) *(const Octet*) p);
+}
+
+static uint32_t read32(const uint8_t *p) {
+	return ox::bigEndianAdapt((uint32_t) *(const Quad*) p);
+}
+
+static uint64_t lane(uint64_t acc, uint64_t input) {
+	acc += input * Prime2;
+	acc = ox::rotateLeft(acc, 31);
+	return acc * Prime1;
+}
+
+static uint64_t mergeLane(uint64_t acc, uint64_t val) {
+	acc ^= lane(0, val);
+	return acc * Prime1 + Prime4;
+}
+
+uint64_t ox_xxh64(const void *data, size_t len, uint64_t seed) {
+	auto p = (const uint8_t*) data;
+	auto end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		// four lanes over 32 byte stripes
+		uint64_t v1 = seed + Prime1 + Prime2;
+		uint64_t v2 = seed + Prime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - Prime1;
+		for (auto limit = end - 32; p <= limit; p += 32) {
+			v1 = lane(v1, read64(p));
+			v2 = lane(v2, read64(p + 8));
+			v3 = lane(v3, read64(p + 16));
+			v4 = lane(v4, read64(p + 24));
+		}
+		h = ox::rotateLeft(v1, 1) + ox::rotateLeft(v2, 7) + ox::rotateLeft(v3, 12) + ox::rotateLeft(v4, 18);
+		h = mergeLane(h, v1);
+		h = mergeLane(h, v2);
+		h = mergeLane(h, v3);
+		h = mergeLane(h, v4);
+	} else {
+		h = seed + Prime5;
+	}
+	h += len;
+
+	// the tail
+	for (; end - p >= 8; p += 8) {
+		h ^= lane(0, read64(p));
+		h = ox::rotateLeft(h, 27) * Prime1 + Prime4;
+	}
+	if (end - p >= 4) {
+		h ^= read32(p) * Prime1;
+		h = ox::rotateLeft(h, 23) * Prime2 + Prime3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= *p * Prime5;
+		h = ox::rotateLeft(h, 11) * Prime1;
+	}
+
+	// avalanche
+	h ^= h >> 33;
+	h *= Prime2;
+	h ^= h >> 29;
+	h *= Prime3;
+	h ^= h >> 32;
+	return h;
+}
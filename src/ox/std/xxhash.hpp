@@ -0,0 +1,17 @@
+/*
+ * Copyright 2015 - 2017 gtalent2@gmail.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+
+#include "types.hpp"
+
+/**
+ * Computes the 64 bit xxHash (XXH64) of the given data. It is a fast hash for
+ * telling data apart, not a cryptographic one.
+ * @param seed changes the hash of every input, 0 for the standard XXH64
+ */
+uint64_t ox_xxh64(const void *data, size_t len, uint64_t seed = 0);